@@ -12,6 +12,80 @@
 
 #include "supercard_driver.h"
 
+#ifdef IOTRACE_ENABLED
+/*-----------------------------------------------------------------------*/
+/* I/O trace recorder (see iotrace.h)                                    */
+/*-----------------------------------------------------------------------*/
+
+#include "gbahw.h"
+#include "iotrace.h"
+
+static t_iotrace_rec iotrace_ring[IOTRACE_ENTRIES];
+static uint32_t iotrace_total;    /* Records ever produced (ring head) */
+static bool iotrace_paused;
+
+void iotrace_reset() {
+  iotrace_total = 0;
+}
+
+void iotrace_init() {
+  iotrace_reset();
+  timer_cycles_start();
+}
+
+static void iotrace_record(uint8_t op, uint8_t arg, LBA_t sector, UINT count, uint32_t start) {
+  if (iotrace_paused)
+    return;
+  t_iotrace_rec *r = &iotrace_ring[iotrace_total++ & (IOTRACE_ENTRIES - 1)];
+  r->timestamp = start;
+  r->duration = timer_cycles_read() - start;
+  r->sector = sector;
+  r->count = count;
+  r->op = op;
+  r->arg = arg;
+}
+
+bool iotrace_dump(const char *fn) {
+  FIL fd;
+  UINT wrbytes;
+  bool ret = false;
+  iotrace_paused = true;     /* Do not trace our own writes */
+
+  uint32_t cnt = iotrace_total < IOTRACE_ENTRIES ? iotrace_total : IOTRACE_ENTRIES;
+  uint32_t first = iotrace_total - cnt;
+  t_iotrace_hdr hdr = {
+    .magic = IOTRACE_MAGIC,
+    .version = IOTRACE_VERSION,
+    .recsize = sizeof(t_iotrace_rec),
+    .count = cnt,
+    .dropped = first,
+    .timer_freq = 1 << 24,
+  };
+
+  if (FR_OK == f_open(&fd, fn, FA_WRITE | FA_CREATE_ALWAYS)) {
+    /* Write the ring oldest first, in (at most) two chunks. */
+    uint32_t head = first & (IOTRACE_ENTRIES - 1);
+    uint32_t cnt1 = cnt < IOTRACE_ENTRIES - head ? cnt : IOTRACE_ENTRIES - head;
+    ret = FR_OK == f_write(&fd, &hdr, sizeof(hdr), &wrbytes) && wrbytes == sizeof(hdr) &&
+          FR_OK == f_write(&fd, &iotrace_ring[head], cnt1 * sizeof(t_iotrace_rec), &wrbytes) &&
+          FR_OK == f_write(&fd, &iotrace_ring[0], (cnt - cnt1) * sizeof(t_iotrace_rec), &wrbytes);
+    ret = (FR_OK == f_close(&fd)) && ret;
+  }
+
+  iotrace_paused = false;
+  return ret;
+}
+
+#define IOTRACE_START()                    uint32_t iot_start = timer_cycles_read()
+#define IOTRACE_END(op, arg, sector, cnt)  iotrace_record(op, arg, sector, cnt, iot_start)
+
+#else
+
+#define IOTRACE_START()
+#define IOTRACE_END(op, arg, sector, cnt)
+
+#endif
+
 DSTATUS disk_status (BYTE pdrv) {
   return 0;
 }
@@ -32,7 +106,9 @@ DRESULT disk_read (
 	UINT count		/* Number of sectors to read */
 )
 {
+  IOTRACE_START();
   unsigned err = sdcard_read_blocks(buff, sector, count);
+  IOTRACE_END(IOTRACE_OP_READ, err ? IOTRACE_ARG_ERROR : 0, sector, count);
   return err ? RES_ERROR : RES_OK;
 }
 
@@ -50,7 +126,9 @@ DRESULT disk_write (
 	UINT count			/* Number of sectors to write */
 )
 {
+  IOTRACE_START();
   unsigned err = sdcard_write_blocks(buff, sector, count);
+  IOTRACE_END(IOTRACE_OP_WRITE, err ? IOTRACE_ARG_ERROR : 0, sector, count);
   return err ? RES_ERROR : RES_OK;
 }
 
@@ -62,6 +140,8 @@ DRESULT disk_ioctl (
 	void *buff		/* Buffer to send/receive control data */
 )
 {
+  IOTRACE_START();
+  IOTRACE_END(IOTRACE_OP_IOCTL, cmd, 0, 0);
   switch (cmd) {
   case CTRL_SYNC:
   case CTRL_TRIM:
@@ -22,6 +22,7 @@
 #include <string.h>
 #include "ff.h"			/* Declarations of FatFs API */
 #include "diskio.h"		/* Declarations of device I/O functions */
+#include "profiler.h"
 
 
 /*--------------------------------------------------------------------------
@@ -3925,6 +3926,7 @@ FRESULT f_read (
 	FSIZE_t remain;
 	UINT rcnt, cc, csect;
 	BYTE *rbuff = (BYTE*)buff;
+	PROF_SCOPE(PROF_F_READ);
 
 
 	*br = 0;	/* Clear read byte counter */
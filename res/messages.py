@@ -62,7 +62,7 @@ en_strings = {
   "MSG_TOOLS0_SDRAM": "SDRAM memory test",
   "MSG_TOOLS1_SRAM":  "SRAM memory test",
   "MSG_TOOLS2_BAT":   "SRAM battery test",
-  "MSG_TOOLS3_BENCH": "SD (read) benchmark",
+  "MSG_TOOLS3_BENCH": "SD benchmark",
   "MSG_TOOLS4_FBAK":  "Flash backup",
 
   "MSG_TOOLS_RUN": "Run",
@@ -214,10 +214,11 @@ en_strings = {
   "MSG_ERR_UNKTYP":  "Unknown file type!",                 # alertmsg
 
   "MSG_BAD_SDRAM": "SDRAM (ROM storage) error!",           # alertmsg
+  "MSG_SDRAMFAIL": "%s Lines %x, banks %x",               # alertmsg
   "MSG_BAD_SRAM":  "SRAM test error!",                     # alertmsg
   "MSG_GOOD_RAM":  "All memory tests passed!",             # alertmsg
 
-  "MSG_BENCHSPD":  "Speed: %u KiB/s",
+  "MSG_BENCHRES":  "Read %u KiB/s, write %u KiB/s",
   "MSG_CAPACITY":  "Capacity: %s",
   "MSG_DBPINFO":   "Patch database version info",
 
@@ -41,14 +41,25 @@
 #define GBC_EMULATOR_PATH         "/.superfw/emulators/gbc-emu.gba"
 #define SETTINGS_FILEPATH         "/.superfw/settings.txt"
 #define RECENT_FILEPATH           "/.superfw/recent.txt"
+#define RECENT_JOURNAL_FILEPATH   "/.superfw/recent.jnl"
 #define UISETTINGS_FILEPATH       "/.superfw/ui-settings.txt"
 #define FLASHBACKUPTMP_FILEPATH   "/.superfw/flash_backup.tmp"
 #define FLASHBACKUP_FILEPTRN      "/.superfw/flash_backup-%02x%02x%02x%02x.bin"
+#define SDBENCH_FILEPATH          "/.superfw/bench.txt"
+#define SDBENCH_TMPFILE           "/.superfw/bench.tmp"
+#define PROFILE_FILEPATH          "/.superfw/profile.txt"
+#define IOTRACE_FILEPATH          "/.superfw/iotrace.bin"
+#define USRPATCHDB_FILEPATH       "/.superfw/user-patches.db"
+#define USRPATCHDBTMP_FILEPATH    "/.superfw/user-patches.tmp"
+#define USRPATCHDBBAK_FILEPATH    "/.superfw/user-patches.bak"
+#define GAMEDB_FILEPATH           "/.superfw/gamedb.bin"
+#define BOOTSTATE_FILEPATH        "/.superfw/bootstate.bin"
 
 #define PENDING_SAVE_FILEPATH     "/.superfw/pending-save.txt"
 #define PENDING_SRAM_TEST         "/.superfw/pending-sram-test.txt"
 
 extern uint8_t dldi_payload[];
+extern uint8_t dldi_payload_fast[];
 
 // In-game menu requires ~1MB of free space. Lives in the last MB of ROM.
 #define GBA_ROM_BASE              0x08000000
@@ -61,6 +72,8 @@ extern uint8_t dldi_payload[];
 #define ROM_OFF_SCRATCH           0x00000000     // At 0x08000000
 #define ROM_OFF_FONTS_BASE        0x00F00000     // At 0x08F00000
 #define ROM_OFF_HISCRATCH         0x01000000     // At 0x09000000
+#define ROM_OFF_ASSETCACHE        0x01800000     // At 0x09800000 (after hiscratch)
+#define ROM_OFF_EMUCACHE          0x01A00000     // At 0x09A00000 (resident emulators)
 #define ROM_OFF_USRPATCH_DB       0x01C00000     // At 0x09C00000
 #define ROM_OFF_PATCH_DB          0x01D00000     // At 0x09D00000
 #define ROM_OFF_ASSETS_BASE       0x01E00000     // At 0x09E00000
@@ -69,7 +82,13 @@ extern uint8_t dldi_payload[];
 #define ROM_FONTBASE_U8         ((volatile uint8_t*)(0x08000000 + ROM_OFF_FONTS_BASE))
 #define ROM_HISCRATCH_U8        ((volatile uint8_t*)(0x08000000 + ROM_OFF_HISCRATCH))
 #define ROM_PATCHDB_U8          ((volatile uint8_t*)(0x08000000 + ROM_OFF_PATCH_DB))
+#define ROM_USRPATCHDB_U8       ((volatile uint8_t*)(0x08000000 + ROM_OFF_USRPATCH_DB))
 #define ROM_ASSETS_U8           ((volatile uint8_t*)(0x08000000 + ROM_OFF_ASSETS_BASE))
+#define ROM_ASSETCACHE_U8       ((volatile uint8_t*)(0x08000000 + ROM_OFF_ASSETCACHE))
+#define ROM_EMUCACHE_U8         ((volatile uint8_t*)(0x08000000 + ROM_OFF_EMUCACHE))
+#define ASSETCACHE_SIZE         (ROM_OFF_EMUCACHE - ROM_OFF_ASSETCACHE)
+#define EMUCACHE_SIZE           (ROM_OFF_USRPATCH_DB - ROM_OFF_EMUCACHE)
+#define USRPATCHDB_SIZE         (ROM_OFF_PATCH_DB - ROM_OFF_USRPATCH_DB)
 
 #define SUPERFW_COMMENT_DOFFSET         (0xF0 - 0xC0)   // Offset within the ROM header!
 
@@ -160,6 +179,7 @@ unsigned apunpack16(const uint8_t *src, uint8_t *dst);
 // Some info/misc stuff
 typedef struct {
   uint32_t patch_count;
+  uint32_t usr_patch_count;     // User DB (on the SD card)
   char version[9];
   char date[9];
   char creator[33];
@@ -194,6 +214,7 @@ void menu_init(int);    // Initializes meny system (ie. loading resources)
 void menu_render(unsigned fcnt);     // Renders the menu to the backframe
 void menu_keypress(unsigned newkeys);   // Notifies key press
 void menu_flip();       // Swaps front and back buffer to show the last rendered frame.
+void menu_idle();       // Runs background work (ie. prefetching) during idle time.
 
 // Patching system
 typedef enum {
@@ -256,11 +277,12 @@ bool validate_gb_header(const uint8_t *header);
 #define ERR_NDS_BAD_ADDRS      0x3
 #define ERR_NDS_BAD_ENTRYP     0x4
 #define ERR_NDS_BADHEADER      0x5
-unsigned load_nds(const char *filename, const void *dldi_driver);
+unsigned load_nds(const char *filename, const void *dldi_driver, const void *dldi_driver_fast);
 
 // Asset management
 const void *get_vfile_ptr(const char *fname);
 int get_vfile_size(const char *fname);
+const void *get_vfile_unpacked(const char *fname, unsigned *size);
 
 // RTC patches
 extern uint16_t patch_rtc_probe[];
@@ -328,12 +350,10 @@ uint32_t flash_identify();
 
 // Test/validation stuff
 int sram_test();
-int sdram_test(progress_abort_fn progcb);
 void sram_pseudo_fill();
 unsigned sram_pseudo_check();
 int check_peding_sram_test();
 void program_sram_check();
-int sdbench_read(progress_abort_fn progcb);
 
 #endif
 
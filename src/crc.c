@@ -125,6 +125,26 @@ static const uint16_t crc16_lut[256] = {
   0x6e17,0x7e36,0x4e55,0x5e74,0x2e93,0x3eb2,0x0ed1,0x1ef0
 };
 
+// Regular CRC32 (IEEE, reflected 0xEDB88320 poly), can be computed in several
+// steps by passing the previous return value (zero to start). Uses a nibble
+// LUT, which is good enough for small files.
+static const uint32_t crc32_lut[16] = {
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+  0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+  0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, unsigned size) {
+  crc = ~crc;
+  for (unsigned i = 0; i < size; i++) {
+    crc ^= *buf++;
+    crc = (crc >> 4) ^ crc32_lut[crc & 0xF];
+    crc = (crc >> 4) ^ crc32_lut[crc & 0xF];
+  }
+  return ~crc;
+}
+
 // This is the regular CRC16 (0x8005 poly) but in reverse (0xA001)
 uint16_t ds_crc16(const uint8_t *buf, unsigned size) {
   uint16_t ret = 0xFFFF;
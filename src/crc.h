@@ -24,6 +24,7 @@
 // CRC routines
 uint8_t crc7(const uint8_t *buf, unsigned size);
 uint16_t ds_crc16(const uint8_t *buf, unsigned size);
+uint32_t crc32_update(uint32_t crc, const uint8_t *buf, unsigned size);
 uint8_t crc7_nolut(const uint8_t *buf, unsigned size);
 void crc16_nibble_512(const uint8_t *buf, uint8_t *crcout);
 void crc16_nibble_512_nolut(const uint8_t *buf, uint8_t *crcout);
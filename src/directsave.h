@@ -20,6 +20,14 @@
 // This  This is used to load and patch the menu with the required values.
 // This header is used both by gcc and as!
 
+// Flash read cache: direct mapped, one 512 byte SD block per line. The cache
+// area starts with a tag word per line (block number or ~0 if invalid),
+// followed by the line data. Only allocated if there's enough ROM space.
+#define DIRSAVE_CACHE_LINES       32
+#define DIRSAVE_CACHE_SPACE       (17*1024)    // Tags + lines, rounded up
+
+#ifndef __ASSEMBLER__
+
 typedef struct {
   uint32_t entrypoint;                 // ARM entrypoint for the requested function
   uint32_t base_sector;                // Sector number where the contiguous save file lives.
@@ -27,11 +35,14 @@ typedef struct {
   uint32_t sd_mutex;                   // Mutex value (set to one when DS is using the SD card)
   uint32_t drv_issdhc;                 // Boolean (is SDHC card)
   uint32_t drv_rca;                    // SD card RCA id
+  uint32_t cache_base;                 // Flash read cache address (zero if disabled)
 } t_dirsave_header;
 
 // Built-in assets
 extern const uint8_t directsave_payload[];
 extern const uint32_t directsave_payload_size;
 
+#endif
+
 #define SD_MUTEX_OFFSET    (3*4)
 
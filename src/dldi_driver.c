@@ -28,17 +28,77 @@
 
 #define REG_EXMEMCNT     (*((volatile uint16_t*)0x04000204))
 
+// Reads are served from a multi-block read stream that is kept open across
+// calls, so that sequential reads (even tiny ones) do not pay for a full
+// CMD18/CMD12 sequence every time. The speed variant (DLDI_READ_AHEAD) also
+// prefetches a few sectors on small sequential reads.
+
+#define DLDI_RA_SECTORS     8            // Read-ahead buffer size (4KiB)
+
+static bool stream_open;                 // A multi-block read is in progress
+static uint32_t stream_next;             // Next sector in the stream
+
+#ifdef DLDI_READ_AHEAD
+static uint32_t ra_buffer[DLDI_RA_SECTORS * 512 / 4];
+static uint32_t ra_sector;               // First buffered sector
+static unsigned ra_count, ra_offset;     // Buffered and consumed sector count
+#endif
+
 static void supercard_prepare(bool enable_sd) {
   REG_EXMEMCNT &= ~0x80;    // ARM9 has access rights, does nothing on ARM7.
   // Enable/Disable SD card interface.
   set_supercard_mode(MAPPED_SDRAM, true, enable_sd);
 }
 
+static void stream_close() {
+  if (stream_open)
+    sdcard_read_stream_close();
+  stream_open = false;
+}
+
+// Reads sectors via the stream, (re)opening it if the read is not sequential.
+static bool stream_read(uint32_t sector, uint32_t num_sectors, uint8_t *buffer) {
+  if (stream_open && stream_next != sector)
+    stream_close();
+
+  if (!stream_open) {
+    if (sdcard_read_stream_open(sector))
+      return false;
+    stream_open = true;
+    stream_next = sector;
+  }
+
+  if (sdcard_read_stream(buffer, num_sectors)) {
+    stream_close();
+    return false;
+  }
+  stream_next += num_sectors;
+  return true;
+}
+
+#ifdef DLDI_READ_AHEAD
+static void copy_sector(uint8_t *dst, const uint32_t *src) {
+  if ((uintptr_t)dst & 3) {
+    const uint8_t *src8 = (const uint8_t*)src;
+    for (unsigned i = 0; i < 512; i++)
+      dst[i] = src8[i];
+  } else {
+    uint32_t *dst32 = (uint32_t*)dst;
+    for (unsigned i = 0; i < 512/4; i++)
+      dst32[i] = src[i];
+  }
+}
+#endif
+
 bool dldi_startup() {
   supercard_prepare(true);
 
   // Initialize the SD card from scratch.
   unsigned errc = sdcard_init(NULL);
+  stream_open = false;
+  #ifdef DLDI_READ_AHEAD
+  ra_count = 0;
+  #endif
 
   supercard_prepare(false);
   return !errc;
@@ -51,15 +111,42 @@ bool dldi_inserted() {
 bool dldi_readsectors(uint32_t sector, uint32_t num_sectors, uint8_t *buffer) {
   supercard_prepare(true);
 
-  unsigned errc = sdcard_read_blocks(buffer, sector, num_sectors);
+  #ifdef DLDI_READ_AHEAD
+  // Serve sectors from the read-ahead buffer first.
+  while (num_sectors && ra_offset < ra_count && sector == ra_sector + ra_offset) {
+    copy_sector(buffer, &ra_buffer[ra_offset * 512 / 4]);
+    ra_offset++;
+    sector++;
+    num_sectors--;
+    buffer += 512;
+  }
+  bool sequential = stream_open && stream_next == sector;
+  #endif
+
+  bool ok = !num_sectors || stream_read(sector, num_sectors, buffer);
+
+  #ifdef DLDI_READ_AHEAD
+  // Small sequential reads, prefetch the next few sectors.
+  if (ok && num_sectors && sequential && num_sectors < DLDI_RA_SECTORS) {
+    ra_sector = stream_next;
+    ra_offset = 0;
+    ra_count = stream_read(ra_sector, DLDI_RA_SECTORS, (uint8_t*)ra_buffer) ? DLDI_RA_SECTORS : 0;
+  }
+  #endif
 
   supercard_prepare(false);
-  return !errc;
+  return ok;
 }
 
 bool dldi_writesectors(uint32_t sector, uint32_t num_sectors, const void *buffer) {
   supercard_prepare(true);
 
+  // Writing requires the card to be idle, also drop any (stale) read-ahead data.
+  stream_close();
+  #ifdef DLDI_READ_AHEAD
+  ra_count = 0;
+  #endif
+
   unsigned errc = sdcard_write_blocks(buffer, sector, num_sectors);
 
   supercard_prepare(false);
@@ -67,10 +154,16 @@ bool dldi_writesectors(uint32_t sector, uint32_t num_sectors, const void *buffer
 }
 
 bool dldi_clearstatus() {
+  supercard_prepare(true);
+  stream_close();
+  supercard_prepare(false);
   return true;
 }
 
 bool dldi_shutdown() {
+  supercard_prepare(true);
+  stream_close();
+  supercard_prepare(false);
   return true;
 }
 
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "common.h"
+#include "gamedb.h"
+#include "fatfs/ff.h"
+
+// The DB file is a fixed size hash table, one sector per bucket.
+#define ENTRIES_PER_BUCKET    (512 / sizeof(t_gamedb_entry))
+#define GAMEDB_FILESIZE       (GAMEDB_BUCKETS * 512)
+
+#define CFG_USE_DSAVING       0x01
+#define CFG_USE_IGM           0x02
+#define CFG_USE_CHEATS        0x04
+#define CFG_USE_RTC           0x08
+
+// FNV-1a hash (zero is reserved for empty slots)
+uint32_t gamedb_hash(const char *s) {
+  uint32_t h = 0x811C9DC5;
+  while (*s)
+    h = (h ^ (uint8_t)*s++) * 0x01000193;
+  return h ? h : 1;
+}
+
+static bool gamedb_entry_valid(const t_gamedb_entry *ent, const t_rom_header *romh, uint32_t romsize) {
+  return ent->dbversion == GAMEDB_VERSION &&
+         ent->romsize == romsize &&
+         ent->gversion == romh->version &&
+         !memcmp(ent->gcode, romh->gcode, sizeof(ent->gcode));
+}
+
+// Reads the bucket where the hash lives, returns the file open (if requested).
+static bool gamedb_read_bucket(FIL *fd, uint32_t hash, t_gamedb_entry *bucket, bool write) {
+  if (FR_OK != f_open(fd, GAMEDB_FILEPATH, write ? FA_READ | FA_WRITE : FA_READ))
+    return false;
+
+  UINT rdbytes;
+  if (f_size(fd) != GAMEDB_FILESIZE ||
+      FR_OK != f_lseek(fd, (hash % GAMEDB_BUCKETS) * 512) ||
+      FR_OK != f_read(fd, bucket, 512, &rdbytes) || rdbytes != 512) {
+    f_close(fd);
+    return false;
+  }
+  return true;
+}
+
+static bool gamedb_write_bucket(FIL *fd, uint32_t hash, const t_gamedb_entry *bucket) {
+  UINT wrbytes;
+  bool ok = FR_OK == f_lseek(fd, (hash % GAMEDB_BUCKETS) * 512) &&
+            FR_OK == f_write(fd, bucket, 512, &wrbytes) && wrbytes == 512;
+  return (FR_OK == f_close(fd)) && ok;
+}
+
+// Creates an empty DB file (also used to drop an outdated/corrupted one).
+static bool gamedb_create() {
+  f_mkdir(SUPERFW_DIR);
+
+  FIL fd;
+  if (FR_OK != f_open(&fd, GAMEDB_FILEPATH, FA_WRITE | FA_CREATE_ALWAYS))
+    return false;
+
+  uint32_t zero[512/4];
+  memset(zero, 0, sizeof(zero));
+  bool ok = true;
+  for (unsigned i = 0; i < GAMEDB_BUCKETS && ok; i++) {
+    UINT wrbytes;
+    ok = FR_OK == f_write(&fd, zero, sizeof(zero), &wrbytes) && wrbytes == sizeof(zero);
+  }
+
+  return (FR_OK == f_close(&fd)) && ok;
+}
+
+bool gamedb_lookup(const char *romfn, const t_rom_header *romh, uint32_t romsize, t_gamedb_entry *ent) {
+  memset(ent, 0, sizeof(*ent));
+
+  FIL fd;
+  t_gamedb_entry bucket[ENTRIES_PER_BUCKET];
+  uint32_t hash = gamedb_hash(romfn);
+  if (!gamedb_read_bucket(&fd, hash, bucket, false))
+    return false;
+  f_close(&fd);
+
+  for (unsigned i = 0; i < ENTRIES_PER_BUCKET; i++) {
+    if (bucket[i].pathhash == hash) {
+      if (!gamedb_entry_valid(&bucket[i], romh, romsize))
+        return false;   // The ROM changed (or old entry), needs to be re-probed.
+      *ent = bucket[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+bool gamedb_store(const char *romfn, const t_rom_header *romh, uint32_t romsize, t_gamedb_entry *ent) {
+  uint32_t hash = gamedb_hash(romfn);
+  ent->pathhash = hash;
+  ent->romsize = romsize;
+  memcpy(ent->gcode, romh->gcode, sizeof(ent->gcode));
+  ent->gversion = romh->version;
+  ent->dbversion = GAMEDB_VERSION;
+
+  FIL fd;
+  t_gamedb_entry bucket[ENTRIES_PER_BUCKET];
+  if (!gamedb_read_bucket(&fd, hash, bucket, true)) {
+    if (!gamedb_create() || !gamedb_read_bucket(&fd, hash, bucket, true))
+      return false;
+  }
+
+  // Use the matching slot or an empty one. Evict some entry if full.
+  unsigned slot = (hash >> 16) % ENTRIES_PER_BUCKET;
+  for (unsigned i = 0; i < ENTRIES_PER_BUCKET; i++) {
+    if (bucket[i].pathhash == hash) {
+      slot = i;
+      break;
+    }
+    else if (!bucket[i].pathhash)
+      slot = i;
+  }
+
+  bucket[slot] = *ent;
+  return gamedb_write_bucket(&fd, hash, bucket);
+}
+
+bool gamedb_update(const char *romfn, uint8_t flags, const t_rom_settings *cfg, const uint32_t *cfgstamp) {
+  FIL fd;
+  t_gamedb_entry bucket[ENTRIES_PER_BUCKET];
+  uint32_t hash = gamedb_hash(romfn);
+  if (!gamedb_read_bucket(&fd, hash, bucket, true))
+    return false;
+
+  for (unsigned i = 0; i < ENTRIES_PER_BUCKET; i++) {
+    if (bucket[i].pathhash == hash) {
+      bucket[i].flags |= flags;
+      if (cfg)
+        gamedb_set_config(&bucket[i], cfg, cfgstamp);
+      return gamedb_write_bucket(&fd, hash, bucket);
+    }
+  }
+
+  // No entry for this ROM, it will be probed on the next lookup.
+  f_close(&fd);
+  return true;
+}
+
+void gamedb_get_config(const t_gamedb_entry *ent, t_rom_settings *cfg) {
+  cfg->rtcval = ent->rtcval;
+  cfg->patch_policy = ent->patch_policy;
+  cfg->use_dsaving = ent->cfgflags & CFG_USE_DSAVING;
+  cfg->use_igm = ent->cfgflags & CFG_USE_IGM;
+  cfg->use_cheats = ent->cfgflags & CFG_USE_CHEATS;
+  cfg->use_rtc = ent->cfgflags & CFG_USE_RTC;
+}
+
+void gamedb_set_config(t_gamedb_entry *ent, const t_rom_settings *cfg, const uint32_t *cfgstamp) {
+  ent->flags |= GMD_CONFIG;
+  ent->cfgsize = cfgstamp[0];
+  ent->cfgdate = cfgstamp[1];
+  ent->rtcval = cfg->rtcval;
+  ent->patch_policy = cfg->patch_policy;
+  ent->cfgflags = (cfg->use_dsaving ? CFG_USE_DSAVING : 0) |
+                  (cfg->use_igm     ? CFG_USE_IGM     : 0) |
+                  (cfg->use_cheats  ? CFG_USE_CHEATS  : 0) |
+                  (cfg->use_rtc     ? CFG_USE_RTC     : 0);
+}
+
+bool gamedb_config_valid(const t_gamedb_entry *ent, const uint32_t *cfgstamp) {
+  return (ent->flags & GMD_CONFIG) &&
+         ent->cfgsize == cfgstamp[0] &&
+         ent->cfgdate == cfgstamp[1];
+}
+
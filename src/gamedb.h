@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GAMEDB_H_
+#define _GAMEDB_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common.h"
+
+// Per-game metadata database. Caches the ROM config, the patch engine cache
+// result and the cheats DB hit found when opening a GBA ROM, so they can be
+// resolved with a single indexed sector read. The config is validated against
+// the config file size and date. The patch cache is written by the firmware,
+// so its misses are cached too. Cheats DB misses are always probed, since
+// they might have been copied to the SD card later on.
+// Entries are keyed by the ROM path hash and validated against the game code
+// and ROM size. The DB is just a cache: deleting the file is always safe.
+
+#define GAMEDB_VERSION         3
+#define GAMEDB_BUCKETS        64       // One sector each (16 entries per bucket)
+
+// Metadata flags
+#define GMD_CONFIG          0x01       // ROM config file (copied in the entry)
+#define GMD_CHEATS_DB       0x02       // .cht file in the cheats directory
+#define GMD_PCACHE_CHECKED  0x04       // Patch engine cache was checked
+#define GMD_PCACHE          0x08       // Patch engine cache file
+
+typedef struct {
+  uint32_t pathhash;                   // ROM full path hash (zero if empty)
+  uint32_t romsize;                    // ROM file size
+  uint32_t cfgdate;                    // Config file date and time (for GMD_CONFIG)
+  uint8_t gcode[4];                    // Game code and version
+  uint8_t gversion;
+  uint8_t dbversion;                   // Entry format version (GAMEDB_VERSION)
+  uint8_t flags;                       // GMD_* flags
+  // ROM config (only valid with GMD_CONFIG)
+  uint8_t patch_policy;
+  t_rtc_state rtcval;
+  uint8_t cfgflags;
+  uint16_t cfgsize;                    // Config file size
+  uint8_t pad[4];
+} t_gamedb_entry;
+
+_Static_assert (sizeof(t_gamedb_entry) == 32, "t_gamedb_entry must be 32 bytes long");
+
+uint32_t gamedb_hash(const char *s);
+
+// Looks up a ROM. Returns false if not found (entry is zeroed and ready to fill)
+bool gamedb_lookup(const char *romfn, const t_rom_header *romh, uint32_t romsize, t_gamedb_entry *ent);
+// Inserts or replaces the entry for the given ROM.
+bool gamedb_store(const char *romfn, const t_rom_header *romh, uint32_t romsize, t_gamedb_entry *ent);
+// Updates an existing entry (if any) after writing some file for the ROM.
+// Sets the given flags, and the config (and its file stamp) if not NULL.
+bool gamedb_update(const char *romfn, uint8_t flags, const t_rom_settings *cfg, const uint32_t *cfgstamp);
+
+static inline uint8_t gamedb_flag(uint8_t flags, uint8_t flag, bool set) {
+  return set ? (flags | flag) : (flags & ~flag);
+}
+
+// ROM config packing in the entry.
+void gamedb_get_config(const t_gamedb_entry *ent, t_rom_settings *cfg);
+void gamedb_set_config(t_gamedb_entry *ent, const t_rom_settings *cfg, const uint32_t *cfgstamp);
+// Checks whether the cached config matches the config file stamp.
+bool gamedb_config_valid(const t_gamedb_entry *ent, const uint32_t *cfgstamp);
+
+#endif
+
@@ -44,3 +44,22 @@ void dma_memcpy32(volatile void *dst, const void *src, uint16_t count) {
   asm volatile("": : :"memory");
 }
 
+void timer_cycles_start() {
+  REG_TMxCNT_H(2) = 0;
+  REG_TMxCNT_H(3) = 0;
+  REG_TMxCNT_L(2) = 0;
+  REG_TMxCNT_L(3) = 0;
+  REG_TMxCNT_H(3) = TM_ENABLE | TM_CASCADE;
+  REG_TMxCNT_H(2) = TM_ENABLE;
+}
+
+uint32_t timer_cycles_read() {
+  // Re-read if the high part overflowed while reading the low part.
+  uint16_t hi, lo;
+  do {
+    hi = REG_TMxCNT_L(3);
+    lo = REG_TMxCNT_L(2);
+  } while (hi != REG_TMxCNT_L(3));
+  return (hi << 16) | lo;
+}
+
@@ -39,6 +39,10 @@
 #define DISPSTAT_HBLANK      0x0002
 #define DISPSTAT_VBLANK_IRQ  0x0008
 
+#define TM_ENABLE        0x0080
+#define TM_IRQ           0x0040
+#define TM_CASCADE       0x0004
+
 #define DMA_ENABLE       0x8000
 #define DMA_TRANSFER32   0x0400
 #define DMA_DST_INC      0x0000
@@ -79,6 +83,9 @@
 
 #define REG_IE           (*((volatile uint16_t *) 0x04000200))
 
+#define REG_TMxCNT_L(n)  (*(((volatile uint16_t *) 0x04000100) + (n) * 2))
+#define REG_TMxCNT_H(n)  (*(((volatile uint16_t *) 0x04000102) + (n) * 2))
+
 #define DMA_SAD(n)       (*(((volatile uint32_t *) 0x040000B0) + (n) * 3))
 #define DMA_DAD(n)       (*(((volatile uint32_t *) 0x040000B4) + (n) * 3))
 #define DMA_CTL(n)       (*(((volatile uint32_t *) 0x040000B8) + (n) * 3))
@@ -110,6 +117,10 @@ void dma_memset16(volatile void *ptr, uint16_t value, uint16_t count);
 void dma_memcpy16(volatile void *dst, const void *src, uint16_t count);
 void dma_memcpy32(volatile void *dst, const void *src, uint16_t count);
 
+// 32 bit cycle counter (16.78MHz) built using cascaded timers 2 and 3.
+void timer_cycles_start();
+uint32_t timer_cycles_read();
+
 
 
 
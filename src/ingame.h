@@ -17,11 +17,19 @@
  */
 
 
-#define MIN_SCRATCH_SPACE       (160*1024)        // IWRAM/EWRAM/VRAM + regs
+#define MIN_SCRATCH_SPACE       (160*1024)        // IWRAM/EWRAM/VRAM + regs + frame
 
+// Only the memory that the menu overwrites is spilled on entry: the BG palette,
+// a single mode 4 page, the IWRAM used for data/stack and the EWRAM used by the
+// menu payload (__EWRAM_SPILL_SIZE__ bytes, up to EWRAM_SPILL_SIZE). The rest
+// of the game state is read from memory when a savestate is taken.
+#define PALETTE_SPILL_SIZE      512
 #define EWRAM_SPILL_SIZE        (62 * 1024)
 #define IWRAM_SPILL_SIZE        (16 * 1024)
-#define VRAM_SPILL_SIZE         (80 * 1024)
+#define VRAM_SPILL_SIZE         (38 * 1024)
+
+// Frames are rendered into SDRAM and copied into VRAM at V-Blank.
+#define IGM_FRAME_SIZE          (240 * 160)
 
 #ifndef __ASSEMBLER__
 
@@ -77,11 +85,13 @@ typedef struct {
   uint32_t abt_regs[3];        // SP, LR and SPSR for abort mode
   uint32_t und_regs[3];        // SP, LR and SPSR for undefined mode
 
-  uint8_t palette[1024];
+  uint8_t palette[PALETTE_SPILL_SIZE];
   uint8_t low_vram[VRAM_SPILL_SIZE];
   uint8_t low_iwram[IWRAM_SPILL_SIZE];
   uint8_t low_ewram[EWRAM_SPILL_SIZE];
 
+  uint8_t framebuf[IGM_FRAME_SIZE];   // Menu back buffer (not spilled data)
+
 } t_spilled_region;
 
 #define SIGNATURE_A          0x45505553     // SUPERFWSNAP
@@ -47,6 +47,7 @@ extern uint16_t ingame_menu_palette[4];
 extern uint32_t savefile_backups;                // Num of save backups to create
 extern uint32_t scratch_base, scratch_size;      // Space to write snapshots (in memory)
 extern uint32_t spill_addr;                      // Spill buffer that gets reloaded on IGM exit
+extern uint8_t __EWRAM_SPILL_SIZE__[];           // EWRAM spilled size (linker provided)
 extern char savefile_pattern[256];
 extern char savestate_pattern[256];
 
@@ -76,6 +77,7 @@ uint32_t *get_cheat_table();
 #define MEM_ICON_DISABLED    4
 
 #define MEM_VRAM_U8            (((volatile  uint8_t *) 0x06000000))
+#define MEM_OBJPAL_U8          (((volatile  uint8_t *) 0x05000200))
 #define MEM_ROM_U8             (((volatile  uint8_t *) 0x08000000))
 #define MEM_ROM_U16(off)       (((volatile  uint16_t *) (0x08000000 + (off))))
 
@@ -132,6 +134,9 @@ static inline void* get_memslot_addr(unsigned slotnum) {
   return (void*)(scratch_base + ((slotnum * 388) << 10));
 }
 
+// Amount of EWRAM spilled on entry (depends on the payload size).
+#define EWRAM_SPILLED          ((unsigned)(uintptr_t)__EWRAM_SPILL_SIZE__)
+
 // The save state is a bit all over the place, since entering the menu only
 // swaps some partial state (to save space and be faster).
 void take_mem_snapshot(void *buffer) {
@@ -142,7 +147,7 @@ void take_mem_snapshot(void *buffer) {
 
   // Copy the (partially) spilled buffers first.
   fast_mem_cpy_256(save_ptr->iwram, spill_ptr->low_iwram, sizeof(spill_ptr->low_iwram));
-  fast_mem_cpy_256(save_ptr->ewram, spill_ptr->low_ewram, sizeof(spill_ptr->low_ewram));
+  fast_mem_cpy_256(save_ptr->ewram, spill_ptr->low_ewram, EWRAM_SPILLED);
   fast_mem_cpy_256(save_ptr->vram,  spill_ptr->low_vram,  sizeof(spill_ptr->low_vram));
   fast_mem_cpy_256(save_ptr->palette, spill_ptr->palette, sizeof(spill_ptr->palette));
 
@@ -152,8 +157,9 @@ void take_mem_snapshot(void *buffer) {
                    32*1024 - sizeof(spill_ptr->low_iwram));
 
   const uint8_t *EWRAM_BUF = (uint8_t*)0x02000000;
-  fast_mem_cpy_256(&save_ptr->ewram[sizeof(spill_ptr->low_ewram)], &EWRAM_BUF[sizeof(spill_ptr->low_ewram)],
-                   256*1024 - sizeof(spill_ptr->low_ewram));
+  fast_mem_cpy_256(&save_ptr->ewram[EWRAM_SPILLED], &EWRAM_BUF[EWRAM_SPILLED], 256*1024 - EWRAM_SPILLED);
+
+  fast_mem_cpy_256(&save_ptr->palette[PALETTE_SPILL_SIZE], (uint8_t*)MEM_OBJPAL_U8, 1024 - PALETTE_SPILL_SIZE);
 
   const uint8_t *VRAM_BUF = (uint8_t*)0x06000000;
   fast_mem_cpy_256(&save_ptr->vram[sizeof(spill_ptr->low_vram)], &VRAM_BUF[sizeof(spill_ptr->low_vram)],
@@ -271,7 +277,12 @@ bool writefd_mem_snapshot(FIL *fd) {
   if (FR_OK != f_write(fd, &tmp.iomap, sizeof(tmp.iomap), &wrbytes) || wrbytes != sizeof(tmp.iomap))
     return false;
 
-  if (!write_rom_buffer(fd, spill_ptr->palette, sizeof(spill_ptr->palette), tmp.buf))
+  // Palette: the BG half is spilled, the OBJ half is untouched.
+  set_supercard_mode(MAPPED_SDRAM, true, false);   // Ensure we can read spill area.
+  memory_copy32((uint32_t*)tmp.buf, (uint32_t*)spill_ptr->palette, PALETTE_SPILL_SIZE / 4);
+  memory_copy32((uint32_t*)&tmp.buf[PALETTE_SPILL_SIZE], (uint32_t*)MEM_OBJPAL_U8, (1024 - PALETTE_SPILL_SIZE) / 4);
+  set_supercard_mode(MAPPED_SDRAM, true, true);   // So we can write to the SD card
+  if (FR_OK != f_write(fd, tmp.buf, 1024, &wrbytes) || wrbytes != 1024)
     return false;
 
   const uint8_t *OARAM_BUF = (uint8_t*)0x07000000;
@@ -296,10 +307,10 @@ bool writefd_mem_snapshot(FIL *fd) {
     return false;
 
   const uint8_t *EWRAM_BUF = (uint8_t*)0x02000000;
-  const unsigned highsize3 = 256*1024 - sizeof(spill_ptr->low_ewram);
-  if (!write_rom_buffer(fd, spill_ptr->low_ewram, sizeof(spill_ptr->low_ewram), tmp.buf))
+  const unsigned highsize3 = 256*1024 - EWRAM_SPILLED;
+  if (!write_rom_buffer(fd, spill_ptr->low_ewram, EWRAM_SPILLED, tmp.buf))
     return false;
-  if (FR_OK != f_write(fd, &EWRAM_BUF[sizeof(spill_ptr->low_ewram)], highsize3, &wrbytes) || wrbytes != highsize3)
+  if (FR_OK != f_write(fd, &EWRAM_BUF[EWRAM_SPILLED], highsize3, &wrbytes) || wrbytes != highsize3)
     return false;
 
   return true;
@@ -327,7 +338,7 @@ bool load_mem_snapshot(const void *buffer) {
 
   // Copy the (partially) spilled buffers first.
   fast_mem_cpy_256(spill_ptr->low_iwram, save_ptr->iwram, sizeof(spill_ptr->low_iwram));
-  fast_mem_cpy_256(spill_ptr->low_ewram, save_ptr->ewram, sizeof(spill_ptr->low_ewram));
+  fast_mem_cpy_256(spill_ptr->low_ewram, save_ptr->ewram, EWRAM_SPILLED);
   fast_mem_cpy_256(spill_ptr->low_vram,  save_ptr->vram,  sizeof(spill_ptr->low_vram));
   fast_mem_cpy_256(spill_ptr->palette, save_ptr->palette, sizeof(spill_ptr->palette));
 
@@ -337,8 +348,9 @@ bool load_mem_snapshot(const void *buffer) {
                    32*1024 - sizeof(spill_ptr->low_iwram));
 
   uint8_t *EWRAM_BUF = (uint8_t*)0x02000000;
-  fast_mem_cpy_256(&EWRAM_BUF[sizeof(spill_ptr->low_ewram)], &save_ptr->ewram[sizeof(spill_ptr->low_ewram)],
-                   256*1024 - sizeof(spill_ptr->low_ewram));
+  fast_mem_cpy_256(&EWRAM_BUF[EWRAM_SPILLED], &save_ptr->ewram[EWRAM_SPILLED], 256*1024 - EWRAM_SPILLED);
+
+  fast_mem_cpy_256((uint8_t*)MEM_OBJPAL_U8, &save_ptr->palette[PALETTE_SPILL_SIZE], 1024 - PALETTE_SPILL_SIZE);
 
   uint8_t *VRAM_BUF = (uint8_t*)0x06000000;
   fast_mem_cpy_256(&VRAM_BUF[sizeof(spill_ptr->low_vram)], &save_ptr->vram[sizeof(spill_ptr->low_vram)],
@@ -414,7 +426,7 @@ bool read_rom_buffer(FIL *fd, void *buffer, unsigned size, void *tmpbuf) {
 }
 
 
-bool readfd_mem_snapshot(FIL *fd) {
+static bool readfd_mem_snapshot_data(FIL *fd) {
 
   t_spilled_region *spill_ptr = (t_spilled_region*)spill_addr;
 
@@ -485,8 +497,13 @@ bool readfd_mem_snapshot(FIL *fd) {
   for (unsigned i = 0; i < 4; i++)                 // Timers
     curr_ro_io->tms[i].tm_cnth  = tmp.iomap.tms[i].tm_cnth;
 
-  if (!read_rom_buffer(fd, spill_ptr->palette, sizeof(spill_ptr->palette), tmp.buf))
+  // Palette: the BG half goes to the spill area, the OBJ half is loaded.
+  if (FR_OK != f_read(fd, tmp.buf, 1024, &rdbytes) || rdbytes != 1024)
     return false;
+  set_supercard_mode(MAPPED_SDRAM, true, false);   // Ensure we can write spill area.
+  memory_copy32((uint32_t*)spill_ptr->palette, (uint32_t*)tmp.buf, PALETTE_SPILL_SIZE / 4);
+  memory_copy32((uint32_t*)MEM_OBJPAL_U8, (uint32_t*)&tmp.buf[PALETTE_SPILL_SIZE], (1024 - PALETTE_SPILL_SIZE) / 4);
+  set_supercard_mode(MAPPED_SDRAM, true, true);   // So we can read from the SD card
 
   // Use aux function for OAM/VRAM since they don't take byte writes nicely.
   uint8_t *OARAM_BUF = (uint8_t*)0x07000000;
@@ -510,15 +527,26 @@ bool readfd_mem_snapshot(FIL *fd) {
     return false;
 
   uint8_t *EWRAM_BUF = (uint8_t*)0x02000000;
-  const unsigned highsize3 = 256*1024 - sizeof(spill_ptr->low_ewram);
-  if (!read_rom_buffer(fd, spill_ptr->low_ewram, sizeof(spill_ptr->low_ewram), tmp.buf))
+  const unsigned highsize3 = 256*1024 - EWRAM_SPILLED;
+  if (!read_rom_buffer(fd, spill_ptr->low_ewram, EWRAM_SPILLED, tmp.buf))
     return false;
-  if (FR_OK != f_read(fd, &EWRAM_BUF[sizeof(spill_ptr->low_ewram)], highsize3, &rdbytes) || rdbytes != highsize3)
+  if (FR_OK != f_read(fd, &EWRAM_BUF[EWRAM_SPILLED], highsize3, &rdbytes) || rdbytes != highsize3)
     return false;
 
   return true;
 }
 
+bool readfd_mem_snapshot(FIL *fd) {
+  // Map the state file clusters (states are read in small chunks and would
+  // otherwise walk the FAT chain along the way). The map lives in the stack.
+  DWORD clmt[32];
+  file_fastseek_map(fd, clmt, sizeof(clmt) / sizeof(clmt[0]));
+
+  bool ret = readfd_mem_snapshot_data(fd);
+  fd->cltbl = NULL;
+  return ret;
+}
+
 static void draw_hline(uint8_t *fb, unsigned x, unsigned y, unsigned w, uint16_t col) {
   memory_set16((uint16_t*)&fb[x + y * SCREEN_WIDTH], dup8(col), w / 2);
   memory_set16((uint16_t*)&fb[x + (y+1) * SCREEN_WIDTH], dup8(col), w / 2);
@@ -1112,9 +1140,51 @@ const t_menu_def menudata [] = {
   { draw_cheats_menu, cheatsacts, NULL,   0, cheats_cnt,  true },
 };
 
+// Frames are rendered into an SDRAM buffer and copied to the (single) VRAM
+// page during V-Blank, so that the menu only overwrites 38KB of VRAM.
+static inline uint8_t *menu_framebuf() {
+  return ((t_spilled_region*)spill_addr)->framebuf;
+}
+
+_Static_assert (IGM_FRAME_SIZE % 256 == 0, "The frame is copied in 256 byte blocks");
+
+static bool frame_row_equal(const uint32_t *a, const volatile uint32_t *b) {
+  for (unsigned i = 0; i < SCREEN_WIDTH / 4; i++)
+    if (a[i] != b[i])
+      return false;
+  return true;
+}
+
+static void present_frame() {
+  // Find the rows that changed since the last frame (outside V-Blank), most
+  // frames only change a few rows (cursor, scrolling text) or none at all.
+  const uint32_t *fb = (uint32_t*)menu_framebuf();
+  const volatile uint32_t *vram = (uint32_t*)MEM_VRAM_U8;
+  const unsigned rwords = SCREEN_WIDTH / 4;
+  unsigned first = 0, last = SCREEN_HEIGHT;
+  while (first < last && frame_row_equal(&fb[first * rwords], &vram[first * rwords]))
+    first++;
+  while (last > first && frame_row_equal(&fb[(last - 1) * rwords], &vram[(last - 1) * rwords]))
+    last--;
+
+  // Wait for VBlank (with some leeway)
+  while ((REG_VCOUNT & ~7) != 160);
+
+  // Copy the changed rows, in 256 byte blocks. Avoid DMA since its registers
+  // are not preserved for the game.
+  if (first < last) {
+    unsigned start = (first * SCREEN_WIDTH) & ~255U;
+    unsigned end = (last * SCREEN_WIDTH + 255) & ~255U;
+    fast_mem_cpy_256((uint8_t*)MEM_VRAM_U8 + start, (uint8_t*)fb + start, end - start);
+  }
+}
+
 void setup_video_frame() {
+  // Clear the displayed page before enabling it.
+  fast_mem_clr_256((uint16_t*)MEM_VRAM_U8, dup16(dup8(BG_COLOR)), SCREEN_WIDTH * SCREEN_HEIGHT);
+
   // Setup video mode
-  REG_DISPCNT = 0x404;   // Mode 4, BG2 no OBJs
+  REG_DISPCNT = 0x404;   // Mode 4 (page 0), BG2 no OBJs
   REG_BGxCNT(2) = 0x80;  // 256 color mode
   REG_BLDCNT = 0;        // No effects
   REG_BGxHOFS(2) = 0;
@@ -1136,18 +1206,12 @@ void setup_video_frame() {
 
   memory_copy16((uint16_t*)&MEM_PALETTE[ICON_PAL], menu_icons_pal, sizeof(menu_icons_pal) >> 1);
   MEM_PALETTE[ICON_PAL] = MEM_PALETTE[BG_COLOR]; // Transparent color to BG color
-
-  // Clear two frames with BG color
-  fast_mem_clr_256((uint16_t*)MEM_VRAM_U8, dup16(dup8(BG_COLOR)), SCREEN_WIDTH * SCREEN_HEIGHT * 2);
 }
 
 void ingame_menu_blocked(uint32_t *use_cheats_hook) {
   setup_video_frame();
 
-  // Display frame 0 (empty)
-  REG_DISPCNT = (REG_DISPCNT & ~0x10);
-
-  uint8_t *fb = (uint8_t*)&MEM_VRAM_U8[0xA000];
+  uint8_t *fb = menu_framebuf();
   fast_mem_clr_256((uint16_t*)fb, dup16(dup8(BG_COLOR)), SCREEN_WIDTH * SCREEN_HEIGHT);
   render_logo((uint16_t*)fb, SCREEN_WIDTH / 2, 20, 2);
 
@@ -1167,10 +1231,7 @@ void ingame_menu_blocked(uint32_t *use_cheats_hook) {
   // Show an user message
   draw_text_center(msgs[ingame_menu_lang][IMENU_SAVING_BLOCKED], fb, SCREEN_WIDTH / 2, SCREEN_HEIGHT - 32, HI_COLOR);
 
-  // Wait for VBlank (with some leeway)
-  while ((REG_VCOUNT & ~7) != 160);
-  // Display frame 1, just rendered
-  REG_DISPCNT = (REG_DISPCNT | 0x10);
+  present_frame();
 
   // Wait for the user to press any button
   uint16_t pk = 0xFFFF;
@@ -1209,11 +1270,11 @@ void ingame_menu_loop(uint32_t *use_cheats_hook) {
   state_slot = num_mem_savestates ? 0 : -1;
   memset(&popup, 0, sizeof(popup));
 
+  uint8_t *fb = menu_framebuf();
   while (1) {
     // Render a new frame into the back-buffer
     framen ^= 1;
     // Clear the screen & draw logo at the top
-    uint8_t *fb = (uint8_t*)&MEM_VRAM_U8[0xA000 * framen];
     fast_mem_clr_256((uint16_t*)fb, dup16(dup8(BG_COLOR)), SCREEN_WIDTH * SCREEN_HEIGHT);
     render_logo((uint16_t*)fb, SCREEN_WIDTH / 2, 20, 2);
 
@@ -1233,8 +1294,10 @@ void ingame_menu_loop(uint32_t *use_cheats_hook) {
         void (*cb)() = popup.opt ? popup.callback : NULL;
         memset(&popup, 0, sizeof(popup));
 
-        if ((pressed & KEY_BUTTA) && cb)
+        if ((pressed & KEY_BUTTA) && cb) {
           cb();
+          set_supercard_mode(MAPPED_SDRAM, true, false);   // Frame buffer access
+        }
       }
       else if (pressed & (KEY_BUTTLEFT | KEY_BUTTRIGHT))
         popup.opt ^= 1;
@@ -1273,10 +1336,7 @@ void ingame_menu_loop(uint32_t *use_cheats_hook) {
         menudata[submenu].key_fn(pressed);
     }
 
-    // Wait for VBlank (with some leeway)
-    while ((REG_VCOUNT & ~7) != 160);
-    // Flip frame
-    REG_DISPCNT = (REG_DISPCNT & ~0x10) | (framen << 4);
+    present_frame();
   }
 
   // Unmount the device, ensure everything is in order
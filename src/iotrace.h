@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IOTRACE_H_
+#define _IOTRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Disk I/O trace recorder. Every disk_read/disk_write/disk_ioctl call is
+// recorded in a ring buffer (in diskio.c) that can be dumped to the SD card
+// and analyzed offline (see tools/iotrace.c). Only built when IOTRACE_ENABLED
+// is defined. The file format is also used by the host tool.
+
+#define IOTRACE_MAGIC         0x52544F49    // "IOTR"
+#define IOTRACE_VERSION       1
+#ifndef IOTRACE_ENTRIES
+#define IOTRACE_ENTRIES       1024          // Ring size (power of two)
+#endif
+
+#define IOTRACE_OP_READ       0
+#define IOTRACE_OP_WRITE      1
+#define IOTRACE_OP_IOCTL      2
+
+#define IOTRACE_ARG_ERROR     0x80          // Driver returned an error
+
+typedef struct {
+  uint32_t timestamp;         // Call time (timer cycles, see timer_freq)
+  uint32_t duration;          // Cycles spent in the call
+  uint32_t sector;            // First sector (zero for ioctls)
+  uint16_t count;             // Sector count (zero for ioctls)
+  uint8_t op;                 // IOTRACE_OP_*
+  uint8_t arg;                // ioctl command and/or IOTRACE_ARG_ERROR
+} t_iotrace_rec;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recsize;           // sizeof(t_iotrace_rec)
+  uint32_t count;             // Records following the header (oldest first)
+  uint32_t dropped;           // Records lost due to ring overflow
+  uint32_t timer_freq;        // Timestamp frequency (Hz)
+  uint32_t reserved[3];
+} t_iotrace_hdr;
+
+#ifdef IOTRACE_ENABLED
+
+// Clears the trace and starts the cycle timer.
+void iotrace_init();
+void iotrace_reset();
+// Writes the trace to the SD card (tracing is paused while writing).
+bool iotrace_dump(const char *fn);
+
+#endif
+
+#endif
+
@@ -17,6 +17,7 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -32,10 +33,16 @@
 #include "common.h"
 #include "util.h"
 #include "sha256.h"
+#include "crc.h"
+#include "profiler.h"
 
 // Here we have the ROM loading routines.
 
-#define LOAD_BS     (8*1024)     // Load in 8KB chunks
+#define LOAD_BS     (8*1024)     // Load in 8KB chunks (when bouncing data)
+#define LOAD_BURST  (256*1024)   // Direct SD->SDRAM bursts (and progress cadence)
+
+// SD interface registers shadow the SDRAM above this address when mapped.
+#define SDIF_SHADOW_ADDR    0x09000000
 
 #define GBA_ROM_ADDR                  ((volatile  uint8_t *)0x08000000)
 #define GBA_ROM_ADDR16(addr, value)   *((volatile uint16_t *)(0x08000000 + addr)) = (value)
@@ -45,6 +52,164 @@
 
 extern bool slowsd;
 
+typedef struct {
+  progress_fn progress;
+  uint32_t done, total;     // Streamed and total bytes
+  uint32_t next;            // Next progress report
+  t_patch_stream *ps;       // Patches to apply as data is loaded (optional)
+} t_load_progress;
+
+// Streams "size" bytes, from the current file position, into ROM (SDRAM).
+// Whenever possible data is read straight into SDRAM using large multi-block
+// SD reads, this requires the destination to be outside the area shadowed by
+// the SD interface (and sector aligned file reads). Otherwise data bounces via
+// a small buffer (with the SD interface temporarily disabled). Only the exact
+// tail is copied (rounded up to a word).
+// Patches are applied to every chunk right after it is read (and before it
+// is copied to SDRAM in the bounce case), while the data is still hot.
+static bool stream_rom_data(FIL *fd, uint8_t *dst, uint32_t size, t_load_progress *lp) {
+  while (size) {
+    if (lp && lp->progress && lp->done >= lp->next) {
+      lp->progress(lp->done >> 8, lp->total >> 8);
+      lp->next = lp->done + LOAD_BURST;
+    }
+
+    UINT rdbytes;
+    unsigned toread;
+    uintptr_t daddr = (uintptr_t)dst;
+    if (!(daddr & 3) && !(f_tell(fd) & 511) && size >= 512 && daddr + 512 <= SDIF_SHADOW_ADDR) {
+      // Whole sectors only, FatFs reads them directly into the buffer.
+      toread = MIN(size, LOAD_BURST);
+      toread = MIN(toread, SDIF_SHADOW_ADDR - daddr) & ~511U;
+      if (FR_OK != f_read(fd, dst, toread, &rdbytes) || rdbytes != toread)
+        return false;
+      if (lp && lp->ps)
+        patch_stream_chunk(lp->ps, dst, daddr - GBA_ROM_BASE, toread);
+    } else {
+      // Read up to the next sector boundary, so that we can go back to direct reads.
+      uint32_t tmp[LOAD_BS/4];
+      toread = MIN(size, LOAD_BS - (f_tell(fd) & 511));
+      if (FR_OK != f_read(fd, tmp, toread, &rdbytes) || rdbytes != toread)
+        return false;
+      if (lp && lp->ps)
+        patch_stream_chunk(lp->ps, (uint8_t*)tmp, daddr - GBA_ROM_BASE, toread);
+
+      // Copy data into the ROM (disable SD interface to avoid collisions!)
+      set_supercard_mode(MAPPED_SDRAM, true, false);
+      dma_memcpy32(dst, tmp, (toread + 3) / 4);
+      set_supercard_mode(MAPPED_SDRAM, true, true);
+    }
+
+    dst += toread;
+    size -= toread;
+    if (lp)
+      lp->done += toread;
+  }
+  return true;
+}
+
+// Recently used emulator binaries are kept resident in SDRAM (at
+// ROM_OFF_EMUCACHE), so that launching games for the same system does not
+// need to load the emulator from the SD card every time. Every slot has its
+// own header, which is checksummed since SDRAM survives resets (and big ROMs
+// might have overwritten it). Copies are matched against the emulator file
+// size and timestamp, so updated emulators are reloaded.
+// The cache lives above the SD interface shadow, so it must be disabled.
+
+#define EMUCACHE_MAGIC      0x43554D45     // "EMUC"
+#define EMUCACHE_SLOTS      4
+#define EMUCACHE_SLOT_SIZE  (EMUCACHE_SIZE / EMUCACHE_SLOTS)
+#define EMUCACHE_HDR_SIZE   64
+#define EMUCACHE_NAME_LEN   16
+#define EMUCACHE_MAX_EMU    (EMUCACHE_SLOT_SIZE - EMUCACHE_HDR_SIZE)
+
+typedef struct {
+  uint32_t magic;
+  char name[EMUCACHE_NAME_LEN];  // Emulator name (zero padded)
+  uint32_t size;            // Binary size (in bytes)
+  uint32_t fdatetime;       // Emulator file timestamp
+  uint32_t lastuse;         // Usage counter (for LRU eviction)
+  uint32_t crc;             // Checksum of all the fields above
+} t_emucache_hdr;
+
+static uint8_t *emucache_slot(unsigned slot) {
+  return (uint8_t*)&ROM_EMUCACHE_U8[slot * EMUCACHE_SLOT_SIZE];
+}
+
+static bool emucache_read_hdr(unsigned slot, t_emucache_hdr *h) {
+  memcpy32(h, emucache_slot(slot), sizeof(*h));
+  return h->magic == EMUCACHE_MAGIC &&
+         h->crc == crc32_update(0, (uint8_t*)h, offsetof(t_emucache_hdr, crc));
+}
+
+static void emucache_write_hdr(unsigned slot, t_emucache_hdr *h) {
+  h->crc = crc32_update(0, (uint8_t*)h, offsetof(t_emucache_hdr, crc));
+  memcpy32(emucache_slot(slot), h, sizeof(*h));
+}
+
+// Copies the resident emulator into ROM, returns its size (zero if not found).
+static unsigned emucache_fetch(const char *name, uint32_t fsize, uint32_t fdt, uint8_t *dst) {
+  int hit = -1;
+  uint32_t maxuse = 0;
+  t_emucache_hdr hdrs[EMUCACHE_SLOTS];
+  for (unsigned i = 0; i < EMUCACHE_SLOTS; i++) {
+    if (emucache_read_hdr(i, &hdrs[i])) {
+      maxuse = MAX(maxuse, hdrs[i].lastuse);
+      if (!strncmp(hdrs[i].name, name, EMUCACHE_NAME_LEN) &&
+          hdrs[i].size == fsize && hdrs[i].fdatetime == fdt)
+        hit = i;
+    }
+  }
+  if (hit < 0)
+    return 0;
+
+  memcpy32(dst, emucache_slot(hit) + EMUCACHE_HDR_SIZE, ROUND_UP2(fsize, 4));
+  hdrs[hit].lastuse = maxuse + 1;
+  emucache_write_hdr(hit, &hdrs[hit]);
+  return fsize;
+}
+
+// Stores an emulator copy, replacing older copies or the least recently used.
+static void emucache_store(const char *name, uint32_t fsize, uint32_t fdt, const uint8_t *src) {
+  if (fsize > EMUCACHE_MAX_EMU || strlen(name) >= EMUCACHE_NAME_LEN)
+    return;
+
+  int slot = -1;
+  uint32_t maxuse = 0, minuse = ~0U;
+  for (unsigned i = 0; i < EMUCACHE_SLOTS; i++) {
+    t_emucache_hdr h;
+    if (!emucache_read_hdr(i, &h)) {
+      if (minuse) {
+        slot = i;       // Free slots are always preferred
+        minuse = 0;
+      }
+      continue;
+    }
+    maxuse = MAX(maxuse, h.lastuse);
+    if (!strncmp(h.name, name, EMUCACHE_NAME_LEN)) {
+      slot = i;         // Stale copy of the same emulator, replace it.
+      minuse = 0;
+    }
+    else if (h.lastuse < minuse) {
+      slot = i;
+      minuse = h.lastuse;
+    }
+  }
+
+  t_emucache_hdr h = {
+    .magic = EMUCACHE_MAGIC,
+    .size = fsize,
+    .fdatetime = fdt,
+    .lastuse = maxuse + 1,
+  };
+  strcpy(h.name, name);     // Length checked above
+
+  // Invalidate the slot first, in case we get interrupted.
+  memset32(emucache_slot(slot), 0, EMUCACHE_HDR_SIZE);
+  memcpy32(emucache_slot(slot) + EMUCACHE_HDR_SIZE, src, ROUND_UP2(fsize, 4));
+  emucache_write_hdr(slot, &h);
+}
+
 bool validate_gba_header(const uint8_t *header) {
   const t_rom_header *gbah = (t_rom_header*)header;
 
@@ -164,7 +329,7 @@ void load_ingame_menu(
   set_supercard_mode(MAPPED_SDRAM, true, true);
 }
 
-void load_directsave_payload(uint32_t address, const t_dirsave_info *dsinfo) {
+void load_directsave_payload(uint32_t address, const t_dirsave_info *dsinfo, uint32_t cache_addr) {
   // Copy the direct save payload to the specified address offset.
   uint8_t *ptr = ((uint8_t*)address);
   memcpy32(ptr, directsave_payload, directsave_payload_size);
@@ -175,6 +340,11 @@ void load_directsave_payload(uint32_t address, const t_dirsave_info *dsinfo) {
   hdr->memory_size = dsinfo->save_size;
   hdr->drv_issdhc = sc_issdhc();
   hdr->drv_rca = sc_rca();
+
+  // Invalidate all the read cache lines (if the cache is in use).
+  hdr->cache_base = cache_addr;
+  if (cache_addr)
+    memset32((void*)cache_addr, ~0U, DIRSAVE_CACHE_LINES * sizeof(uint32_t));
 }
 
 // Loads ROM header from disk for inspection.
@@ -202,6 +372,7 @@ unsigned load_gba_rom(
   unsigned cheats,
   progress_fn progress
 ) {
+  PROF_SCOPE(PROF_LOAD_GBA_ROM);
 
   // Determine how much ROM space we need for the IGM and DirSav payloads
   const unsigned igm_reqsz = ingame_menu_payload.menu_rsize + font_block_size();
@@ -210,13 +381,17 @@ unsigned load_gba_rom(
   const unsigned romrsize = ROUND_UP2(fs, 1024) + (fs < MAX_GBA_ROM_SIZE ? 1024 : 0);
   // Required size for these payloads. We should always have enough, since menu checks it.
   const unsigned req_size = (ingame_menu ? igm_reqsz : 0) + (dsinfo ? DIRSAVE_REQ_SPACE : 0);
+  // The DirSav read cache is optional, only placed after the payload if it fits.
+  unsigned ds_space = dsinfo ? DIRSAVE_REQ_SPACE : 0;
 
   uint32_t igm_addr, igm_space, ds_addr;
   if (romrsize + req_size <= MAX_GBA_ROM_SIZE) {
+    if (dsinfo && romrsize + req_size + DIRSAVE_CACHE_SPACE <= MAX_GBA_ROM_SIZE)
+      ds_space += DIRSAVE_CACHE_SPACE;
     // Allocate the DirSav payload first
     ds_addr = romrsize;
     // Now the IGM
-    igm_addr = ds_addr + (dsinfo ? DIRSAVE_REQ_SPACE : 0);
+    igm_addr = ds_addr + ds_space;
     // Calculate the total space for the IGM to use
     igm_space = MAX_GBA_ROM_SIZE - igm_addr;
   }
@@ -224,10 +399,12 @@ unsigned load_gba_rom(
     // Cannot append it at the end, it's too big. Check if we have a hole.
     if (!ptch || ptch->hole_size < req_size)
       return ERR_NO_PAYLOAD_SPACE;
+    if (dsinfo && ptch->hole_size >= req_size + DIRSAVE_CACHE_SPACE)
+      ds_space += DIRSAVE_CACHE_SPACE;
 
     ds_addr = ptch->hole_addr;
-    igm_addr = ds_addr + (dsinfo ? DIRSAVE_REQ_SPACE : 0);
-    igm_space = ptch->hole_size - (dsinfo ? DIRSAVE_REQ_SPACE : 0);
+    igm_addr = ds_addr + ds_space;
+    igm_space = ptch->hole_size - ds_space;
   }
   // Round it down to a KB boundary
   igm_space &= ~1023;
@@ -262,44 +439,35 @@ unsigned load_gba_rom(
   FRESULT res = f_open(&fd, fn, FA_READ);
   if (res != FR_OK)
     return ERR_LOAD_BADROM;
+  // Map the cluster chain so that the load is not interrupted by FAT reads.
+  file_fastseek_open(&fd);
 
   // Honor fast loading (switch mirror if appropriate)
   slowsd = use_slowsd;
 
-  uint8_t *ptr = (uint8_t*)(GBA_ROM_ADDR);
-  for (uint32_t offset = 0; offset < gap_start; offset += LOAD_BS) {
-    if (progress && (offset & (256*1024-1)) == 0)
-      progress(offset >> 8, fs >> 8);
-
-    unsigned toread = MIN(LOAD_BS, gap_start - offset);
-    UINT rdbytes;
-    uint32_t tmp[LOAD_BS/4];
-    if (FR_OK != f_read(&fd, tmp, toread, &rdbytes)) {
-      slowsd = true;
-      f_close(&fd);
-      return ERR_LOAD_BADROM;
-    }
-
-    set_supercard_mode(MAPPED_SDRAM, true, false);
-    dma_memcpy32(&ptr[offset], tmp, toread/4);
-    set_supercard_mode(MAPPED_SDRAM, true, true);
-  }
-  for (uint32_t offset = gap_end; offset < fs; offset += LOAD_BS) {
-    if (progress && (offset & (256*1024-1)) == 0)
-      progress(offset >> 8, fs >> 8);
-
-    unsigned toread = MIN(LOAD_BS, fs - offset);
-    UINT rdbytes;
-    uint32_t tmp[LOAD_BS/4];
-    if (FR_OK != f_read(&fd, tmp, toread, &rdbytes)) {
-      slowsd = true;
-      f_close(&fd);
-      return ERR_LOAD_BADROM;
-    }
+  // Patch ops are applied as the ROM is streamed in. Ops that land in the
+  // gap (or past the ROM end) are applied after the payloads are loaded.
+  t_patch_stream ps;
+  if (ptch)
+    patch_stream_init(&ps, ptch, ingame_menu, rtc_clock != NULL, dsinfo ? ds_addr : 0);
 
-    set_supercard_mode(MAPPED_SDRAM, true, false);
-    dma_memcpy32(&ptr[offset], tmp, toread/4);
-    set_supercard_mode(MAPPED_SDRAM, true, true);
+  // Load everything but the gap (if any), where the payloads live.
+  uint8_t *ptr = (uint8_t*)(GBA_ROM_ADDR);
+  const uint32_t load_end = MIN(gap_start, fs);
+  t_load_progress lp = {
+    .progress = progress,
+    .total = load_end + (gap_end < fs ? fs - gap_end : 0),
+    .ps = ptch ? &ps : NULL,
+  };
+  bool ok = stream_rom_data(&fd, ptr, load_end, &lp);
+  if (ok && gap_end < fs)
+    ok = FR_OK == f_lseek(&fd, gap_end) && stream_rom_data(&fd, &ptr[gap_end], fs - gap_end, &lp);
+
+  file_fastseek_close(&fd);
+  if (!ok) {
+    slowsd = true;
+    f_close(&fd);
+    return ERR_LOAD_BADROM;
   }
   progress(1, 1);  // Mark as complete
 
@@ -308,16 +476,22 @@ unsigned load_gba_rom(
   // Close the file, not super necessary really :P
   f_close(&fd);
 
+  // Account the load time now and dump the profile (if enabled), since the
+  // SD card is not accessible past this point.
+  PROF_SCOPE_CLOSE();
+  PROF_DUMP();
+
   // Proceed to patch the ROM
   set_supercard_mode(MAPPED_SDRAM, true, false);
 
   // Load/Patch the DirectSave payload if necessary.
   if (dsinfo)
-    load_directsave_payload(ds_addr, dsinfo);
+    load_directsave_payload(ds_addr, dsinfo,
+                            ds_space > DIRSAVE_REQ_SPACE ? ds_addr + DIRSAVE_REQ_SPACE : 0);
 
-  // Actually apply patches
+  // Apply any remaining patches (and the header ones)
   if (ptch)
-    patch_apply_rom(ptch, rtc_clock, ingame_menu ? igm_addr : 0, dsinfo ? ds_addr : 0);
+    patch_stream_finish(&ps, rtc_clock, ingame_menu ? igm_addr : 0);
 
   // Fix header checksum unconditionally (just in case we boot to BIOS).
   fix_gba_header((uint16_t*)GBA_ROM_ADDR);
@@ -341,13 +515,21 @@ void load_gbc_rom(const char *fn, uint32_t fs, progress_fn progress) {
   // Uncompress the emulator code ROM first
   // Map the full SDRAM address space
   set_supercard_mode(MAPPED_SDRAM, true, false);
-  const void *emupload = get_vfile_ptr("GCEM");
-  if (!emupload) {
-    // In case the emulator is not bundled in.
-    set_supercard_mode(MAPPED_SDRAM, true, true);
-    return;
+  unsigned emusize;
+  const void *emubin = get_vfile_unpacked("GCEM", &emusize);
+  if (emubin) {
+    // Already unpacked in the asset cache, just copy it.
+    memcpy32(ptr, emubin, ROUND_UP2(emusize, 4));
+    ptr += emusize;
+  } else {
+    const void *emupload = get_vfile_ptr("GCEM");
+    if (!emupload) {
+      // In case the emulator is not bundled in.
+      set_supercard_mode(MAPPED_SDRAM, true, true);
+      return;
+    }
+    ptr += apunpack16(emupload, ptr);
   }
-  ptr += apunpack16(emupload, ptr);
   set_supercard_mode(MAPPED_SDRAM, true, true);
 
   // Load the GB/GBC rom immediately after the GBA emulator binary.
@@ -356,26 +538,13 @@ void load_gbc_rom(const char *fn, uint32_t fs, progress_fn progress) {
   if (res != FR_OK)
     return;
 
-  for (uint32_t offset = 0; offset < fs; offset += LOAD_BS) {
-    if (progress && (offset & (64*1024-1)) == 0)
-      progress(offset, fs);
-
-    UINT rdbytes;
-    uint32_t tmp[LOAD_BS/4];
-    if (FR_OK != f_read(&fd, tmp, LOAD_BS, &rdbytes)) {
-      f_close(&fd);
-      return;
-    }
-
-    // Copy data into the ROM (disable SD interface to avoid collisions!)
-    set_supercard_mode(MAPPED_SDRAM, true, false);
-    dma_memcpy32(ptr, tmp, LOAD_BS/4);
-    set_supercard_mode(MAPPED_SDRAM, true, true);
-    ptr += LOAD_BS;
-  }
+  t_load_progress lp = { .progress = progress, .total = fs };
+  bool ok = stream_rom_data(&fd, ptr, fs, &lp);
 
   // Close the file, not super necessary really :P
   f_close(&fd);
+  if (!ok)
+    return;
 
   // Set the ROM into read only mode, disable SD card reader as well.
   set_supercard_mode(MAPPED_SDRAM, false, false);
@@ -397,57 +566,49 @@ unsigned load_extemu_rom(const char *fn, uint32_t fs, const t_emu_loader *ldinfo
   strcat(emupath, ldinfo->emu_name);
   strcat(emupath, ".gba");
 
-  // Load the emulator from disk, check whether it exists tho.
-  FIL fd;
-  if (FR_OK != f_open(&fd, emupath, FA_READ))
+  // Check whether the emulator exists (its size/date validate resident copies).
+  FILINFO info;
+  if (FR_OK != f_stat(emupath, &info))
     return ERR_LOAD_NOEMU;
+  const uint32_t fdt = (info.fdate << 16) | info.ftime;
 
-  while (1) {
-    UINT rdbytes;
-    uint32_t tmp[LOAD_BS/4];
-    if (FR_OK != f_read(&fd, tmp, LOAD_BS, &rdbytes)) {
-      f_close(&fd);
+  // Use the resident emulator copy if possible, load it from disk otherwise.
+  set_supercard_mode(MAPPED_SDRAM, true, false);
+  unsigned emusize = emucache_fetch(ldinfo->emu_name, info.fsize, fdt, ptr);
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+
+  if (!emusize) {
+    FIL fd;
+    if (FR_OK != f_open(&fd, emupath, FA_READ))
+      return ERR_LOAD_NOEMU;
+    bool ok = stream_rom_data(&fd, ptr, info.fsize, NULL);
+    f_close(&fd);
+    if (!ok)
       return ERR_LOAD_NOEMU;
-    }
-    if (!rdbytes)
-      break;
 
-    // Copy data into the ROM (disable SD interface to avoid collisions!)
+    emusize = info.fsize;
     set_supercard_mode(MAPPED_SDRAM, true, false);
-    dma_memcpy32(ptr, tmp, rdbytes/4);
+    emucache_store(ldinfo->emu_name, info.fsize, fdt, ptr);
     set_supercard_mode(MAPPED_SDRAM, true, true);
-    ptr += rdbytes;
   }
-  f_close(&fd);
+  ptr += emusize;
 
   // Generate rom header and what not.
   if (ldinfo->hndlr)
     ptr += ldinfo->hndlr(ptr, fn, fs);
 
   // Proceed to load the ROM now.
+  FIL fd;
   if (FR_OK != f_open(&fd, fn, FA_READ))
     return ERR_LOAD_BADROM;
 
-  for (uint32_t offset = 0; offset < fs; offset += LOAD_BS) {
-    if (progress && (offset & (64*1024-1)) == 0)
-      progress(offset, fs);
-
-    UINT rdbytes;
-    uint32_t tmp[LOAD_BS/4];
-    if (FR_OK != f_read(&fd, tmp, LOAD_BS, &rdbytes)) {
-      f_close(&fd);
-      return ERR_LOAD_BADROM;
-    }
-
-    // Copy data into the ROM (disable SD interface to avoid collisions!)
-    set_supercard_mode(MAPPED_SDRAM, true, false);
-    dma_memcpy32(ptr, tmp, LOAD_BS/4);
-    set_supercard_mode(MAPPED_SDRAM, true, true);
-    ptr += LOAD_BS;
-  }
+  t_load_progress lp = { .progress = progress, .total = fs };
+  bool ok = stream_rom_data(&fd, ptr, fs, &lp);
 
   // Close the file, not super necessary really :P
   f_close(&fd);
+  if (!ok)
+    return ERR_LOAD_BADROM;
 
   // Set the ROM into read only mode, disable SD card reader as well.
   set_supercard_mode(MAPPED_SDRAM, false, false);
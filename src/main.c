@@ -27,6 +27,8 @@
 #include "fonts/font_render.h"
 #include "common.h"
 #include "fatfs/ff.h"
+#include "profiler.h"
+#include "iotrace.h"
 
 // Global variables
 FATFS sdfs;          // FatFS mounted filesystem
@@ -137,20 +139,31 @@ static int main_gba() {
   // This hangs on failure since it is fatal.
   init_sdcard_and_mount();
 
+  // Load the boot state blob (settings, recent list and pending operations).
+  // If not valid, probe for pending stuff and use the regular settings files.
+  // The (low) scratch area is not used until the menu is up and running.
+  bool bstvalid = bootstate_load((void*)ROM_SCRATCH_U8);
+  unsigned pending = bstvalid ? bootstate_pending() : ~0U;
+
   // Check if we need to save SRAM before doing anything else.
-  check_pending_saves();
+  if (pending & BOOTSTATE_PEND_SAVE)
+    check_pending_saves();
 
   // Check if there's a pending SRAM test and perform it.
-  int sram_tres = check_peding_sram_test();
+  int sram_tres = (pending & BOOTSTATE_PEND_SRAMTEST) ? check_peding_sram_test() : -1;
+  bootstate_clear_pending();
 
   // Load settings files
-  load_settings();
+  if (!bstvalid)
+    load_settings();
 
   // Load patchdb info.
   set_supercard_mode(MAPPED_SDRAM, true, false);
   memset(&pdbinfo, 0, sizeof(pdbinfo));
   patchmem_dbinfo((uint8_t*)ROM_PATCHDB_U8, &pdbinfo.patch_count, pdbinfo.version, pdbinfo.date, pdbinfo.creator);
   set_supercard_mode(MAPPED_SDRAM, true, true);
+  if (patchusr_init(USRPATCHDB_FILEPATH))
+    patchusr_dbinfo(&pdbinfo.usr_patch_count);
 
   // Configure video mode so we can render the menu.
   setup_video();
@@ -163,6 +176,13 @@ static int main_gba() {
   REG_IME = 1;
   set_irq_enable(true);
 
+  #ifdef PROFILER_ENABLED
+  prof_init();
+  #endif
+  #ifdef IOTRACE_ENABLED
+  iotrace_init();
+  #endif
+
   // Initialize menu, start displaying some UI to the user.
   menu_init(sram_tres);
 
@@ -180,6 +200,10 @@ static int main_gba() {
     unsigned cframe = frame_count;
     menu_render(frame_count - prev_frame);
 
+    // Use the remaining frame time (if any) to prefetch stuff.
+    if (REG_VCOUNT < 120)
+      menu_idle();
+
     wait_for_vblank();    // Avoid tearing.
     menu_flip();
     prev_frame = cframe;
@@ -199,7 +223,7 @@ static int main_nds() {
   check_pending_saves();
 
   // Proceed to load BOOT.NDS from disk, if exists
-  unsigned errc = load_nds("/BOOT.NDS", (void*)dldi_payload);
+  unsigned errc = load_nds("/BOOT.NDS", (void*)dldi_payload, (void*)dldi_payload_fast);
 
   if (errc)
     fatal_init_error("Cannot load BOOT.NDS: %d", errc);
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+// SDRAM test engine.
+// Runs an address line test, a bank aliasing test and a March C- test. The
+// march test runs in small blocks that are backed up (using DMA) and restored
+// afterwards, so the menu state, fonts and assets in SDRAM survive the test.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "gbahw.h"
+#include "common.h"
+#include "memtest.h"
+
+#define BANK_PROBES       8     // Locations (rows) checked per bank
+
+// Halfword offset for each address line (zero for the base address)
+#define LINE_OFF(n)       ((n) ? 1U << ((n) - 1) : 0)
+
+// Checks that every address line toggles independently. Returns a bitmask
+// of the failing lines (bit N is line AN).
+static uint32_t sdram_test_addr_lines() {
+  volatile uint16_t *sd = (uint16_t*)GBA_ROM_BASE;
+  uint16_t saved[SDRAM_TEST_ADDR_BITS];
+  uint32_t fails = 0;
+
+  for (unsigned n = 0; n < SDRAM_TEST_ADDR_BITS; n++) {
+    saved[n] = sd[LINE_OFF(n)];
+    sd[LINE_OFF(n)] = 0x5555;
+  }
+
+  // Writing one location must not modify any other (stuck high or shorted lines).
+  for (unsigned n = 1; n < SDRAM_TEST_ADDR_BITS; n++) {
+    sd[LINE_OFF(n)] = 0xAAAA;
+    for (unsigned m = 0; m < SDRAM_TEST_ADDR_BITS; m++)
+      if (m != n && sd[LINE_OFF(m)] != 0x5555)
+        fails |= (1U << n) | (m ? 1U << m : 0);
+    sd[LINE_OFF(n)] = 0x5555;
+  }
+
+  // Writing the base address must not modify any other (stuck low lines).
+  sd[0] = 0xAAAA;
+  for (unsigned n = 1; n < SDRAM_TEST_ADDR_BITS; n++)
+    if (sd[LINE_OFF(n)] != 0x5555)
+      fails |= 1U << n;
+
+  for (unsigned n = 0; n < SDRAM_TEST_ADDR_BITS; n++)
+    sd[LINE_OFF(n)] = saved[n];
+
+  return fails;
+}
+
+// Writes a different signature to the same locations in every bank, and then
+// reads them back, to detect banks aliasing each other. Returns a bitmask of
+// the failing banks.
+static uint32_t sdram_test_banks() {
+  uint32_t saved[SDRAM_TEST_BANKS][BANK_PROBES];
+  uint32_t fails = 0;
+
+  for (unsigned b = 0; b < SDRAM_TEST_BANKS; b++) {
+    for (unsigned p = 0; p < BANK_PROBES; p++) {
+      volatile uint32_t *ptr = (uint32_t*)(GBA_ROM_BASE + b * SDRAM_TEST_BANK_SIZE +
+                                           p * (SDRAM_TEST_BANK_SIZE / BANK_PROBES) + p * 4);
+      saved[b][p] = *ptr;
+      *ptr = 0x5AA50000 | (b << 8) | p;
+    }
+  }
+
+  for (unsigned b = 0; b < SDRAM_TEST_BANKS; b++) {
+    for (unsigned p = 0; p < BANK_PROBES; p++) {
+      volatile uint32_t *ptr = (uint32_t*)(GBA_ROM_BASE + b * SDRAM_TEST_BANK_SIZE +
+                                           p * (SDRAM_TEST_BANK_SIZE / BANK_PROBES) + p * 4);
+      if (*ptr != (0x5AA50000 | (b << 8) | p))
+        fails |= 1U << b;
+      *ptr = saved[b][p];
+    }
+  }
+
+  return fails;
+}
+
+// March C-: any(w0); up(r0,w1); up(r1,w0); down(r0,w1); down(r1,w0); any(r0)
+// Returns NULL or the address of the first failing group.
+static uint32_t *march_block(uint32_t *blk, unsigned bytes) {
+  uint32_t *f;
+  memtest_fill(blk, 0, 0, bytes);
+  if ((f = memtest_rw_up(blk, 0, ~0U, bytes)))
+    return f;
+  if ((f = memtest_rw_up(blk, ~0U, 0, bytes)))
+    return f;
+  if ((f = memtest_rw_down(blk, 0, ~0U, bytes)))
+    return f;
+  if ((f = memtest_rw_down(blk, ~0U, 0, bytes)))
+    return f;
+  return memtest_check(blk, 0, 0, bytes);
+}
+
+unsigned sdram_test(progress_abort_fn progcb, t_sdram_report *report) {
+  memset(report, 0, sizeof(*report));
+
+  // Run the quick tests first, they find most wiring issues.
+  report->addr_lines = sdram_test_addr_lines();
+  report->banks = sdram_test_banks();
+
+  const unsigned nblocks = SDRAM_TEST_SIZE / SDRAM_TEST_BLOCK;
+  uint32_t tmp[SDRAM_TEST_BLOCK / sizeof(uint32_t)];
+  for (unsigned i = 0; i < nblocks; i++) {
+    uint32_t *blk = (uint32_t*)(GBA_ROM_BASE + i * SDRAM_TEST_BLOCK);
+    // Skip the last group, it holds the CPLD control register.
+    const unsigned bytes = SDRAM_TEST_BLOCK - (i == nblocks - 1 ? 32 : 0);
+
+    dma_memcpy32(tmp, blk, bytes / sizeof(uint32_t));
+    uint32_t *f = march_block(blk, bytes);
+    dma_memcpy32(blk, tmp, bytes / sizeof(uint32_t));
+
+    if (f) {
+      uint32_t addr = (uintptr_t)f;
+      if (!report->fail_addr)
+        report->fail_addr = addr;
+      report->banks |= 1U << ((addr - GBA_ROM_BASE) / SDRAM_TEST_BANK_SIZE);
+    }
+
+    // Update progress every now and then (the block is restored by now).
+    if (!(i & 63) && progcb(i, nblocks))
+      return SDRAM_TEST_ABORTED;
+  }
+
+  return (report->addr_lines || report->banks) ? SDRAM_TEST_FAILED : SDRAM_TEST_OK;
+}
+
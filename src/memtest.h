@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MEMTEST_H_
+#define _MEMTEST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common.h"
+
+// SDRAM geometry, as seen from the GBA bus. The bank split is assumed to be
+// on the top address bits (4 internal banks, 8MiB each).
+#define SDRAM_TEST_SIZE        (32*1024*1024)
+#define SDRAM_TEST_BANKS       4
+#define SDRAM_TEST_BANK_SIZE   (SDRAM_TEST_SIZE / SDRAM_TEST_BANKS)
+#define SDRAM_TEST_BLOCK       (4*1024)     // Tested (and backed up) at once
+#define SDRAM_TEST_ADDR_BITS   25           // Base address plus lines A1 to A24
+
+#define SDRAM_TEST_OK          0
+#define SDRAM_TEST_FAILED      1
+#define SDRAM_TEST_ABORTED     2
+
+typedef struct {
+  uint32_t addr_lines;         // Bitmask of failing (byte) address lines
+  uint32_t banks;              // Bitmask of banks with failing cells
+  uint32_t fail_addr;          // First failing address (zero if none)
+} t_sdram_report;
+
+// Tests the whole SDRAM: address lines, bank aliasing and a March C- test
+// (run block by block). Memory contents are preserved, so the fonts and
+// other assets remain valid. Returns one of the SDRAM_TEST_* codes.
+unsigned sdram_test(progress_abort_fn progcb, t_sdram_report *report);
+
+// March elements (memtest.S), see the asm file for details.
+void memtest_fill(uint32_t *ptr, uint32_t unused, uint32_t value, unsigned bytes);
+uint32_t *memtest_check(uint32_t *ptr, uint32_t expected, uint32_t unused, unsigned bytes);
+uint32_t *memtest_rw_up(uint32_t *ptr, uint32_t expected, uint32_t value, unsigned bytes);
+uint32_t *memtest_rw_down(uint32_t *ptr, uint32_t expected, uint32_t value, unsigned bytes);
+
+#endif
+
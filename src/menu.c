@@ -33,7 +33,13 @@
 #include "ingame.h"
 #include "emu.h"
 #include "sha256.h"
+#include "crc.h"
 #include "supercard_driver.h"
+#include "sdbench.h"
+#include "memtest.h"
+#include "gamedb.h"
+#include "profiler.h"
+#include "iotrace.h"
 
 #include "res/icons.h"
 #include "res/logo.h"
@@ -69,6 +75,8 @@ extern bool slowsd;
 #define RECENT_MAXFN_CNT          (200)
 #define BROWSER_ROWS                 8
 #define RECENT_ROWS                  9
+#define PREFETCH_CNT                 8    // ROMs around the selector with prefetched metadata
+#define PREFETCH_SETTLE             10    // Idle calls (frames) before prefetching
 
 #define FAST_ANIM 16           // The threshold for an animation to be considered fast
 #define FAST_ANIM_FRAME_SKIP 8 // The number of frames to skip when rendering fast animations
@@ -85,6 +93,13 @@ extern bool slowsd;
 #define SEL_COLOR       255
 
 #define FLASH_UNLOCK_KEYS      (KEY_BUTTDOWN|KEY_BUTTB|KEY_BUTTSTA)
+
+// Profiler builds get an extra info page (with the profiling table)
+#ifdef PROFILER_ENABLED
+  #define INFO_PAGES             4
+#else
+  #define INFO_PAGES             3
+#endif
 #define FLASH_GO_KEYS          (KEY_BUTTUP|KEY_BUTTL|KEY_BUTTR)
 
 
@@ -205,6 +220,7 @@ static struct {
     int selector;                 // Pointed file offset
     int seloff;                   // Entry at the top of the list
     int maxentries;               // Total file/dir count in current dir
+    bool partial;                 // Some files are not listed (hidden or too many)
   } browser;
 
   // UI settings
@@ -319,11 +335,55 @@ typedef struct {
 } t_rentry;
 _Static_assert (sizeof(t_rentry) % 4 == 0, "t_rentry must be word-friendly");
 
+// Recent list journal record. Records are a full sector long, so that appends
+// never straddle sectors and a torn write can only damage the last record.
+#define RECENT_JNL_MAGIC       0x4A52      // "RJ"
+#define RECENT_JNL_PUSH        1           // Move (or insert) path to the front
+#define RECENT_JNL_DELETE      2           // Remove path from the list
+#define RECENT_JNL_MAXRECS     32          // Compact the list past this count
+
+typedef struct {
+  uint16_t magic;
+  uint8_t op;
+  uint8_t pad;
+  uint32_t crc;              // CRC32 of fpath (whole field)
+  char fpath[MAX_FN_LEN];
+  uint8_t padding[512 - 8 - MAX_FN_LEN];
+} t_rjrecord;
+_Static_assert (sizeof(t_rjrecord) == 512, "t_rjrecord must be one sector");
+
+static unsigned recent_jnl_count;    // Number of records in the journal
+
+// ROM metadata, prefetched in the background for the browser selected entries.
+// It is filled in steps (one SD access each) so that the browser never stalls.
+#define PF_HEADER                    0
+#define PF_PATCHDB                   1
+#define PF_GAMEDB                    2
+#define PF_CONFIG                    3
+#define PF_CHEATS                    4
+#define PF_DONE                      5
+
+typedef struct {
+  uint32_t pathhash;                   // ROM full path hash (zero if unused)
+  uint32_t romfs;                      // ROM file size
+  uint8_t step;                        // Next PF_* step
+  bool header_ok;                      // Header could be read
+  bool patches_datab_found;            // Patch database lookup result
+  bool gm_found;                       // Metadata DB lookup result
+  bool cfg_found;                      // ROM config file stat result
+  bool cheats_db_found;                // Cheats DB file probe result
+  uint32_t cfgstamp[2];                // ROM config file size and date
+  t_rom_header romh;
+  t_patch patches_datab;
+  t_gamedb_entry gment;
+} t_prefetch;
+
 // Pointer to SDRAM, where we place some data:
 //  - Scratch area 512KB (for FW updates)
 //  - File list order (~64KiB)
 //  - Browser file information (~13MB)
 //  - Recently played ROMs table (~64KiB)
+//  - Prefetched ROM metadata (~10KiB)
 //  - Font data (placed by the bootloader at the 15..16MB range)
 // At the end of the SDRAM, ro-data can be loaded by the loader.
 typedef struct {
@@ -331,6 +391,7 @@ typedef struct {
   t_centry *fileorder[BROWSER_MAXFN_CNT];
   t_centry fentries[BROWSER_MAXFN_CNT];
   t_rentry rentries[RECENT_MAXFN_CNT];
+  t_prefetch prefetch[PREFETCH_CNT];
 } t_sdram_state;
 
 _Static_assert (sizeof(t_sdram_state) <= 15*1024*1024, "scratch SDRAM doesn't exceed 15MB");
@@ -356,10 +417,25 @@ typedef struct {
 } t_oamobj;
 
 static bool enable_flashing = false;
+static unsigned prefetch_next = 0;
+static int prefetch_selector = -1;
+static unsigned prefetch_idle = 0;
 static unsigned framen = 0;
 static unsigned objnum = 0;
 static t_oamobj fobjs[64];
 
+static void prefetch_reset() {
+  for (unsigned i = 0; i < PREFETCH_CNT; i++)
+    sdr_state->prefetch[i].pathhash = 0;
+}
+
+static t_prefetch *prefetch_find(uint32_t pathhash, uint32_t fs) {
+  for (unsigned i = 0; i < PREFETCH_CNT; i++)
+    if (sdr_state->prefetch[i].pathhash == pathhash && sdr_state->prefetch[i].romfs == fs)
+      return &sdr_state->prefetch[i];
+  return NULL;
+}
+
 unsigned lang_lookup(uint16_t code) {
   for (unsigned i = 0; i < LANG_COUNT; i++)
     if (lang_codes[i] == code)
@@ -453,17 +529,21 @@ bool generate_patches_progress(const char *fn, unsigned fs) {
   FRESULT res = f_open(&fd, fn, FA_READ);
   if (res != FR_OK)
     return false;
+  file_fastseek_open(&fd);
 
   t_patch_builder pb;
   patchengine_init(&pb, fs);
-  const unsigned max_hiscratch = 8*1024*1024;
+  const unsigned max_hiscratch = ROM_OFF_ASSETCACHE - ROM_OFF_HISCRATCH;   // 8MB
 
   for (unsigned i = 0; i < fs; i += max_hiscratch) {
     for (unsigned j = 0; j < max_hiscratch && i + j < fs; j += 4096) {
       UINT rdbytes;
       uint32_t tmp[4096/4];
-      if (FR_OK != f_read(&fd, tmp, sizeof(tmp), &rdbytes))
+      if (FR_OK != f_read(&fd, tmp, sizeof(tmp), &rdbytes)) {
+        file_fastseek_close(&fd);
+        f_close(&fd);
         return false;
+      }
 
       set_supercard_mode(MAPPED_SDRAM, true, false);
       dma_memcpy32(&hiscratch[j], tmp, sizeof(tmp)/4);
@@ -485,11 +565,17 @@ bool generate_patches_progress(const char *fn, unsigned fs) {
     set_supercard_mode(MAPPED_SDRAM, true, true);
   }
 
+  file_fastseek_close(&fd);
   f_close(&fd);
   patchengine_finalize(&pb);
 
   // Proceed to write patches to their cache.
-  return write_patches_cache(fn, &pb.p);
+  if (!write_patches_cache(fn, &pb.p))
+    return false;
+
+  gamedb_update(fn, GMD_PCACHE_CHECKED | GMD_PCACHE, NULL, NULL);
+  prefetch_reset();
+  return true;
 }
 
 bool dump_flashmem_backup() {
@@ -581,13 +667,96 @@ bool dirsav_avail() {
   return (p && supports_directsave(p->save_mode));
 }
 
+// Checks whether a file exists using the browser listing, if the file lives in
+// the current browser directory. Returns false if the listing can't tell (the
+// SD card must be checked then).
+static bool browser_listed(const char *fn, bool *found) {
+  const char *bn = file_basename(fn);
+  unsigned dl = strlen(smenu.browser.cpath);
+  if (smenu.browser.partial || bn - fn != dl || strncmp(fn, smenu.browser.cpath, dl))
+    return false;
+  if (bn[0] == '.' && !show_hidden_files)
+    return false;    // Dot files are not listed
+
+  *found = false;
+  for (int i = 0; i < smenu.browser.maxentries && !*found; i++)
+    *found = !sdr_state->fentries[i].isdir && !strcasecmp(sdr_state->fentries[i].fname, bn);
+
+  // Non-ASCII names might still match (FAT is case insensitive), check those.
+  for (const char *c = bn; *c && !*found; c++)
+    if (*c & 0x80)
+      return false;
+
+  return true;
+}
+
+static bool browser_file_exists(const char *fn) {
+  bool found;
+  return browser_listed(fn, &found) ? found : check_file_exists(fn);
+}
+
+// Cheats file path in the cheats DB, using the game ID and version.
+static void cheats_db_filename(const t_rom_header *rmh, char *fn) {
+  npf_snprintf(fn, MAX_FN_LEN, CHEATS_PATH "%c%c%c%c-%02x.cht",
+               rmh->gcode[0], rmh->gcode[1], rmh->gcode[2], rmh->gcode[3], rmh->version);
+}
+
+// Runs the next prefetch step: reads the ROM header, looks up the patch and
+// metadata databases and checks the config and cheats DB files.
+static void prefetch_step(t_prefetch *pf, const char *fn) {
+  const t_rom_header *rmh = &pf->romh;
+  switch (pf->step++) {
+  case PF_HEADER:
+    pf->header_ok = !preload_gba_rom(fn, pf->romfs, &pf->romh);
+    if (!pf->header_ok)
+      pf->step = PF_DONE;
+    break;
+  case PF_PATCHDB:
+    {
+      uint8_t gamecode[5] = {
+        rmh->gcode[0], rmh->gcode[1],
+        rmh->gcode[2], rmh->gcode[3],
+        rmh->version
+      };
+      pf->patches_datab_found = patchdb_lookup(gamecode, &pf->patches_datab);
+    }
+    break;
+  case PF_GAMEDB:
+    pf->gm_found = gamedb_lookup(fn, rmh, pf->romfs, &pf->gment);
+    break;
+  case PF_CONFIG:
+    pf->cfg_found = rom_settings_stamp(fn, pf->cfgstamp);
+    break;
+  case PF_CHEATS:
+    // Cheats DB hits are cached already, only misses need probing.
+    pf->cheats_db_found = false;
+    if (!(pf->gment.flags & GMD_CHEATS_DB)) {
+      char cheatsfn[MAX_FN_LEN];
+      cheats_db_filename(rmh, cheatsfn);
+      pf->cheats_db_found = check_file_exists(cheatsfn);
+    }
+    break;
+  };
+}
+
 static void browser_open_gba(const char *fn, uint32_t fs, bool prompt_patchgen) {
+  // Use the prefetched data if available (consume it, since it might change).
+  t_prefetch *pf = prefetch_find(gamedb_hash(fn), fs);
+  if (pf) {
+    pf->pathhash = 0;
+    if (pf->step != PF_DONE || !pf->header_ok)
+      pf = NULL;
+  }
+
   if (fs > MAX_GBA_ROM_SIZE) {
     // The ROM is too big to be loaded!
     spop.alert_msg = msgs[lang_id][MSG_ERR_TOOBIG];
-  } else if (preload_gba_rom(fn, fs, &spop.p.load.romh)) {
+  } else if (!pf && preload_gba_rom(fn, fs, &spop.p.load.romh)) {
     spop.alert_msg = msgs[lang_id][MSG_ERR_READ];
   } else {
+    if (pf)
+      memcpy32(&spop.p.load.romh, &pf->romh, sizeof(spop.p.load.romh));
+
     // Fill in the requested ROM info (some hacky tricks used!)
     if (fn != spop.p.load.romfn)
       strcpy(spop.p.load.romfn, fn);
@@ -605,17 +774,41 @@ static void browser_open_gba(const char *fn, uint32_t fs, bool prompt_patchgen)
       rmh->gcode[2], rmh->gcode[3],
       rmh->version
     };
-    set_supercard_mode(MAPPED_SDRAM, true, false);
-    spop.p.load.patches_datab_found = patchmem_lookup(
-            gamecode, (uint8_t*)ROM_PATCHDB_U8, &spop.p.load.patches_datab);
-    set_supercard_mode(MAPPED_SDRAM, true, true);
+    if (pf) {
+      spop.p.load.patches_datab_found = pf->patches_datab_found;
+      memcpy32(&spop.p.load.patches_datab, &pf->patches_datab, sizeof(spop.p.load.patches_datab));
+    } else
+      spop.p.load.patches_datab_found = patchdb_lookup(gamecode, &spop.p.load.patches_datab);
 
     bool issfw = is_superfw(&spop.p.load.romh);
 
+    // Check the metadata DB first. Cheats DB misses are not cached, they are
+    // probed again since the files could have been copied later on.
+    t_gamedb_entry gment;
+    bool gm_found;
+    if (pf) {
+      gm_found = pf->gm_found;
+      gment = pf->gment;
+    } else
+      gm_found = gamedb_lookup(fn, rmh, fs, &gment);
+    uint8_t gm_flags = gment.flags;
+    bool gm_dirty = !gm_found;
+
     // Attempt to load any existing patch and check also the PE cache dir.
-    spop.p.load.patches_cache_found = load_rom_patches(fn, &spop.p.load.patches_cache);
-    if (!spop.p.load.patches_cache_found)
-      spop.p.load.patches_cache_found = load_cached_patches(fn, &spop.p.load.patches_cache);
+    // The browser listing tells whether there's a .patch file next to the ROM.
+    // The PE cache is only written by the firmware, so its misses are cached.
+    char patchfn[MAX_FN_LEN];
+    bool patchfn_found;
+    strcpy(patchfn, fn);
+    replace_extension(patchfn, ".patch");
+    spop.p.load.patches_cache_found = false;
+    if (!browser_listed(patchfn, &patchfn_found) || patchfn_found)
+      spop.p.load.patches_cache_found = load_rom_patches(fn, &spop.p.load.patches_cache);
+    if (!spop.p.load.patches_cache_found) {
+      if (!(gment.flags & GMD_PCACHE_CHECKED) || (gment.flags & GMD_PCACHE))
+        spop.p.load.patches_cache_found = load_cached_patches(fn, &spop.p.load.patches_cache);
+      gment.flags = gamedb_flag(gment.flags, GMD_PCACHE, spop.p.load.patches_cache_found) | GMD_PCACHE_CHECKED;
+    }
 
     // Default to global settings (in case the file is not found).
     t_rom_settings savedcfg = {
@@ -627,8 +820,28 @@ static void browser_open_gba(const char *fn, uint32_t fs, bool prompt_patchgen)
       .use_rtc = rtcpatch_default
     };
     // Check for any game-specific config file, so we don't have to guess the config.
-    // The config file can be partial, hence the defaults.
-    spop.p.load.write_config = load_rom_settings(fn, &savedcfg);
+    // The config file can be partial, hence the defaults. The cached config is
+    // only used if the file was not modified (ie. edited by hand).
+    uint32_t cfgstamp[2];
+    bool cfg_found;
+    if (pf) {
+      cfg_found = pf->cfg_found;
+      memcpy(cfgstamp, pf->cfgstamp, sizeof(cfgstamp));
+    } else
+      cfg_found = rom_settings_stamp(fn, cfgstamp);
+
+    spop.p.load.write_config = false;
+    if (cfg_found && gamedb_config_valid(&gment, cfgstamp)) {
+      spop.p.load.write_config = true;
+      gamedb_get_config(&gment, &savedcfg);
+    } else {
+      gment.flags &= ~GMD_CONFIG;
+      if (cfg_found && load_rom_settings(fn, &savedcfg)) {
+        spop.p.load.write_config = true;
+        gamedb_set_config(&gment, &savedcfg, cfgstamp);
+        gm_dirty = true;
+      }
+    }
 
     // Attempt to find a cheat file if cheats are enabled.
     spop.p.load.cheats_size = 0;
@@ -636,12 +849,12 @@ static void browser_open_gba(const char *fn, uint32_t fs, bool prompt_patchgen)
     if (enable_cheats) {
       strcpy(spop.p.load.cheatsfn, fn);
       replace_extension(spop.p.load.cheatsfn, ".cht");
-      spop.p.load.cheats_found = check_file_exists(spop.p.load.cheatsfn);
+      spop.p.load.cheats_found = browser_file_exists(spop.p.load.cheatsfn);
       if (!spop.p.load.cheats_found) {
-        // Create a path using the game ID and version.
-        npf_snprintf(spop.p.load.cheatsfn, sizeof(spop.p.load.cheatsfn), CHEATS_PATH "%c%c%c%c-%02x.cht",
-                     rmh->gcode[0], rmh->gcode[1], rmh->gcode[2], rmh->gcode[3], rmh->version);
-        spop.p.load.cheats_found = check_file_exists(spop.p.load.cheatsfn);
+        cheats_db_filename(rmh, spop.p.load.cheatsfn);
+        // A cached hit is validated when the file is read below.
+        spop.p.load.cheats_found = (gment.flags & GMD_CHEATS_DB) ||
+                                   (pf ? pf->cheats_db_found : check_file_exists(spop.p.load.cheatsfn));
 
         // Load the cheats into memory if enabled.
         if (spop.p.load.cheats_found) {
@@ -654,10 +867,15 @@ static void browser_open_gba(const char *fn, uint32_t fs, bool prompt_patchgen)
           else
             spop.p.load.cheats_size = cheatsz;
         }
+        gment.flags = gamedb_flag(gment.flags, GMD_CHEATS_DB, spop.p.load.cheats_found);
       }
     }
     spop.p.load.use_cheats = enable_cheats && spop.p.load.cheats_found && savedcfg.use_cheats;
 
+    // Store the probing results, if anything changed.
+    if (gm_dirty || gm_flags != gment.flags)
+      gamedb_store(fn, rmh, fs, &gment);
+
     // If patch engine is selected but no patches found, prompt for generation.
     // If auto is selected and no patches nor DB entries found, do prompt too.
     bool no_patches = (savedcfg.patch_policy == PatchAuto && !spop.p.load.patches_datab_found && !spop.p.load.patches_cache_found);
@@ -677,7 +895,7 @@ static void browser_open_gba(const char *fn, uint32_t fs, bool prompt_patchgen)
 
     // Calculate the .sav file name, and check its existance.
     sram_template_filename_calc(fn, ".sav", spop.p.load.savefn);
-    spop.p.load.savefile_found = check_file_exists(spop.p.load.savefn);
+    spop.p.load.savefile_found = browser_file_exists(spop.p.load.savefn);
 
     // If PatchAuto is selected, resolve it. Downgrade if not found.
     if (savedcfg.patch_policy == PatchAuto) {
@@ -757,28 +975,65 @@ const t_emu_loader * get_emu_info(const char *ext) {
   return NULL;
 }
 
+// Installs the patch DB as the user DB, which is looked up before the builtin
+// one. Its entries are read on demand from the SD card, so it can be large.
+// The file is copied to a temporary file first, and only replaces the current
+// user DB once it is validated.
 static void load_patchdb_action(bool confirm) {
   if (confirm) {
-    FIL fd;
-    FRESULT res = f_open(&fd, spop.p.pdb_ld.fn, FA_READ);
-    if (res != FR_OK) {
-      spop.alert_msg = msgs[lang_id][MSG_ERR_GENERIC];
-      return;
-    } else {
-      for (unsigned off = 0; off < spop.p.pdb_ld.fs; off += 1024) {
-        UINT rdbytes;
-        uint32_t tmp[1024/4];
-        if (FR_OK != f_read(&fd, tmp, sizeof(tmp), &rdbytes)) {
-          spop.alert_msg = msgs[lang_id][MSG_ERR_GENERIC];
-          return;
-        }
+    const char *dbfn = USRPATCHDB_FILEPATH;
+    bool imported = false;
+    if (strcasecmp(spop.p.pdb_ld.fn, USRPATCHDB_FILEPATH)) {
+      FIL fi, fo;
+      if (FR_OK != f_open(&fi, spop.p.pdb_ld.fn, FA_READ)) {
+        spop.alert_msg = msgs[lang_id][MSG_ERR_GENERIC];
+        return;
+      }
+      if (FR_OK != f_open(&fo, USRPATCHDBTMP_FILEPATH, FA_WRITE | FA_CREATE_ALWAYS)) {
+        f_close(&fi);
+        spop.alert_msg = msgs[lang_id][MSG_ERR_GENERIC];
+        return;
+      }
 
-        set_supercard_mode(MAPPED_SDRAM, true, false);
-        dma_memcpy32(ROM_PATCHDB_U8 + off, tmp, sizeof(tmp)/4);
-        set_supercard_mode(MAPPED_SDRAM, true, true);
+      bool ok = true;
+      for (unsigned off = 0; ok && off < spop.p.pdb_ld.fs; off += 1024) {
+        UINT rdbytes, wrbytes;
+        uint32_t tmp[1024/4];
+        ok = FR_OK == f_read(&fi, tmp, sizeof(tmp), &rdbytes) &&
+             FR_OK == f_write(&fo, tmp, rdbytes, &wrbytes) && wrbytes == rdbytes;
+      }
+      f_close(&fi);
+      ok = (FR_OK == f_close(&fo)) && ok;
+      if (!ok) {
+        f_unlink(USRPATCHDBTMP_FILEPATH);
+        spop.alert_msg = msgs[lang_id][MSG_ERR_GENERIC];
+        return;
       }
+      dbfn = USRPATCHDBTMP_FILEPATH;
+      imported = true;
+    }
+
+    // Prefetched lookups are stale now.
+    prefetch_reset();
+    bool ok = patchusr_init(dbfn);
+    if (ok && imported) {
+      // Lookups read the entries from the final path. The previous DB (if
+      // any) is moved aside and only deleted once the new one is in place.
+      f_unlink(USRPATCHDBBAK_FILEPATH);
+      bool hadprev = FR_OK == f_rename(USRPATCHDB_FILEPATH, USRPATCHDBBAK_FILEPATH);
+      ok = FR_OK == f_rename(USRPATCHDBTMP_FILEPATH, USRPATCHDB_FILEPATH);
+      if (ok)
+        f_unlink(USRPATCHDBBAK_FILEPATH);
+      else if (hadprev)
+        f_rename(USRPATCHDBBAK_FILEPATH, USRPATCHDB_FILEPATH);
     }
-    spop.alert_msg = msgs[lang_id][MSG_OK_GENERIC];
+    if (!ok) {
+      // Keep using the previous DB (if any).
+      f_unlink(USRPATCHDBTMP_FILEPATH);
+      patchusr_init(USRPATCHDB_FILEPATH);
+    }
+    patchusr_dbinfo(&pdbinfo.usr_patch_count);
+    spop.alert_msg = msgs[lang_id][ok ? MSG_OK_GENERIC : MSG_ERR_GENERIC];
   }
 }
 
@@ -951,6 +1206,7 @@ static void insert_recent_fn(const char *fn) {
   }
 
   // Not in the list, push all items back and insert it in the first position
+  // (the last entry falls off the list if it is full).
   if (smenu.recent.maxentries) {
     unsigned movecnt = MIN(smenu.recent.maxentries, RECENT_MAXFN_CNT - 1);
     memmove32(&sdr_state->rentries[1], &sdr_state->rentries[0], movecnt * sizeof(sdr_state->rentries[0]));
@@ -959,10 +1215,36 @@ static void insert_recent_fn(const char *fn) {
   const char *pbn = file_basename(fn);
   sdr_state->rentries[0].fname_offset = pbn - fn;
   dma_memcpy16(sdr_state->rentries[0].fpath, fn, (strlen(fn) + 1 + 1) / 2);
-  smenu.recent.maxentries++;
+  smenu.recent.maxentries = MIN(smenu.recent.maxentries + 1, RECENT_MAXFN_CNT);
+}
+
+static void remove_recent_entry(unsigned entry_num) {
+  if (entry_num + 1 < smenu.recent.maxentries)
+    memmove32(&sdr_state->rentries[entry_num], &sdr_state->rentries[entry_num + 1],
+              (smenu.recent.maxentries - (entry_num + 1)) * sizeof(sdr_state->rentries[0]));
+  smenu.recent.maxentries--;
+}
+
+static void remove_recent_fn(const char *fn) {
+  for (unsigned i = 0; i < smenu.recent.maxentries; i++) {
+    if (!strcmp(sdr_state->rentries[i].fpath, fn)) {
+      remove_recent_entry(i);
+      return;
+    }
+  }
+}
+
+static const char *recent_entry(unsigned i) {
+  return sdr_state->rentries[i].fpath;
+}
+
+static bool recent_bootstate_save() {
+  return bootstate_save(smenu.recent.maxentries, recent_entry);
 }
 
-static bool recent_flush() {
+// Writes the full list to disk (text file and boot state blob) and drops the
+// journal, since it is now part of the snapshot.
+static bool recent_compact() {
   // Flush to disk!
   FIL fo;
   if (FR_OK != f_open(&fo, RECENT_FILEPATH, FA_WRITE | FA_CREATE_ALWAYS))
@@ -1001,27 +1283,113 @@ static bool recent_flush() {
   }
 
   f_close(&fo);
+
+  // Keep the boot state blob in sync too
+  if (!recent_bootstate_save())
+    return false;
+
+  // The snapshot is complete, the journal can go now.
+  FRESULT res = f_unlink(RECENT_JOURNAL_FILEPATH);
+  if (res != FR_OK && res != FR_NO_FILE)
+    return false;
+  recent_jnl_count = 0;
+  return true;
+}
+
+// Appends a single record to the journal. Compacts the list instead if the
+// journal is long enough (or cannot be written).
+static bool recent_journal_append(unsigned op, const char *fn) {
+  if (recent_jnl_count >= RECENT_JNL_MAXRECS)
+    return recent_compact();
+
+  t_rjrecord rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.magic = RECENT_JNL_MAGIC;
+  rec.op = op;
+  strcpy(rec.fpath, fn);
+  rec.crc = crc32_update(0, (uint8_t*)rec.fpath, sizeof(rec.fpath));
+
+  FIL fo;
+  if (FR_OK != f_open(&fo, RECENT_JOURNAL_FILEPATH, FA_WRITE | FA_OPEN_APPEND))
+    return recent_compact();
+
+  UINT wrbytes;
+  FRESULT res = f_write(&fo, &rec, sizeof(rec), &wrbytes);
+  if (FR_OK != f_close(&fo) || res != FR_OK || wrbytes != sizeof(rec))
+    return recent_compact();
+
+  recent_jnl_count++;
   return true;
 }
 
 static bool insert_recent_flush(const char *fn) {
   // Insert element.
   insert_recent_fn(fn);
-  return recent_flush();
+  return recent_journal_append(RECENT_JNL_PUSH, fn);
 }
 
 static bool delete_recent_flush(unsigned entry_num) {
-  if (entry_num + 1 < smenu.recent.maxentries)
-    memmove32(&sdr_state->rentries[entry_num], &sdr_state->rentries[entry_num + 1],
-              (smenu.recent.maxentries - (entry_num + 1)) * sizeof(sdr_state->rentries[0]));
+  char fn[MAX_FN_LEN];
+  strcpy(fn, sdr_state->rentries[entry_num].fpath);
+  remove_recent_entry(entry_num);
 
-  smenu.recent.maxentries--;
   smenu.recent.selector = MIN(smenu.recent.maxentries - 1, smenu.recent.selector);
 
   if (!smenu.recent.maxentries)
     smenu.menu_tab = MENUTAB_ROMBROWSE;
 
-  return recent_flush();
+  return recent_journal_append(RECENT_JNL_DELETE, fn);
+}
+
+// Replays the journal on top of the loaded snapshot. Replaying is idempotent,
+// so records that already made it into the snapshot are harmless.
+static void recent_journal_replay() {
+  FIL fi;
+  recent_jnl_count = 0;
+  if (FR_OK != f_open(&fi, RECENT_JOURNAL_FILEPATH, FA_READ))
+    return;
+
+  bool torn = (f_size(&fi) % sizeof(t_rjrecord)) != 0;
+  while (1) {
+    t_rjrecord rec;
+    UINT rdbytes;
+    if (FR_OK != f_read(&fi, &rec, sizeof(rec), &rdbytes) || rdbytes != sizeof(rec))
+      break;
+
+    // Stop at the first bad record, anything after it is not trustworthy.
+    if (rec.magic != RECENT_JNL_MAGIC ||
+        rec.crc != crc32_update(0, (uint8_t*)rec.fpath, sizeof(rec.fpath)) ||
+        !memchr(rec.fpath, 0, sizeof(rec.fpath))) {
+      torn = true;
+      break;
+    }
+
+    if (rec.op == RECENT_JNL_PUSH)
+      insert_recent_fn(rec.fpath);
+    else if (rec.op == RECENT_JNL_DELETE)
+      remove_recent_fn(rec.fpath);
+    recent_jnl_count++;
+  }
+  f_close(&fi);
+
+  // Partially written record (ie. power loss), rewrite everything.
+  if (torn)
+    recent_compact();
+}
+
+// Appends a path (not null terminated) at the end of the list.
+static void recent_append_entry(const char *fn, unsigned len) {
+  if (!len || len >= MAX_FN_LEN || smenu.recent.maxentries >= RECENT_MAXFN_CNT)
+    return;
+
+  // Use an aligned copy as DMA source.
+  char tmp[MAX_FN_LEN];
+  memcpy(tmp, fn, len);
+  tmp[len] = 0;
+
+  t_rentry *e = &sdr_state->rentries[smenu.recent.maxentries++];
+  e->fname_offset = file_basename(tmp) - tmp;
+  dma_memcpy16(e->fpath, tmp, (len + 1 + 1) / 2);
 }
 
 static void recent_reload() {
@@ -1031,62 +1399,74 @@ static void recent_reload() {
   smenu.anim_state = 0;
   smenu.anim_skip = 0;
 
-  FIL fi;
-  if (FR_OK != f_open(&fi, RECENT_FILEPATH, FA_READ))
-    return;
-
-  // Read data block by block.
-  char tmp[1024 + 4];
-  unsigned bcount = 0;
-  while (1) {
-    if (bcount <= 512) {
-      UINT rdbytes;
-      if (FR_OK != f_read(&fi, &tmp[bcount], 512, &rdbytes))
-        return;
-      bcount += rdbytes;
-      tmp[bcount] = 0;
+  // Use the list from the boot state blob if it was loaded, or the file.
+  unsigned bstsize;
+  const char *bstrecent = bootstate_recent(&bstsize);
+  if (bstrecent) {
+    // The blob is already in memory, parse it in place.
+    const char *p = bstrecent, *end = &bstrecent[bstsize];
+    while (p < end) {
+      const char *eol = memchr(p, '\n', end - p);
+      unsigned len = (eol ? eol : end) - p;
+      recent_append_entry(p, len);
+      p += len + 1;
     }
+  }
+  else {
+    FIL fi;
+    if (FR_OK == f_open(&fi, RECENT_FILEPATH, FA_READ)) {
+      // Read data block by block, parse full lines only.
+      char tmp[1024];
+      unsigned bcount = 0;
+      while (1) {
+        UINT rdbytes;
+        if (FR_OK != f_read(&fi, &tmp[bcount], sizeof(tmp) - bcount, &rdbytes))
+          break;
+        bcount += rdbytes;
+        if (!bcount)
+          break;
 
-    if (!bcount)
-      break;
+        unsigned off = 0;
+        while (off < bcount) {
+          const char *eol = memchr(&tmp[off], '\n', bcount - off);
+          if (!eol && rdbytes && bcount - off < sizeof(tmp))
+            break;     // Incomplete line, read more data first.
+          unsigned len = eol ? (unsigned)(eol - &tmp[off]) : bcount - off;
+          recent_append_entry(&tmp[off], len);
+          off += len + 1;
+        }
 
-    // Attempt to parse the next path.
-    char *p = strchr(tmp, '\n');
-    if (!p)
-      p = strchr(tmp, '\0');
-    if (!p)
-      break;       // Some path is way too long!
-
-    *p = 0;        // Add the string end char.
-
-    unsigned cnt = strlen(tmp) + 1;
-    if (cnt > 1) {
-      const char *pbn = file_basename(tmp);
-      sdr_state->rentries[smenu.recent.maxentries].fname_offset = pbn - tmp;
-      dma_memcpy16(sdr_state->rentries[smenu.recent.maxentries].fpath, tmp, (cnt + 1) / 2);
-      smenu.recent.maxentries++;
+        // Keep the incomplete line (if any) for the next iteration.
+        off = MIN(off, bcount);
+        memmove(&tmp[0], &tmp[off], bcount - off);
+        bcount -= off;
+        if (!rdbytes)
+          break;
+      }
+      f_close(&fi);
     }
-
-    // Consume the bytes
-    memmove(&tmp[0], &tmp[cnt], bcount - cnt);
-    bcount -= cnt;
   }
 
-  f_close(&fi);
+  // Apply any changes that happened since the snapshot was written.
+  recent_journal_replay();
 }
 
 // Loads a new directory list in the ROM browser.
 // Sets selector pointer at offset zero
 // TODO: Implement filtering (.gba/.rom/.bin... etc) using settings
 static void browser_reload() {
+  PROF_SCOPE(PROF_BROWSER_RELOAD);
+  prefetch_reset();
   smenu.browser.selector = 0;
   smenu.anim_state = 0;
   smenu.anim_skip = 0;
 
   unsigned fcount = 0;
   DIR d;
+  smenu.browser.partial = true;
   if (FR_OK != f_opendir(&d, smenu.browser.cpath))
     return;   // FIXME: Implement error reporting!
+  smenu.browser.partial = false;
 
   while (1) {
     FILINFO info;
@@ -1096,12 +1476,16 @@ static void browser_reload() {
     if (!show_hidden_files) {
       if (info.fname[0] == '.') // Skip dot files
         continue;
-      if (info.fattrib & AM_HID) // Skip hidden files
+      if (info.fattrib & AM_HID) { // Skip hidden files
+        smenu.browser.partial = true;
         continue;
+      }
     }
 
-    if (fcount >= BROWSER_MAXFN_CNT)
+    if (fcount >= BROWSER_MAXFN_CNT) {
+      smenu.browser.partial = true;
       break;
+    }
 
     t_centry *e = &sdr_state->fentries[fcount++];
     e->filesize = (uint32_t) info.fsize;  // TODO: Support 4GB+ files?
@@ -1749,8 +2133,10 @@ void render_info(volatile uint8_t *frame) {
   uint32_t gitver = VERSION_SLUG_WORD;
   char tmp[64], tmp2[32];
 
-  init_logo_palette(&MEM_PALETTE[1]);
-  render_logo((uint16_t*)frame, SCREEN_WIDTH/2, 40, 4);
+  if (smenu.info.selector < 3) {
+    init_logo_palette(&MEM_PALETTE[1]);
+    render_logo((uint16_t*)frame, SCREEN_WIDTH/2, 40, 4);
+  }
 
   switch (smenu.info.selector) {
   case 0:
@@ -1766,6 +2152,10 @@ void render_info(volatile uint8_t *frame) {
     draw_central_text(tmp, frame, 120, 90);
     npf_snprintf(tmp, sizeof(tmp), "Game count: %lu", pdbinfo.patch_count);
     draw_central_text(tmp, frame, 120, 110);
+    if (pdbinfo.usr_patch_count) {
+      npf_snprintf(tmp, sizeof(tmp), "User DB games: %lu", pdbinfo.usr_patch_count);
+      draw_central_text(tmp, frame, 120, 130);
+    }
     break;
   case 2:
     if (sd_info.sdhc)
@@ -1778,6 +2168,18 @@ void render_info(volatile uint8_t *frame) {
     npf_snprintf(tmp, sizeof(tmp), "Card ID: %02x | %04x", sd_info.manufacturer, sd_info.oemid);
     draw_central_text(tmp, frame, 120, 110);
     break;
+  #ifdef PROFILER_ENABLED
+  case 3:
+    // Profiler table: probe name, call count and total time.
+    for (unsigned i = 0; i < PROF_MAX; i++) {
+      const t_prof_entry *e = &prof_table[i];
+      draw_text_ovf(prof_name(i), frame, 8, 20 + i * 16, 112);
+      npf_snprintf(tmp, sizeof(tmp), "%lu | %lu ms", e->calls, (uint32_t)((e->cycles * 1000) >> 24));
+      draw_text_ovf(tmp, frame, 124, 20 + i * 16, 112);
+    }
+    draw_central_text("SELECT: dump, R: reset", frame, 120, 118);
+    break;
+  #endif
   }
 
   // Flashing info
@@ -1797,6 +2199,7 @@ void render_tools(volatile uint8_t *frame) {
 // Renders the menu. Arg0 represents the frame count difference with the
 // previous rendered frame (for animations and similar stuff).
 void menu_render(unsigned fcnt) {
+  PROF_SCOPE(PROF_MENU_RENDER);
   objnum = 0;
   volatile uint8_t *frame = &MEM_VRAM_U8[0xA000*framen];
 
@@ -1881,6 +2284,10 @@ void menu_init(int sram_testres) {
   // Load recent ROMs (we could disable this for speed)
   recent_reload();
 
+  // Regenerate the boot state blob if it was missing (or outdated/invalid)
+  if (!bootstate_valid())
+    recent_compact();
+
   reload_theme();
 
   smenu.menu_tab = (recent_menu && smenu.recent.maxentries) ? MENUTAB_RECENT : MENUTAB_ROMBROWSE;
@@ -2219,7 +2626,12 @@ void menu_keypress(unsigned newkeys) {
               .use_cheats = spop.p.load.use_cheats,
               .use_rtc = spop.p.load.rtc_patch_enabled
             };
-            save_rom_settings(spop.p.load.romfn, &savedcfg);
+            if (save_rom_settings(spop.p.load.romfn, &savedcfg)) {
+              uint32_t cfgstamp[2];
+              if (rom_settings_stamp(spop.p.load.romfn, cfgstamp))
+                gamedb_update(spop.p.load.romfn, 0, &savedcfg, cfgstamp);
+              prefetch_reset();
+            }
           }
 
           // Prepare the savegame (load and store stuff, directsave...)
@@ -2481,9 +2893,15 @@ void menu_keypress(unsigned newkeys) {
           // Performs a test on the SRAM/SDRAM, ensure they are fine.
           set_supercard_mode(MAPPED_SDRAM, true, false);
 
-          if (sdram_test(loadrom_progress_abort))
-            spop.alert_msg = msgs[lang_id][MSG_BAD_SDRAM];
-          else
+          t_sdram_report srep;
+          unsigned ret = sdram_test(loadrom_progress_abort, &srep);
+          if (ret == SDRAM_TEST_FAILED) {
+            // Report the failing address lines and banks.
+            npf_snprintf(smenu.info.tstr, sizeof(smenu.info.tstr), msgs[lang_id][MSG_SDRAMFAIL],
+                         msgs[lang_id][MSG_BAD_SDRAM], srep.addr_lines, srep.banks);
+            spop.alert_msg = smenu.info.tstr;
+          }
+          else if (ret == SDRAM_TEST_OK)
             spop.alert_msg = msgs[lang_id][MSG_GOOD_RAM];
 
           set_supercard_mode(MAPPED_SDRAM, true, true);
@@ -2504,14 +2922,15 @@ void menu_keypress(unsigned newkeys) {
           spop.qpop.clear_popup_ok = true;
         }
         else if (smenu.tools.selector == ToolsSDBench) {
+          t_sdbench_summary bres;
           slowsd = use_slowsd;
-          int ret = sdbench_read(loadrom_progress_abort);
+          unsigned ret = sdbench_run(loadrom_progress_abort, &bres);
           slowsd = true;
-          if (ret < 0)
+          if (ret == SDBENCH_ERR_FILE || ret == SDBENCH_ERR_IO)
             spop.alert_msg = msgs[lang_id][MSG_ERR_GENERIC];
-          else {
-            unsigned speed = 8*1024*1024 / (unsigned)ret;
-            npf_snprintf(smenu.info.tstr, sizeof(smenu.info.tstr), msgs[lang_id][MSG_BENCHSPD], speed);
+          else if (!ret) {
+            npf_snprintf(smenu.info.tstr, sizeof(smenu.info.tstr), msgs[lang_id][MSG_BENCHRES],
+                         bres.seqread_kibps, bres.seqwrite_kibps);
             spop.alert_msg = smenu.info.tstr;
           }
         }
@@ -2594,7 +3013,19 @@ void menu_keypress(unsigned newkeys) {
 
     case MENUTAB_INFO:
       if (newkeys & KEY_BUTTA)
-        smenu.info.selector = (smenu.info.selector + 1) % 3;
+        smenu.info.selector = (smenu.info.selector + 1) % INFO_PAGES;
+      #ifdef PROFILER_ENABLED
+      if (smenu.info.selector == 3) {
+        if (newkeys & KEY_BUTTSEL)
+          spop.alert_msg = PROF_DUMP() ? "Profile written to SD" : msgs[lang_id][MSG_ERR_GENERIC];
+        if (newkeys & KEY_BUTTR)
+          prof_reset();
+      }
+      #endif
+      #ifdef IOTRACE_ENABLED
+      if (smenu.info.selector < 3 && (newkeys & KEY_BUTTSEL))
+        spop.alert_msg = iotrace_dump(IOTRACE_FILEPATH) ? "I/O trace written to SD" : msgs[lang_id][MSG_ERR_GENERIC];
+      #endif
       if ((newkeys & FLASH_UNLOCK_KEYS) == FLASH_UNLOCK_KEYS)
         enable_flashing = true;
       break;
@@ -2602,3 +3033,51 @@ void menu_keypress(unsigned newkeys) {
   }
 }
 
+// Called from the main loop with the remaining frame time. Prefetches the ROM
+// metadata for the entries around the selected file, so that opening them
+// does not need to hit the SD card. Only one step (one SD access) runs per
+// call, and only once the selection stopped moving, so scrolling is smooth.
+void menu_idle() {
+  if (smenu.menu_tab != MENUTAB_ROMBROWSE || spop.pop_num || spop.alert_msg || spop.qpop.message)
+    return;
+
+  if (smenu.browser.selector != prefetch_selector) {
+    prefetch_selector = smenu.browser.selector;
+    prefetch_idle = 0;
+  }
+  if (prefetch_idle < PREFETCH_SETTLE) {
+    prefetch_idle++;
+    return;
+  }
+
+  const int offs[] = {0, 1, -1, 2, -2};
+  for (unsigned i = 0; i < sizeof(offs) / sizeof(offs[0]); i++) {
+    int idx = smenu.browser.selector + offs[i];
+    if (idx < 0 || idx >= smenu.browser.maxentries)
+      continue;
+
+    const t_centry *e = sdr_state->fileorder[idx];
+    unsigned l = strlen(e->fname);
+    if (e->isdir || l < 4 || strcasecmp(&e->fname[l-4], ".gba") || e->filesize > MAX_GBA_ROM_SIZE)
+      continue;
+
+    char path[MAX_FN_LEN];
+    strcpy(path, smenu.browser.cpath);
+    strcat(path, e->fname);
+    uint32_t pathhash = gamedb_hash(path);
+    t_prefetch *pf = prefetch_find(pathhash, e->filesize);
+    if (pf && pf->step == PF_DONE)
+      continue;
+
+    if (!pf) {
+      pf = &sdr_state->prefetch[prefetch_next];
+      prefetch_next = (prefetch_next + 1) % PREFETCH_CNT;
+      pf->pathhash = pathhash;
+      pf->romfs = e->filesize;
+      pf->step = PF_HEADER;
+    }
+    prefetch_step(pf, path);
+    return;
+  }
+}
+
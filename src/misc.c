@@ -22,42 +22,13 @@
 #include "compiler.h"
 #include "common.h"
 #include "util.h"
+#include "settings.h"
 #include "supercard_driver.h"
 #include "fatfs/ff.h"
 
-// Tests the SDRAM, to ensure it actually holds data correctly.
-ARM_CODE IWRAM_CODE NOINLINE
-int sdram_test(progress_abort_fn progcb) {
-  // Write stuff to SDRAM and check that it indeed was properly written.
-  // To avoid losing data, we backup the current word into a register.
-  volatile uint16_t *sdram_ptr  = (uint16_t*)GBA_ROM_BASE;
-  const static uint16_t tseq[] = { 0xABCD, 0xAAAA, 0x5555 };
-
-  // Skip the last word (I suppose!) since it's the SC control reg.
-  for (unsigned i = 0; i < 16*1024*1024 - 1; i++) {
-    uint16_t oval = sdram_ptr[i];
-    for (unsigned j = 0; j < sizeof(tseq)/sizeof(tseq[0]); j++) {
-      sdram_ptr[i] = tseq[j];
-      if (sdram_ptr[i] != tseq[j]) {
-        sdram_ptr[i] = oval;
-        return -i;
-      }
-    }
-    sdram_ptr[i] = oval;
-
-    // Update progress every now and then.
-    if (!(i & 0xFFFF)) {
-      if (progcb(i >> 16, 256))
-        return 0;
-    }
-  }
-
-  return 0;
-}
-
 // Tests the SRAM, to ensure it actually holds data correctly.
 int sram_test() {
-  // Similar to above, just way faster :P
+  // Quick pattern test of every byte, preserving the contents
   volatile uint8_t *sram_ptr  = (uint8_t*)0x0E000000;
   const static uint8_t tseq[] = { 0xAA, 0x55, 0x00, 0xFF };
 
@@ -129,6 +100,8 @@ void program_sram_check() {
   FIL fout;
   if (FR_OK == f_open(&fout, PENDING_SRAM_TEST, FA_WRITE | FA_CREATE_ALWAYS))
     f_close(&fout);
+
+  bootstate_set_pending(BOOTSTATE_PEND_SRAMTEST);
 }
 
 int check_peding_sram_test() {
@@ -141,29 +114,4 @@ int check_peding_sram_test() {
   return -1;
 }
 
-// Tests the SD card by reading blocks (directly) and discarding the data.
-int sdbench_read(progress_abort_fn progcb) {
-  // Just read consecutive blocks without repeating them (to avoid any caching)
-  // Assume ~1MB/s read rate, aim for 8 seconds aprox. Read 8MiB in 8KiB blocks.
-  unsigned start_frame = frame_count;
-  for (unsigned i = 0; i < 1024; i++) {
-    uint32_t buf[8 * 1024 / sizeof(uint32_t)];
-    const unsigned blkcnt = sizeof(buf) / 512;
-
-    unsigned ret = sdcard_read_blocks((uint8_t*)buf, i * blkcnt, blkcnt);
-    if (ret)
-      return -1;
-
-    // Update progress every now and then (aim for 0.25s)
-    if (!(i & 0x1F)) {
-      if (progcb(i, 1024))
-        return 0;
-    }
-  }
-  unsigned end_frame = frame_count;
-
-  // Return milliseconds, do math in 1K microseconds.
-  return ((end_frame - start_frame) * 17067) >> 10;
-}
-
 
@@ -43,6 +43,18 @@
 #define WRAM_MIN_ADDR          0x037F8000   // (That's 32KiB before the WRAM-ARM7)
 #define WRAM_MAX_ADDR          0x03810000   // (WRAM-ARM7 is 64KiB big)
 
+#define NDS_LOAD_CHUNK         (64*1024)    // Read (and DLDI scan) granularity
+
+// The ARM7 waits in the bootloader until we launch the NDS file. Meanwhile it
+// takes fill/copy jobs via the IPC FIFO (see rom_boot.S).
+#define REG_IPCFIFOCNT         (*((volatile uint16_t*)0x04000184))
+#define REG_IPCFIFOSEND        (*((volatile uint32_t*)0x04000188))
+
+#define IPCFIFO_SEND_FULL      0x0002
+#define IPCFIFO_SEND_CLEAR     0x0008
+#define IPCFIFO_ERROR          0x4000
+#define IPCFIFO_ENABLE         0x8000
+
 typedef struct {
   char gtitle[12];             // Game title (ASCII)
   char gcode[4];               // Game code (usually ASCII)
@@ -104,13 +116,115 @@ bool validate_nds_header(const t_nds_header *header) {
   return (ccrc == header->header_checksum);
 }
 
+// Hands a job to the ARM7: copies (or zero-fills if src is zero) a memory
+// area. The size must be a multiple of four bytes.
+static void arm7_job_post(uint32_t dst, uint32_t src, uint32_t size) {
+  const uint32_t job[3] = { dst, src, size };
+  for (unsigned i = 0; i < 3; i++) {
+    while (REG_IPCFIFOCNT & IPCFIFO_SEND_FULL);
+    REG_IPCFIFOSEND = job[i];
+  }
+}
+
+// Asks the ARM7 to clear the main RAM payload area, but the loaded payloads.
+static void clear_uncovered_mainram(uint32_t a_start, uint32_t a_end, uint32_t b_start, uint32_t b_end) {
+  // Sort the (word aligned) payload ranges, they might be empty.
+  uint32_t rng[2][2] = {
+    { a_start & ~3U, ROUND_UP2(a_end, 4) },
+    { b_start & ~3U, ROUND_UP2(b_end, 4) },
+  };
+  if (rng[1][0] < rng[0][0]) {
+    uint32_t t0 = rng[0][0], t1 = rng[0][1];
+    rng[0][0] = rng[1][0]; rng[0][1] = rng[1][1];
+    rng[1][0] = t0; rng[1][1] = t1;
+  }
+
+  uint32_t addr = MAINRAM_MIN_ADDR;
+  for (unsigned i = 0; i < 2; i++) {
+    if (rng[i][0] == rng[i][1])
+      continue;
+    if (rng[i][0] > addr)
+      arm7_job_post(addr, 0, rng[i][0] - addr);
+    addr = MAX(addr, rng[i][1]);
+  }
+  if (addr < MAINRAM_MAX_ADDR)
+    arm7_job_post(addr, 0, MAINRAM_MAX_ADDR - addr);
+}
+
+// Loads a payload from the file into RAM, in chunks. Every chunk is scanned
+// for DLDI stubs right after reading it (while it is still warm). Since the
+// stub area (where the driver is copied) can span several chunks, each stub
+// is patched once its whole area has been loaded, and the scan resumes right
+// after it. The fast driver variant is used whenever the stub has enough room
+// for it.
+static bool load_nds_payload(
+  FIL *fd, uint32_t rom_offset, uint8_t *dst, uint32_t size,
+  const t_dldi_driver *driver, const t_dldi_driver *driver_fast
+) {
+  if (FR_OK != f_lseek(fd, rom_offset))
+    return false;
+
+  const unsigned driver_size = driver ? (1 << driver->h.req_size) : 0;
+  const unsigned driver_fast_size = driver_fast ? (1 << driver_fast->h.req_size) : 0;
+  const t_dldi_driver *pending = NULL;    // Driver for the stub at "scanned"
+  uint32_t scanned = 0;
+
+  for (uint32_t offset = 0; offset < size; ) {
+    UINT rdbytes;
+    unsigned toread = MIN(size - offset, NDS_LOAD_CHUNK);
+    if (FR_OK != f_read(fd, &dst[offset], toread, &rdbytes) || rdbytes != toread)
+      return false;
+    offset += toread;
+
+    if (!driver)
+      continue;
+
+    while (true) {
+      // A stub was found, patch it once its area is loaded (or at the end).
+      if (pending) {
+        t_dldi_header *h = (t_dldi_header*)&dst[scanned];
+        if (offset < size && scanned + (1 << h->avail_size) > offset)
+          break;
+        dldi_stub_patch((t_dldi_driver*)h, pending);
+        pending = NULL;
+        scanned += 4;
+      }
+
+      // Scan the newly available data (stub headers must be fully loaded).
+      if (scanned + sizeof(t_dldi_header) >= offset)
+        break;
+      int next_offset = dldi_stub_find(&dst[scanned], offset - scanned);
+      if (next_offset < 0) {
+        // Continue where the search stopped, once we have more data.
+        scanned += ROUND_UP2(offset - scanned - sizeof(t_dldi_header), 4);
+        break;
+      }
+      scanned += next_offset;
+      const t_dldi_header *stub = (t_dldi_header*)&dst[scanned];
+      if (driver_fast && dldi_stub_validate(stub, driver_fast_size))
+        pending = driver_fast;
+      else if (dldi_stub_validate(stub, driver_size))
+        pending = driver;
+      else
+        scanned += 4;
+    }
+  }
+
+  // Zero-pad the last word, the rest of the RAM is cleared separately.
+  for (uint32_t i = size; i & 3; i++)
+    dst[i] = 0;
+
+  return true;
+}
+
 // Loads an NDS file by:
 //  - Loading its header (to main RAM) from disk and parsing it.
-//  - Loading ARM9 & ARM7 code sections to main RAM
-//  - Patching the provided DLDI driver (if any)
+//  - Loading ARM9 & ARM7 code sections to main RAM, patching the provided
+//    DLDI driver (if any) while loading.
+//  - Clearing the rest of the main RAM (using the ARM7, in parallel).
 // Returns error if the NDS file doesn't exist, looks invalid in any way, etc.
 
-unsigned load_nds(const char *filename, const void *dldi_driver) {
+unsigned load_nds(const char *filename, const void *dldi_driver, const void *dldi_driver_fast) {
   FIL fd;
   FRESULT res = f_open(&fd, filename, FA_READ);
   if (res != FR_OK)
@@ -130,7 +244,7 @@ unsigned load_nds(const char *filename, const void *dldi_driver) {
   bool arm7_on_wram = (hdr->arm7_entrypoint >> 24) == 3;
 
   const t_dldi_driver *driver = (t_dldi_driver*)dldi_driver;
-  const unsigned driver_size = (1 << driver->h.req_size);
+  const t_dldi_driver *driver_fast = (t_dldi_driver*)dldi_driver_fast;
 
   // ARM9 size, addresses and entrypoint
   if (hdr->arm9_load_size > MAINRAM_MAX_PAYLOAD)
@@ -160,8 +274,8 @@ unsigned load_nds(const char *filename, const void *dldi_driver) {
       hdr->arm7_entrypoint > hdr->arm7_load_addr + hdr->arm7_load_size)
     return ERR_NDS_BAD_ENTRYP;
 
-  // Clear the main memory areas where payload can be loaded.
-  memset32((void*)MAINRAM_MIN_ADDR,       0, MAINRAM_MAX_PAYLOAD);
+  // Enable the IPC FIFO, used to hand jobs to the ARM7.
+  REG_IPCFIFOCNT = IPCFIFO_ENABLE | IPCFIFO_ERROR | IPCFIFO_SEND_CLEAR;
 
   // Process the arm7 payload first. We load and patch it.
 
@@ -169,57 +283,26 @@ unsigned load_nds(const char *filename, const void *dldi_driver) {
   // begining of the main ram, then move it to VRAM-D. The ARM7 knows how to copy it if needed.
   uint8_t *arm7_addr = arm7_on_wram ? (uint8_t*)((uintptr_t)MAINRAM_TMP_WRAM7_ADDR) :
                                       (uint8_t*)((uintptr_t)hdr->arm7_load_addr);
-  if (FR_OK != f_lseek(&fd, hdr->arm7_rom_offset))
+  if (!load_nds_payload(&fd, hdr->arm7_rom_offset, arm7_addr, hdr->arm7_load_size, driver, driver_fast))
     return ERR_FILE_ACCESS;
-  if (FR_OK != f_read(&fd, arm7_addr, hdr->arm7_load_size, &rdbytes) ||
-                      rdbytes != hdr->arm7_load_size)
-    return ERR_FILE_ACCESS;
-
-  if (dldi_driver) {
-    int offset = 0;
-    while (offset < hdr->arm7_load_size) {
-      int next_offset = dldi_stub_find(&arm7_addr[offset], hdr->arm7_load_size - offset);
-      if (next_offset < 0)
-        break;
-      offset += next_offset;
-
-      t_dldi_header *dldi_stub = (t_dldi_header*)&arm7_addr[offset];
-      if (dldi_stub_validate(dldi_stub, driver_size))
-        dldi_stub_patch((t_dldi_driver*)dldi_stub, driver);
-      offset += 4;
-    }
-  }
 
   // If we used a temporary address for the ARM7 payload, move it now to its VRAM buffer
   if (arm7_on_wram)
     memcpy32((void*)MAINRAM_TMP_VRAM_ADDR, (void*)MAINRAM_TMP_WRAM7_ADDR, hdr->arm7_load_size);
 
+  // Have the ARM7 clear the areas not covered by the payloads, while we read
+  // the ARM9 payload (the temporary ARM7 copy is no longer needed).
+  uint32_t arm7_main_start = arm7_on_wram ? 0 : hdr->arm7_load_addr;
+  uint32_t arm7_main_end = arm7_on_wram ? 0 : hdr->arm7_load_addr + hdr->arm7_load_size;
+  clear_uncovered_mainram(hdr->arm9_load_addr, hdr->arm9_load_addr + hdr->arm9_load_size,
+                          arm7_main_start, arm7_main_end);
+
   // Proceed to load the arm9 payload now
   uint8_t *arm9_addr = (uint8_t*)((uintptr_t)hdr->arm9_load_addr);
-  if (FR_OK != f_lseek(&fd, hdr->arm9_rom_offset))
-    return ERR_FILE_ACCESS;
-  if (FR_OK != f_read(&fd, arm9_addr, hdr->arm9_load_size, &rdbytes) ||
-                      rdbytes != hdr->arm9_load_size)
+  if (!load_nds_payload(&fd, hdr->arm9_rom_offset, arm9_addr, hdr->arm9_load_size, driver, driver_fast))
     return ERR_FILE_ACCESS;
 
   f_close(&fd);
 
-  if (dldi_driver) {
-    // Find patching points in the ARM9 payload
-    int offset = 0;
-    while (offset < hdr->arm9_load_size) {
-      int next_offset = dldi_stub_find(&arm9_addr[offset], hdr->arm9_load_size - offset);
-      if (next_offset < 0)
-        break;
-      offset += next_offset;
-
-      t_dldi_header *dldi_stub = (t_dldi_header*)&arm9_addr[offset];
-      if (dldi_stub_validate(dldi_stub, driver_size))
-        dldi_stub_patch((t_dldi_driver*)dldi_stub, driver);
-      offset += 4;
-    }
-  }
-
   return 0;
 }
-
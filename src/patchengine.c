@@ -37,6 +37,7 @@
 #include "util.h"
 #include "fatfs/ff.h"
 #include "patchengine.h"
+#include "profiler.h"
 
 #define WAITCNT_VALUE_EXACT  0x04000204
 #define IRQHADDR_VALUE       0x03007FFC
@@ -305,6 +306,7 @@ void patchengine_finalize(t_patch_builder *patchb) {
 // WAITCNT, IRQ and save patches. Generate a patch structure out of it.
 ARM_CODE IWRAM_CODE NOINLINE
 bool patchengine_process_rom(const uint32_t *rom, unsigned romsize, t_patch_builder *patchb, void(*progresscb)(unsigned)) {
+  PROF_SCOPE(PROF_PATCHENGINE);
   const uint16_t *rom16 = (uint16_t*)rom;
   t_patch *patch = &patchb->p;
 
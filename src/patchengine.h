@@ -63,9 +63,31 @@ struct struct_t_rtc_state;
 void patchmem_dbinfo(const uint8_t *dbptr, uint32_t *pcnt, char *version, char *date, char *creator);
 // Lookup routines (builtin, on-disk, etc).
 bool patchmem_lookup(const uint8_t *gamecode, const uint8_t *dbptr, t_patch *pdata);
+// User DB (on the SD card), loads its header and index. Returns false if not
+// present or invalid (the user DB is then disabled).
+bool patchusr_init(const char *fn);
+void patchusr_dbinfo(uint32_t *pcnt);
+// Looks up the user DB first and then the builtin one (in SDRAM).
+bool patchdb_lookup(const uint8_t *gamecode, t_patch *pdata);
 // Actual patching magic
 bool patch_apply_rom(const t_patch *pdata, const struct struct_t_rtc_state *rtc_block, uint32_t igmenu_addr, uint32_t ds_addr);
 
+// Fused patching: ops are sorted by address and applied to each ROM chunk as
+// it is loaded (before it reaches SDRAM if it goes through a buffer). Ops that
+// are not fully contained in a loaded chunk (ie. landing in the payload gap or
+// past the ROM end) are applied by the final pass, along with the header.
+typedef struct {
+  const t_patch *pdata;
+  uint32_t ds_addr;
+  unsigned count, next;                     // Sorted ops, and next to apply
+  uint8_t idx[MAX_PATCH_OPS];               // Op (word) indices, by address
+  uint32_t pending[MAX_PATCH_OPS / 32];     // Skipped ops (by sorted index)
+} t_patch_stream;
+
+void patch_stream_init(t_patch_stream *ps, const t_patch *pdata, bool igmenu, bool rtc, uint32_t ds_addr);
+void patch_stream_chunk(t_patch_stream *ps, uint8_t *buf, uint32_t offset, uint32_t size);
+bool patch_stream_finish(t_patch_stream *ps, const struct struct_t_rtc_state *rtc_block, uint32_t igmenu_addr);
+
 void patchengine_init(t_patch_builder *patch, unsigned filesize);
 void patchengine_finalize(t_patch_builder *patch);
 // Generates a patch set from a given ROM.
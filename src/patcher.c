@@ -24,6 +24,8 @@
 #include "fatfs/ff.h"
 #include "common.h"
 #include "patchengine.h"
+#include "supercard_driver.h"
+#include "util.h"
 
 #define GBA_ROM_ADDR_START   0x08000000
 #define GBA_ROM_ADDR_END     0x09FFFFFF
@@ -36,8 +38,18 @@ typedef struct {
   char date[8];          // Creating date (ASCII encoded)
   char version[8];       // DB version (ASCII encoded)
   char creator[32];      // DB author/creator (ASCII encoded)
+  uint32_t blkoff;       // Shared data block pool offset (v2 only)
 } t_db_header;
 
+// Version 1 entries are raw op word arrays (header word, ops, hole info).
+// Version 2 entries are byte streams, with all the ops sorted by address:
+//   u8 flags (save mode, hole info present), varint word count (x4 sections)
+//   ops: u8 opcode/arg, varint (address delta << 2 | section), op payload
+//   (bytes for op 0x3, word offset in the shared block pool for op 0x4)
+//   varint hole address and size (in KiB), if present.
+#define PATCHDB_V1           0x00010000
+#define PATCHDB_V2           0x00020000
+
 typedef struct {
   uint8_t gcode[4];
   uint32_t offset;       // LSB is game version (8 bits), MSB is byte offset
@@ -62,21 +74,112 @@ void patchmem_dbinfo(const uint8_t *dbptr, uint32_t *pcnt, char *version, char *
   memcpy(creator, dbh->creator, sizeof(dbh->creator));
 }
 
-// Routines to lookup patches from the patch database in memory
-bool patchmem_lookup(const uint8_t *gamecode, const uint8_t *dbptr, t_patch *pdata) {
-  const t_db_header *dbh = (t_db_header*)dbptr;
-  if (dbh->signature != 0x31424450 ||      // PTDB signature mismatch
-      dbh->dbversion != 0x00010000)        // Version check
+static unsigned patch_op_words(uint32_t op);
+
+// Reads a variable length integer (LEB128). Returns NULL on overrun.
+static const uint8_t *read_varint(const uint8_t *p, const uint8_t *end, uint32_t *value) {
+  uint32_t v = 0;
+  for (unsigned sh = 0; p < end && sh < 32; sh += 7) {
+    uint8_t b = *p++;
+    v |= (b & 0x7F) << sh;
+    if (!(b & 0x80)) {
+      *value = v;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+// Reads words from the shared block pool (v2 DBs).
+typedef bool (*t_blkread)(void *ctx, uint32_t woff, uint32_t *dst, unsigned words);
+
+// Block offsets are not checked here: only the builtin DB (generated at build
+// time, so trusted) is read from memory. The user DB reader checks them.
+static bool patchmem_blkread(void *ctx, uint32_t woff, uint32_t *dst, unsigned words) {
+  memcpy(dst, &((const uint32_t*)ctx)[woff], words * sizeof(uint32_t));
+  return true;
+}
+
+// Decodes a v2 entry (bounded by end). Untrusted data is fine as long as
+// blkread checks the block offsets.
+static bool patchdb_decode_entry(const uint8_t *p, const uint8_t *end, t_blkread blkread, void *blkctx, t_patch *pdata) {
+  if (p >= end)
     return false;
+  const uint8_t flags = *p++;
 
-  // Skip header and program block.
-  const t_db_idx *dbidx = (t_db_idx*)&dbptr[1024];
-  // Skip the index block to address data entries.
-  const uint32_t *entries = (uint32_t*)&dbptr[1024 + 512 * dbh->idxcnt];
+  // Word count per section, ops are placed section by section.
+  uint32_t cnt[4], pos[4], lim[4];
+  unsigned total = 0;
+  for (unsigned i = 0; i < 4; i++) {
+    if (!(p = read_varint(p, end, &cnt[i])))
+      return false;
+    pos[i] = total;
+    total += cnt[i];
+    lim[i] = total;
+  }
+  if (total > MAX_PATCH_OPS || cnt[0] > 0xFF || cnt[1] > 0x1F || cnt[2] > 0xFF || cnt[3] > 0x0F)
+    return false;
 
-  // Load programs as well
+  pdata->wcnt_ops = cnt[0];
+  pdata->save_ops = cnt[1];
+  pdata->irqh_ops = cnt[2];
+  pdata->rtc_ops = cnt[3];
+  pdata->save_mode = flags & 0x7;
+
+  uint32_t addr = 0;
+  for (unsigned done = 0; done < total;) {
+    uint32_t delta;
+    if (p >= end)
+      return false;
+    const uint32_t opa = *p++;       // Opcode and argument (top 7 bits)
+    if (!(p = read_varint(p, end, &delta)))
+      return false;
+
+    const unsigned sec = delta & 3;
+    addr += delta >> 2;
+    const uint32_t opw = (opa << 25) | (addr & 0x1FFFFFF);
+    const unsigned words = patch_op_words(opw);
+    if (pos[sec] + words > lim[sec])
+      return false;
+
+    uint32_t *dst = &pdata->op[pos[sec]];
+    dst[0] = opw;
+    if ((opw >> 28) == 0x3) {
+      // Byte payload, packed into words
+      unsigned n = ((opw >> 25) & 7) + 1;
+      if ((unsigned)(end - p) < n)
+        return false;
+      for (unsigned j = 1; j < words; j++)
+        dst[j] = 0;
+      for (unsigned j = 0; j < n; j++)
+        dst[1 + j / 4] |= *p++ << ((j % 4) * 8);
+    }
+    else if ((opw >> 28) == 0x4) {
+      // Word payload, from the shared pool
+      uint32_t woff;
+      if (!(p = read_varint(p, end, &woff)) || !blkread(blkctx, woff, &dst[1], words - 1))
+        return false;
+    }
+
+    pos[sec] += words;
+    done += words;
+  }
+
+  pdata->hole_addr = pdata->hole_size = 0;
+  if (flags & 0x8) {
+    uint32_t haddr, hsize;
+    if (!(p = read_varint(p, end, &haddr)) || !(p = read_varint(p, end, &hsize)))
+      return false;
+    pdata->hole_addr = haddr << 10;
+    pdata->hole_size = hsize << 10;
+  }
+
+  return true;
+}
+
+// Loads the patch programs from a DB programs page.
+static bool patchdb_load_progs(const uint8_t *pgrpage, t_patch *pdata) {
   int pgn = 0;
-  const uint8_t *pgrpage = &dbptr[512];
   for (int i = 0; i < MAX_PATCH_PRG; i++)
     pdata->prgs[i].length = 0;
   for (int i = 0; i < 512 && pgn < MAX_PATCH_PRG; i++) {
@@ -91,36 +194,245 @@ bool patchmem_lookup(const uint8_t *gamecode, const uint8_t *dbptr, t_patch *pda
     memcpy(pdata->prgs[pgn++].data, &pgrpage[i+1], cnt);
     i += cnt;
   }
+  return true;
+}
+
+// Parses a DB entry (header word and ops). Returns the number of words used.
+static unsigned patchdb_parse_entry(const uint32_t *p, t_patch *pdata) {
+  const uint32_t pheader = *p++;
+
+  pdata->wcnt_ops = (pheader >>  0) & 0xFF;
+  pdata->save_ops = (pheader >>  8) & 0x1F;    // Only 5 bits
+  pdata->irqh_ops = (pheader >> 16) & 0xFF;
+  pdata->rtc_ops =  (pheader >> 24) & 0x0F;    // Only 4 bits
+
+  pdata->save_mode = (pheader >> 13) & 0x7;    // 3 bits
+
+  const unsigned numops = pdata->wcnt_ops + pdata->save_ops + pdata->irqh_ops + pdata->rtc_ops;
+
+  if ((pheader >> 28) & 0x1) {
+    // Hole/Trailing space information, placed in the last op
+    pdata->hole_addr = (p[numops] >> 16) << 10;   // In KiB chunks
+    pdata->hole_size = (p[numops] & 0xFFFF) << 10;
+  }
+
+  // Copy patch words
+  memcpy(&pdata->op[0], p, numops * sizeof(uint32_t));
+
+  return 1 + numops + ((pheader >> 28) & 0x1);
+}
+
+static bool patchdb_header_ok(const t_db_header *dbh) {
+  return dbh->signature == 0x31424450 &&    // PTDB signature
+         (dbh->dbversion == PATCHDB_V1 || dbh->dbversion == PATCHDB_V2);
+}
+
+// Routines to lookup patches from the patch database in memory
+bool patchmem_lookup(const uint8_t *gamecode, const uint8_t *dbptr, t_patch *pdata) {
+  const t_db_header *dbh = (t_db_header*)dbptr;
+  if (!patchdb_header_ok(dbh))
+    return false;
+
+  // Skip header and program block.
+  const t_db_idx *dbidx = (t_db_idx*)&dbptr[1024];
+  // Skip the index block to address data entries.
+  const uint8_t *entries = &dbptr[1024 + 512 * dbh->idxcnt];
+
+  // Load programs as well
+  if (!patchdb_load_progs(&dbptr[512], pdata))
+    return false;
 
   for (unsigned i = 0; i < dbh->patchcnt; i++) {
     if (!gcodecmp(dbidx[i].gcode, gamecode)) {
       uint32_t offset = dbidx[i].offset >> 8;
-      const uint32_t *p = &entries[offset];
-      const uint32_t pheader = *p++;
+      if (dbh->dbversion == PATCHDB_V1) {
+        patchdb_parse_entry((uint32_t*)&entries[offset * sizeof(uint32_t)], pdata);
+        return true;
+      }
+      // The entry is bounded by the block pool (which is at the end).
+      return patchdb_decode_entry(&entries[offset], &dbptr[dbh->blkoff], patchmem_blkread,
+                                  (void*)&dbptr[dbh->blkoff], pdata);
+    }
+  }
 
-      pdata->wcnt_ops = (pheader >>  0) & 0xFF;
-      pdata->save_ops = (pheader >>  8) & 0x1F;    // Only 5 bits
-      pdata->irqh_ops = (pheader >> 16) & 0xFF;
-      pdata->rtc_ops =  (pheader >> 24) & 0x0F;    // Only 4 bits
+  return false;
+}
 
-      pdata->save_mode = (pheader >> 13) & 0x7;    // 3 bits
+// User patch database, stored on the SD card (same format as the builtin).
+// The header, programs page and index are loaded into SDRAM at init, entries
+// are read directly from the file (so misses need no SD access at all).
+// Third party DBs might not be sorted, these are looked up linearly.
+#define USRPDB_IDXENT        (512 / sizeof(t_db_idx))
+#define USRPDB_MAX_PAGES     ((USRPATCHDB_SIZE - 1024) / 512)
 
-      const unsigned numops = pdata->wcnt_ops + pdata->save_ops + pdata->irqh_ops + pdata->rtc_ops;
+// Largest entry (in bytes) for any DB version (v2 uses at most 5 bytes per op
+// word, plus flags, counts and hole info).
+#define USRPDB_ENTRY_MAX     (MAX_PATCH_OPS * 5 + 32)
 
-      if ((pheader >> 28) & 0x1) {
-        // Hole/Trailing space information, placed in the last op
-        pdata->hole_addr = (p[numops] >> 16) << 10;   // In KiB chunks
-        pdata->hole_size = (p[numops] & 0xFFFF) << 10;
-      }
+static struct {
+  uint32_t patchcnt, idxcnt;
+  uint32_t dbversion, blkoff;
+  bool sorted;                 // Index sorted by game code (binary search)
+} usrpdb;
+
+bool patchusr_init(const char *fn) {
+  memset(&usrpdb, 0, sizeof(usrpdb));
+
+  FIL fd;
+  if (FR_OK != f_open(&fd, fn, FA_READ))
+    return false;
 
-      // Copy patch words
-      memcpy(&pdata->op[0], p, numops * sizeof(uint32_t));
+  UINT rdbytes;
+  uint32_t tmp[1024 / 4];
+  t_db_header dbh;
+  bool ok = FR_OK == f_read(&fd, tmp, sizeof(tmp), &rdbytes) && rdbytes == sizeof(tmp);
+  memcpy(&dbh, tmp, sizeof(dbh));
+  ok = ok && patchdb_header_ok(&dbh) && dbh.patchcnt <= dbh.idxcnt * USRPDB_IDXENT &&
+       dbh.idxcnt <= USRPDB_MAX_PAGES && f_size(&fd) >= 1024 + 512 * dbh.idxcnt;
+
+  if (ok) {
+    set_supercard_mode(MAPPED_SDRAM, true, false);
+    memcpy32((void*)ROM_USRPATCHDB_U8, tmp, sizeof(tmp));
+    set_supercard_mode(MAPPED_SDRAM, true, true);
+  }
 
-      return true;
+  // Load the index pages (checking whether the index is sorted).
+  bool sorted = true;
+  uint8_t prev[5];
+  for (unsigned pg = 0; ok && pg * USRPDB_IDXENT < dbh.patchcnt; pg++) {
+    const t_db_idx *dbidx = (t_db_idx*)tmp;
+    ok = FR_OK == f_read(&fd, tmp, 512, &rdbytes) && rdbytes == 512;
+
+    unsigned cnt = MIN(USRPDB_IDXENT, dbh.patchcnt - pg * USRPDB_IDXENT);
+    for (unsigned i = 0; ok && i < cnt; i++) {
+      if ((pg || i) && gcodecmp(prev, dbidx[i].gcode) > 0)
+        sorted = false;
+      memcpy(prev, dbidx[i].gcode, sizeof(prev));    // Game code and version
     }
+
+    set_supercard_mode(MAPPED_SDRAM, true, false);
+    memcpy32((void*)(ROM_USRPATCHDB_U8 + 1024 + 512 * pg), tmp, 512);
+    set_supercard_mode(MAPPED_SDRAM, true, true);
   }
+  f_close(&fd);
+  if (!ok)
+    return false;
 
-  return false;
+  usrpdb.patchcnt = dbh.patchcnt;
+  usrpdb.idxcnt = dbh.idxcnt;
+  usrpdb.dbversion = dbh.dbversion;
+  usrpdb.blkoff = dbh.blkoff;
+  usrpdb.sorted = sorted;
+  return true;
+}
+
+void patchusr_dbinfo(uint32_t *pcnt) {
+  *pcnt = usrpdb.patchcnt;
+}
+
+// Finds the game in the (SDRAM) index, returns its entry file offset or zero.
+static uint32_t patchusr_find(const uint8_t *gamecode) {
+  const t_db_idx *dbidx = (t_db_idx*)(ROM_USRPATCHDB_U8 + 1024);
+  const unsigned esize = usrpdb.dbversion == PATCHDB_V1 ? sizeof(uint32_t) : 1;
+  uint32_t ret = 0;
+
+  set_supercard_mode(MAPPED_SDRAM, true, false);
+  if (usrpdb.sorted) {
+    unsigned lo = 0, hi = usrpdb.patchcnt;
+    while (lo < hi) {
+      unsigned mid = (lo + hi) / 2;
+      int c = gcodecmp(dbidx[mid].gcode, gamecode);
+      if (!c) {
+        lo = mid;
+        break;
+      }
+      if (c < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    if (lo < usrpdb.patchcnt && !gcodecmp(dbidx[lo].gcode, gamecode))
+      ret = 1024 + 512 * usrpdb.idxcnt + (dbidx[lo].offset >> 8) * esize;
+  } else {
+    for (unsigned i = 0; i < usrpdb.patchcnt && !ret; i++)
+      if (!gcodecmp(dbidx[i].gcode, gamecode))
+        ret = 1024 + 512 * usrpdb.idxcnt + (dbidx[i].offset >> 8) * esize;
+  }
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+  return ret;
+}
+
+typedef struct {
+  FIL *fd;
+  uint32_t blkoff;
+} t_usrblk_ctx;
+
+static bool patchusr_blkread(void *ctx, uint32_t woff, uint32_t *dst, unsigned words) {
+  const t_usrblk_ctx *bc = (t_usrblk_ctx*)ctx;
+  UINT rdbytes;
+  return FR_OK == f_lseek(bc->fd, bc->blkoff + woff * sizeof(uint32_t)) &&
+         FR_OK == f_read(bc->fd, dst, words * sizeof(uint32_t), &rdbytes) &&
+         rdbytes == words * sizeof(uint32_t);
+}
+
+static bool patchusr_lookup(const uint8_t *gamecode, t_patch *pdata) {
+  if (!usrpdb.patchcnt)
+    return false;
+
+  uint32_t offset = patchusr_find(gamecode);
+  if (!offset)
+    return false;
+
+  FIL fd;
+  if (FR_OK != f_open(&fd, USRPATCHDB_FILEPATH, FA_READ))
+    return false;
+
+  // Read the entry (header, ops and hole info) straight from the file.
+  bool found = false;
+  const bool v1 = usrpdb.dbversion == PATCHDB_V1;
+  uint32_t entry[(USRPDB_ENTRY_MAX + 3) / 4];
+  UINT rdbytes;
+  if (FR_OK != f_lseek(&fd, offset) ||
+      FR_OK != f_read(&fd, entry, sizeof(entry), &rdbytes) || rdbytes < sizeof(uint32_t))
+    goto out;
+
+  // Do not trust the file contents, check the op count (v2 checks it too).
+  if (v1) {
+    const uint32_t ph = entry[0];
+    unsigned numops = (ph & 0xFF) + ((ph >> 8) & 0x1F) + ((ph >> 16) & 0xFF) + ((ph >> 24) & 0x0F);
+    if (numops > MAX_PATCH_OPS || (1 + numops + ((ph >> 28) & 0x1)) * sizeof(uint32_t) > rdbytes)
+      goto out;
+  }
+
+  uint32_t prgpage[512 / 4];
+  set_supercard_mode(MAPPED_SDRAM, true, false);
+  memcpy32(prgpage, (void*)(ROM_USRPATCHDB_U8 + 512), sizeof(prgpage));
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+
+  if (!patchdb_load_progs((uint8_t*)prgpage, pdata))
+    goto out;
+  if (v1) {
+    patchdb_parse_entry(entry, pdata);
+    found = true;
+  } else {
+    t_usrblk_ctx bc = { &fd, usrpdb.blkoff };
+    found = patchdb_decode_entry((uint8_t*)entry, (uint8_t*)entry + rdbytes, patchusr_blkread, &bc, pdata);
+  }
+
+out:
+  f_close(&fd);
+  return found;
+}
+
+// Merged lookup: the user database takes precedence over the builtin one.
+bool patchdb_lookup(const uint8_t *gamecode, t_patch *pdata) {
+  if (patchusr_lookup(gamecode, pdata))
+    return true;
+
+  set_supercard_mode(MAPPED_SDRAM, true, false);
+  bool found = patchmem_lookup(gamecode, (uint8_t*)ROM_PATCHDB_U8, pdata);
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+  return found;
 }
 
 // Write a byte to a buffer ensuring that only 32 bit accesses are performed.
@@ -132,13 +444,28 @@ static void write_mem8(uintptr_t ptraddr, uint8_t bytedata) {
   *aptr = data;
 }
 
+// Writes a word, with a single access if the address is aligned.
 static void write_mem32(uintptr_t ptraddr, uint32_t worddata) {
+  if (!(ptraddr & 3)) {
+    *(volatile uint32_t*)ptraddr = worddata;
+    return;
+  }
   write_mem8(ptraddr + 0, worddata >>  0);
   write_mem8(ptraddr + 1, worddata >>  8);
   write_mem8(ptraddr + 2, worddata >> 16);
   write_mem8(ptraddr + 3, worddata >> 24);
 }
 
+// Writes a byte string, using word writes for the aligned part.
+static void write_mem_bytes(uintptr_t ptraddr, const uint8_t *data, unsigned size) {
+  for (; size && (ptraddr & 3); size--)
+    write_mem8(ptraddr++, *data++);
+  for (; size >= 4; size -= 4, ptraddr += 4, data += 4)
+    *(volatile uint32_t*)ptraddr = data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
+  while (size--)
+    write_mem8(ptraddr++, *data++);
+}
+
 static void copy_mem16(uintptr_t ptraddr, const uint16_t *fnptr, unsigned size) {
   for (unsigned i = 0; i < size; i++)
     ((volatile uint16_t*)ptraddr)[i] = fnptr[i];
@@ -205,145 +532,241 @@ static const t_psave_funcs pdirectsave = {
 #define FN_ARM_RET1       0xe3a00001
 #define FN_ARM_RETBX      0xe12fff1e
 
-void apply_patch_ops(const uint32_t *ops, unsigned pcount, const t_patch_prog *prgs, const t_psave_info *psi) {
-  for (unsigned i = 0; i < pcount; i++) {
-    uint32_t opc = ops[i] >> 28;
-    uint32_t arg = (ops[i] >> 25) & 7;
-    uint32_t addr = ops[i] & 0x1FFFFFF;
-
-    switch (opc) {
-    case 0x0:
-      // Patch a full program into an address.
-      for (unsigned j = 0; j < prgs[arg].length; j++)
-        write_mem8(GBA_ROM_ADDR_START + addr + j, prgs[arg].data[j]);
-      break;
-    case 0x1:   // Patch Thumb instruction
-      *(volatile uint16_t *)(GBA_ROM_ADDR_START + addr) = 0x46C0; // mov r8, r8
-      break;
-    case 0x2:   // Patch ARM instruction
-      *(volatile uint32_t *)(GBA_ROM_ADDR_START + addr) = 0xE1A00000; // mov r0, r0
-      break;
-    case 0x3:   // Write N bytes to address
-      for (unsigned j = 0; j < arg + 1; j++)
-        write_mem8(GBA_ROM_ADDR_START + addr + j, ops[(j / 4) + 1] >> (j * 8));
-      i += (arg + 1 + 3) / 4;
-      break;
-    case 0x4:   // Write N words to address
-      for (unsigned j = 0; j < arg + 1; j++)
-        write_mem32(GBA_ROM_ADDR_START + addr + j * 4, ops[++i]);
-      break;
-    case 0x5:   // Patch function with a dummy one
-      switch (arg) {
-        case 0:
-          write_mem32(GBA_ROM_ADDR_START + addr, FN_THUMB_RET0); break;
-        case 1:
-          write_mem32(GBA_ROM_ADDR_START + addr, FN_THUMB_RET1); break;
-        case 4:
-          write_mem32(GBA_ROM_ADDR_START + addr, FN_ARM_RET0);
-          write_mem32(GBA_ROM_ADDR_START + addr + 4, FN_ARM_RETBX);
-          break;
-        case 5:
-          write_mem32(GBA_ROM_ADDR_START + addr, FN_ARM_RET1);
-          write_mem32(GBA_ROM_ADDR_START + addr + 4, FN_ARM_RETBX);
-          break;
-      };
-      break;
+// Returns the handler used by save ops (EEPROM/FLASH), or NULL if invalid.
+static const f_func_info *save_handler(unsigned opc, unsigned arg, const t_psave_info *psi) {
+  if (opc == 0x8) {
+    switch (arg) {
+    case 0: return &psi->sfns->eeprom_read;
+    case 1: return &psi->sfns->eeprom_write;
+    };
+  }
+  else if (opc == 0x9) {
+    switch (arg) {
+    case 0: return &psi->sfns->flash_read;
+    case 1: return &psi->sfns->flash_erase_device;
+    case 2: return &psi->sfns->flash_erase_sector;
+    case 3: return &psi->sfns->flash_write_sector;
+    case 4: return &psi->sfns->flash_write_byte;
+    };
+  }
+  return NULL;
+}
 
-    case 0x7:    // RTC handlers
-      switch (arg) {
+static const uint16_t *rtc_handler(unsigned arg, unsigned *hwcnt) {
+  switch (arg) {
+  case 0: *hwcnt = patch_rtc_probe_end - patch_rtc_probe;             return patch_rtc_probe;
+  case 1: *hwcnt = patch_rtc_reset_end - patch_rtc_reset;             return patch_rtc_reset;
+  case 2: *hwcnt = patch_rtc_getstatus_end - patch_rtc_getstatus;     return patch_rtc_getstatus;
+  case 3: *hwcnt = patch_rtc_gettimedate_end - patch_rtc_gettimedate; return patch_rtc_gettimedate;
+  };
+  return NULL;
+}
+
+// Number of words used by an op (including its inline data).
+static unsigned patch_op_words(uint32_t op) {
+  uint32_t opc = op >> 28;
+  uint32_t arg = (op >> 25) & 7;
+  if (opc == 0x3)
+    return 1 + (arg + 1 + 3) / 4;
+  if (opc == 0x4)
+    return 1 + arg + 1;
+  return 1;
+}
+
+// Number of ROM bytes written by an op (from its address onwards).
+static unsigned patch_op_span(uint32_t op, const t_patch_prog *prgs, const t_psave_info *psi) {
+  uint32_t opc = op >> 28;
+  uint32_t arg = (op >> 25) & 7;
+  unsigned hwcnt;
+  const f_func_info *fi;
+
+  switch (opc) {
+  case 0x0: return prgs[arg].length;
+  case 0x1: return 2;
+  case 0x2: return 4;
+  case 0x3: return arg + 1;
+  case 0x4: return (arg + 1) * 4;
+  case 0x5: return arg >= 4 ? 8 : 4;
+  case 0x7: return rtc_handler(arg, &hwcnt) ? hwcnt * 2 : 0;
+  case 0x8:
+  case 0x9:
+    fi = save_handler(opc, arg, psi);
+    return fi ? *fi->size + 4 : 0;
+  };
+  return 0;
+}
+
+// Applies a single op. The ROM is mapped at "base" (which can be a buffer
+// holding a ROM chunk, offset accordingly).
+static void apply_patch_op(const uint32_t *op, uintptr_t base, const t_patch_prog *prgs, const t_psave_info *psi) {
+  uint32_t opc = op[0] >> 28;
+  uint32_t arg = (op[0] >> 25) & 7;
+  uintptr_t dst = base + (op[0] & 0x1FFFFFF);
+  unsigned hwcnt;
+  const uint16_t *rtcfn;
+  const f_func_info *fi;
+
+  switch (opc) {
+  case 0x0:
+    // Patch a full program into an address.
+    write_mem_bytes(dst, prgs[arg].data, prgs[arg].length);
+    break;
+  case 0x1:   // Patch Thumb instruction
+    *(volatile uint16_t *)dst = 0x46C0; // mov r8, r8
+    break;
+  case 0x2:   // Patch ARM instruction
+    *(volatile uint32_t *)dst = 0xE1A00000; // mov r0, r0
+    break;
+  case 0x3:   // Write N bytes to address
+    for (unsigned j = 0; j < arg + 1; j++)
+      write_mem8(dst + j, op[(j / 4) + 1] >> ((j % 4) * 8));
+    break;
+  case 0x4:   // Write N words to address
+    for (unsigned j = 0; j < arg + 1; j++)
+      write_mem32(dst + j * 4, op[j + 1]);
+    break;
+  case 0x5:   // Patch function with a dummy one
+    switch (arg) {
       case 0:
-        copy_mem16(GBA_ROM_ADDR_START + addr, patch_rtc_probe, patch_rtc_probe_end - patch_rtc_probe);
-        break;
+        write_mem32(dst, FN_THUMB_RET0); break;
       case 1:
-        copy_mem16(GBA_ROM_ADDR_START + addr, patch_rtc_reset, patch_rtc_reset_end - patch_rtc_reset);
+        write_mem32(dst, FN_THUMB_RET1); break;
+      case 4:
+        write_mem32(dst, FN_ARM_RET0);
+        write_mem32(dst + 4, FN_ARM_RETBX);
         break;
-      case 2:
-        copy_mem16(GBA_ROM_ADDR_START + addr, patch_rtc_getstatus, patch_rtc_getstatus_end - patch_rtc_getstatus);
+      case 5:
+        write_mem32(dst, FN_ARM_RET1);
+        write_mem32(dst + 4, FN_ARM_RETBX);
         break;
-      case 3:
-        copy_mem16(GBA_ROM_ADDR_START + addr, patch_rtc_gettimedate, patch_rtc_gettimedate_end - patch_rtc_gettimedate);
-        break;
-      };
-      break;
+    };
+    break;
+
+  case 0x7:    // RTC handlers
+    rtcfn = rtc_handler(arg, &hwcnt);
+    if (rtcfn)
+      copy_mem16(dst, rtcfn, hwcnt);
+    break;
+
+  case 0x8:    // EEPROM memory handlers
+  case 0x9:    // FLASH memory handlers
+    // Copy the handler, followed by the DirectSave payload address.
+    fi = save_handler(opc, arg, psi);
+    if (fi) {
+      copy_mem16(dst, fi->ptr, *fi->size / 2);
+      write_mem32(dst + *fi->size, psi->dspayload_addr);
+    }
+    break;
+  };
+}
 
-    case 0x8:    // EEPROM memory handlers
-      switch (arg) {
-      case 0:      // EEPROM rease handler
-        copy_mem16(GBA_ROM_ADDR_START + addr, psi->sfns->eeprom_read.ptr, *psi->sfns->eeprom_read.size);
-        write_mem32(GBA_ROM_ADDR_START + addr + *psi->sfns->eeprom_read.size, psi->dspayload_addr);
-        break;
-      case 1:      // EEPROM write handler
-        copy_mem16(GBA_ROM_ADDR_START + addr, psi->sfns->eeprom_write.ptr, *psi->sfns->eeprom_write.size);
-        write_mem32(GBA_ROM_ADDR_START + addr + *psi->sfns->eeprom_write.size, psi->dspayload_addr);
-        break;
-      };
-      break;
+void apply_patch_ops(const uint32_t *ops, unsigned pcount, const t_patch_prog *prgs, const t_psave_info *psi) {
+  for (unsigned i = 0; i < pcount; i += patch_op_words(ops[i]))
+    apply_patch_op(&ops[i], GBA_ROM_ADDR_START, prgs, psi);
+}
 
-    case 0x9:    // FLASH memory handlers
-      switch (arg) {
-      case 0x0:    // FLASH read handler
-        copy_mem16(GBA_ROM_ADDR_START + addr, psi->sfns->flash_read.ptr, *psi->sfns->flash_read.size);
-        write_mem32(GBA_ROM_ADDR_START + addr + *psi->sfns->flash_read.size, psi->dspayload_addr);
-        break;
-      case 0x1:    // FLASH erase device handler
-        copy_mem16(GBA_ROM_ADDR_START + addr, psi->sfns->flash_erase_device.ptr, *psi->sfns->flash_erase_device.size);
-        write_mem32(GBA_ROM_ADDR_START + addr + *psi->sfns->flash_erase_device.size, psi->dspayload_addr);
-        break;
-      case 0x2:    // FLASH erase sector handler
-        copy_mem16(GBA_ROM_ADDR_START + addr, psi->sfns->flash_erase_sector.ptr, *psi->sfns->flash_erase_sector.size);
-        write_mem32(GBA_ROM_ADDR_START + addr + *psi->sfns->flash_erase_sector.size, psi->dspayload_addr);
-        break;
-      case 0x3:    // FLASH write sector handler
-        copy_mem16(GBA_ROM_ADDR_START + addr, psi->sfns->flash_write_sector.ptr, *psi->sfns->flash_write_sector.size);
-        write_mem32(GBA_ROM_ADDR_START + addr + *psi->sfns->flash_write_sector.size, psi->dspayload_addr);
-        break;
-      case 0x4:    // FLASH write device handler
-        copy_mem16(GBA_ROM_ADDR_START + addr, psi->sfns->flash_write_byte.ptr, *psi->sfns->flash_write_byte.size);
-        write_mem32(GBA_ROM_ADDR_START + addr + *psi->sfns->flash_write_byte.size, psi->dspayload_addr);
-        break;
-      };
-    };
-  }
+static void patch_psave_info(t_psave_info *psi, const t_patch *pdata, uint32_t ds_addr) {
+  // Save patch routines vary depending on whether DirectSave is enabled or not.
+  psi->dspayload_addr = ds_addr;
+  psi->sfns = ds_addr                                ? &pdirectsave :
+              pdata->save_mode == SaveTypeFlash1024K ? &psram_conversion_128k
+                                                     : &psram_conversion_64k;
 }
 
+// Patches the ROM entry point (to jump to the IGM) and the RTC clock values.
+static void patch_rom_header(const t_rtc_state *rtc_clock, uint32_t igmenu_addr) {
+  if (igmenu_addr) {
+    // Calculate the branch from 0x08000000 to igmenu_addr
+    unsigned brop = 0xEA000000 | ((igmenu_addr - 0x08000000 - 8) >> 2);
+    // Patch the first instruction with the branch opcode
+    write_mem32(GBA_ROM_ADDR_START, brop);
+  }
+
+  if (rtc_clock) {
+    // Setup initial RTC clock
+    write_mem8(GBA_ROM_ADDR_START + 0xC5, rtc_clock->hour);
+    write_mem8(GBA_ROM_ADDR_START + 0xC6, rtc_clock->mins);
+    write_mem8(GBA_ROM_ADDR_START + 0xC7, rtc_clock->day);
+    write_mem8(GBA_ROM_ADDR_START + 0xC8, rtc_clock->month);
+    write_mem8(GBA_ROM_ADDR_START + 0xC9, rtc_clock->year);
+  }
+}
 
 // Applies a patch directly into the ROM memory
 bool patch_apply_rom(const t_patch *pdata, const t_rtc_state *rtc_clock, uint32_t igmenu_addr, uint32_t ds_addr) {
   // Apply the WAIT CNT patches
   unsigned base_cnt = pdata->wcnt_ops + pdata->save_ops;
   const uint32_t *ops = &pdata->op[0];
-  // Save patch routines vary depending on whether DirectSave is enabled or not.
-  t_psave_info psi = {
-    .dspayload_addr = ds_addr,
-    .sfns = ds_addr                                ? &pdirectsave :
-            pdata->save_mode == SaveTypeFlash1024K ? &psram_conversion_128k
-                                                   : &psram_conversion_64k
-  };
+  t_psave_info psi;
+  patch_psave_info(&psi, pdata, ds_addr);
 
   // Apply the waitcnt and save patches.
   apply_patch_ops(ops, base_cnt, pdata->prgs, &psi);
 
   // Apply optional patches, they are placed right after.
-  if (igmenu_addr) {
+  if (igmenu_addr)
     apply_patch_ops(&ops[base_cnt], pdata->irqh_ops, pdata->prgs, &psi);
 
-    // Calculate the branch from 0x08000000 to igmenu_addr
-    unsigned brop = 0xEA000000 | ((igmenu_addr - 0x08000000 - 8) >> 2);
-    // Patch the first instruction with the branch opcode
-    write_mem32(GBA_ROM_ADDR_START, brop);
+  if (rtc_clock)
+    apply_patch_ops(&ops[base_cnt + pdata->irqh_ops], pdata->rtc_ops, pdata->prgs, &psi);
+
+  patch_rom_header(rtc_clock, igmenu_addr);
+  return true;
+}
+
+// Fused patching, ops are applied to the ROM chunks as they are loaded.
+
+static void patch_stream_add(t_patch_stream *ps, unsigned first, unsigned count) {
+  const uint32_t *ops = ps->pdata->op;
+  for (unsigned i = first; i < first + count; i += patch_op_words(ops[i])) {
+    // Insertion sort (stable), by address.
+    unsigned addr = ops[i] & 0x1FFFFFF, j = ps->count++;
+    for (; j > 0 && (ops[ps->idx[j-1]] & 0x1FFFFFF) > addr; j--)
+      ps->idx[j] = ps->idx[j-1];
+    ps->idx[j] = i;
   }
+}
 
-  if (rtc_clock) {
-    // Apply RTC patches and setup initial RTC clock
-    apply_patch_ops(&ops[base_cnt + pdata->irqh_ops], pdata->rtc_ops, pdata->prgs, &psi);
+void patch_stream_init(t_patch_stream *ps, const t_patch *pdata, bool igmenu, bool rtc, uint32_t ds_addr) {
+  unsigned base_cnt = pdata->wcnt_ops + pdata->save_ops;
+  memset(ps, 0, sizeof(*ps));
+  ps->pdata = pdata;
+  ps->ds_addr = ds_addr;
+
+  patch_stream_add(ps, 0, base_cnt);
+  if (igmenu)
+    patch_stream_add(ps, base_cnt, pdata->irqh_ops);
+  if (rtc)
+    patch_stream_add(ps, base_cnt + pdata->irqh_ops, pdata->rtc_ops);
+}
 
-    write_mem8(GBA_ROM_ADDR_START + 0xC5, rtc_clock->hour);
-    write_mem8(GBA_ROM_ADDR_START + 0xC6, rtc_clock->mins);
-    write_mem8(GBA_ROM_ADDR_START + 0xC7, rtc_clock->day);
-    write_mem8(GBA_ROM_ADDR_START + 0xC8, rtc_clock->month);
-    write_mem8(GBA_ROM_ADDR_START + 0xC9, rtc_clock->year);
+void patch_stream_chunk(t_patch_stream *ps, uint8_t *buf, uint32_t offset, uint32_t size) {
+  t_psave_info psi;
+  patch_psave_info(&psi, ps->pdata, ps->ds_addr);
+
+  for (; ps->next < ps->count; ps->next++) {
+    const uint32_t *op = &ps->pdata->op[ps->idx[ps->next]];
+    uint32_t addr = op[0] & 0x1FFFFFF;
+    if (addr >= offset + size)
+      break;            // Belongs to some later chunk
+
+    // Ops not fully contained in this chunk are left for the post-pass.
+    if (addr >= offset && addr + patch_op_span(op[0], ps->pdata->prgs, &psi) <= offset + size)
+      apply_patch_op(op, (uintptr_t)buf - offset, ps->pdata->prgs, &psi);
+    else
+      ps->pending[ps->next / 32] |= 1U << (ps->next % 32);
   }
+}
+
+bool patch_stream_finish(t_patch_stream *ps, const t_rtc_state *rtc_clock, uint32_t igmenu_addr) {
+  t_psave_info psi;
+  patch_psave_info(&psi, ps->pdata, ps->ds_addr);
+
+  for (unsigned i = 0; i < ps->count; i++)
+    if (i >= ps->next || (ps->pending[i / 32] & (1U << (i % 32))))
+      apply_patch_op(&ps->pdata->op[ps->idx[i]], GBA_ROM_ADDR_START, ps->pdata->prgs, &psi);
 
+  patch_rom_header(rtc_clock, igmenu_addr);
   return true;
 }
 
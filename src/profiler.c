@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "common.h"
+#include "profiler.h"
+
+#ifdef PROFILER_ENABLED
+
+#include "fatfs/ff.h"
+#include "nanoprintf.h"
+
+t_prof_entry prof_table[PROF_MAX];
+
+static const char * const prof_names[PROF_MAX] = {
+  "load_gba_rom",
+  "patchengine",
+  "browser_reload",
+  "menu_render",
+  "f_read",
+  "sdcard_read",
+};
+
+void prof_init() {
+  prof_reset();
+  timer_cycles_start();
+}
+
+void prof_reset() {
+  memset(prof_table, 0, sizeof(prof_table));
+}
+
+const char *prof_name(unsigned probe) {
+  return prof_names[probe];
+}
+
+bool prof_dump(const char *fn) {
+  FIL fd;
+  if (FR_OK != f_open(&fd, fn, FA_WRITE | FA_CREATE_ALWAYS))
+    return false;
+
+  char line[96];
+  UINT wrbytes;
+  for (unsigned i = 0; i < PROF_MAX; i++) {
+    const t_prof_entry *e = &prof_table[i];
+    // Cycles are 16.78MHz ticks, so 2^24 cycles per second.
+    npf_snprintf(line, sizeof(line), "%-16s %8lu calls %10lu ms %10lu cycles/call\n",
+                 prof_names[i], e->calls, (uint32_t)((e->cycles * 1000) >> 24),
+                 e->calls ? (uint32_t)(e->cycles / e->calls) : 0);
+    if (FR_OK != f_write(&fd, line, strlen(line), &wrbytes)) {
+      f_close(&fd);
+      return false;
+    }
+  }
+
+  return FR_OK == f_close(&fd);
+}
+
+#endif
+
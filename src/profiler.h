@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Lightweight hot-path profiler. Probes accumulate call counts and cycles
+// (using the timer based cycle counter) in a fixed table. Only built when
+// PROFILER_ENABLED is defined, otherwise probes compile to nothing.
+
+// Probe IDs, one per instrumented function.
+typedef enum {
+  PROF_LOAD_GBA_ROM    = 0,
+  PROF_PATCHENGINE     = 1,
+  PROF_BROWSER_RELOAD  = 2,
+  PROF_MENU_RENDER     = 3,
+  PROF_F_READ          = 4,
+  PROF_SDCARD_READ     = 5,
+  PROF_MAX             = 6,
+} t_prof_probe;
+
+#ifdef PROFILER_ENABLED
+
+#include "gbahw.h"
+
+typedef struct {
+  uint32_t calls;
+  uint64_t cycles;
+} t_prof_entry;
+
+typedef struct {
+  unsigned probe;             // PROF_MAX if already accounted
+  uint32_t start;
+} t_prof_scope;
+
+extern t_prof_entry prof_table[PROF_MAX];
+
+static inline void prof_scope_end(t_prof_scope *s) {
+  if (s->probe < PROF_MAX) {
+    prof_table[s->probe].calls++;
+    prof_table[s->probe].cycles += timer_cycles_read() - s->start;
+    s->probe = PROF_MAX;
+  }
+}
+
+// Accounts the time spent from here until the current scope is left.
+#define PROF_SCOPE(probe)                                               \
+  t_prof_scope __prof_scope __attribute__((cleanup(prof_scope_end))) = \
+    { (probe), timer_cycles_read() }
+
+// Accounts the current scope early (ie. before some noreturn call).
+#define PROF_SCOPE_CLOSE()     prof_scope_end(&__prof_scope)
+
+// Writes the profiling table to the SD card.
+#define PROF_DUMP()            prof_dump(PROFILE_FILEPATH)
+
+void prof_init();
+void prof_reset();
+const char *prof_name(unsigned probe);
+bool prof_dump(const char *fn);
+
+#else
+
+#define PROF_SCOPE(probe)
+#define PROF_SCOPE_CLOSE()
+#define PROF_DUMP()
+
+#endif
+
+#endif
+
@@ -315,6 +315,62 @@ bool file_is_contiguous(const char *fn, LBA_t *lba) {
   return true;
 }
 
+// Fast seek cluster maps (CLMT). Maps are allocated from a small pool in runs
+// of slots, so that a few large files can be mapped at the same time.
+#define CLMT_SLOTS             8
+#define CLMT_SLOT_WORDS       64
+
+static DWORD clmt_pool[CLMT_SLOTS][CLMT_SLOT_WORDS];
+static const FIL *clmt_owner[CLMT_SLOTS];
+
+bool file_fastseek_map(FIL *fd, DWORD *tbl, unsigned words) {
+  tbl[0] = words;
+  fd->cltbl = tbl;
+  if (FR_OK == f_lseek(fd, CREATE_LINKMAP))
+    return true;
+
+  // Too fragmented (tbl[0] holds the required size) or FS error.
+  fd->cltbl = NULL;
+  return false;
+}
+
+bool file_fastseek_open(FIL *fd) {
+  if (f_size(fd) < FASTSEEK_MIN_SIZE)
+    return false;
+
+  // Start with one slot, retry with the required size if the table is short.
+  unsigned nslots = 1;
+  while (nslots <= CLMT_SLOTS) {
+    unsigned first = 0, run = 0;
+    for (unsigned i = 0; i < CLMT_SLOTS && run < nslots; i++) {
+      run = clmt_owner[i] ? 0 : run + 1;
+      first = i + 1 - run;
+    }
+    if (run < nslots)
+      return false;        // Pool exhausted, just walk the FAT.
+
+    DWORD *tbl = &clmt_pool[first][0];
+    if (file_fastseek_map(fd, tbl, nslots * CLMT_SLOT_WORDS)) {
+      for (unsigned i = 0; i < nslots; i++)
+        clmt_owner[first + i] = fd;
+      return true;
+    }
+
+    unsigned reqslots = (tbl[0] + CLMT_SLOT_WORDS - 1) / CLMT_SLOT_WORDS;
+    if (reqslots <= nslots)
+      return false;        // Not a size issue (ie. I/O error)
+    nslots = reqslots;
+  }
+  return false;
+}
+
+void file_fastseek_close(FIL *fd) {
+  for (unsigned i = 0; i < CLMT_SLOTS; i++)
+    if (clmt_owner[i] == fd)
+      clmt_owner[i] = NULL;
+  fd->cltbl = NULL;
+}
+
 // Creates a copy, or an empty FF file (contiguous)
 bool copy_save_contiguous_file(const char *fn, const char *dest, unsigned size) {
   // Ensure the out path exists, create it!
@@ -395,6 +451,9 @@ unsigned prepare_sram_based_savegame(t_sram_load_policy loadp, t_sram_save_polic
     sram_template_filename_calc(savefn, "", savetmpl);
     if (!program_sram_dump(savetmpl, backup_sram_default))
       return ERR_SAVE_CANTWRITE;
+    // Flag it in the boot state, otherwise the next boot won't look for it.
+    if (!bootstate_set_pending(BOOTSTATE_PEND_SAVE))
+      return ERR_SAVE_CANTWRITE;
   }
   else { /* Save disabled */
     if (!program_sram_dump(NULL, 0))   // Remove sentinel file, no save on reboot.
@@ -62,5 +62,17 @@ void erase_sram();
 // Check a contiguous file and return its LBA address
 bool file_is_contiguous(const char *fn, LBA_t *lba);
 
+// Fast seek support: builds a cluster link map for an open (read) file so
+// that reads and seeks do not need to walk the FAT chain. If the map cannot
+// be built the file falls back to regular FAT access.
+#define FASTSEEK_MIN_SIZE      (128*1024)
+
+// Builds the map in a caller provided table (must outlive its use).
+bool file_fastseek_map(FIL *fd, DWORD *tbl, unsigned words);
+// Builds the map using the shared pool (for files above FASTSEEK_MIN_SIZE).
+bool file_fastseek_open(FIL *fd);
+// Returns the map to the pool (call before closing the file).
+void file_fastseek_close(FIL *fd);
+
 #endif
 
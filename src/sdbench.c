@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+// SD card benchmark suite.
+// Runs a matrix of test cases (access pattern, request size and I/O layer)
+// against a contiguous scratch file, timing every request using the cycle
+// counter. Reports throughput and latency percentiles per test case.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "gbahw.h"
+#include "common.h"
+#include "util.h"
+#include "sdbench.h"
+#include "supercard_driver.h"
+#include "save.h"
+#include "fatfs/ff.h"
+#include "nanoprintf.h"
+
+extern bool slowsd;
+extern t_card_info sd_info;
+
+#define BENCH_FILE_SIZE      (8*1024*1024)     // Scratch file size
+#define BENCH_CASE_BYTES     (1024*1024)       // Max bytes moved per test case
+#define BENCH_MAX_SAMPLES           128        // Max requests per test case
+
+// We need up to 64KiB of buffer, VRAM is the only memory big enough for
+// that. The screen will display garbage while the benchmark runs.
+#define BENCH_BUFFER         ((uint8_t*)MEM_VRAM)
+
+#define BENCH_RAW          0x01     // Use the SD driver (instead of FatFs)
+#define BENCH_WRITE        0x02     // Write test (instead of read)
+#define BENCH_RANDOM       0x04     // Random offsets (instead of sequential)
+#define BENCH_SINGLE       0x08     // Single block commands (raw only)
+
+static const uint8_t bench_cases[] = {
+  BENCH_RAW,
+  BENCH_RAW | BENCH_SINGLE,
+  BENCH_RAW | BENCH_RANDOM,
+  BENCH_RAW | BENCH_WRITE,
+  BENCH_RAW | BENCH_WRITE | BENCH_SINGLE,
+  BENCH_RAW | BENCH_WRITE | BENCH_RANDOM,
+  0,
+  BENCH_RANDOM,
+  BENCH_WRITE,
+  BENCH_WRITE | BENCH_RANDOM,
+};
+
+// Request sizes, in 512 byte blocks (512B to 64KiB)
+static const uint8_t bench_sizes[] = { 1, 4, 16, 64, 128 };
+
+#define BENCH_CASE_CNT  (sizeof(bench_cases) / sizeof(bench_cases[0]))
+#define BENCH_SIZE_CNT  (sizeof(bench_sizes) / sizeof(bench_sizes[0]))
+
+// Cycles (16.78MHz) to microseconds
+static inline uint32_t cycles_us(uint32_t cycles) {
+  return (uint32_t)(((uint64_t)cycles * 15625) >> 18);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t va = *(uint32_t*)a, vb = *(uint32_t*)b;
+  return va < vb ? -1 : va > vb ? 1 : 0;
+}
+
+// Performs one request (as timed unit) at the given block offset.
+static bool bench_request(unsigned flags, FIL *fd, LBA_t lba, unsigned blkoff, unsigned blocks) {
+  uint8_t *buf = BENCH_BUFFER;
+  if (flags & BENCH_RAW) {
+    // Multi-block issues just one command, single-block one per block.
+    unsigned step = (flags & BENCH_SINGLE) ? 1 : blocks;
+    for (unsigned i = 0; i < blocks; i += step) {
+      unsigned ret = (flags & BENCH_WRITE) ?
+        sdcard_write_blocks(&buf[i * 512], lba + blkoff + i, step) :
+        sdcard_read_blocks(&buf[i * 512], lba + blkoff + i, step);
+      if (ret)
+        return false;
+    }
+    return true;
+  }
+
+  UINT xfered;
+  if (f_tell(fd) != blkoff * 512 && FR_OK != f_lseek(fd, blkoff * 512))
+    return false;
+  FRESULT res = (flags & BENCH_WRITE) ?
+    f_write(fd, buf, blocks * 512, &xfered) :
+    f_read(fd, buf, blocks * 512, &xfered);
+
+  return res == FR_OK && xfered == blocks * 512;
+}
+
+static void bench_format(char *line, unsigned maxlen, unsigned flags, unsigned blocks,
+                         unsigned reqcnt, unsigned kibps, const uint32_t *lat) {
+  npf_snprintf(line, maxlen, "%-5s %-5s %-4s %-6s %3uK %4u req %6u KiB/s | "
+               "p50 %lu p90 %lu p99 %lu max %lu us\n",
+               (flags & BENCH_RAW) ? "raw" : "fatfs",
+               (flags & BENCH_WRITE) ? "write" : "read",
+               (flags & BENCH_RANDOM) ? "rand" : "seq",
+               !(flags & BENCH_RAW) ? "" : (flags & BENCH_SINGLE) ? "single" : "multi",
+               blocks / 2, reqcnt, kibps,
+               cycles_us(lat[reqcnt / 2]), cycles_us(lat[reqcnt * 9 / 10]),
+               cycles_us(lat[reqcnt * 99 / 100]), cycles_us(lat[reqcnt - 1]));
+}
+
+unsigned sdbench_run(progress_abort_fn progcb, t_sdbench_summary *summary) {
+  FIL fd, fo;
+  LBA_t lba;
+  char line[128];
+  unsigned ret = 0;
+
+  summary->seqread_kibps = summary->seqwrite_kibps = 0;
+
+  // Create a contiguous scratch file, so raw tests do not clobber anything.
+  f_mkdir(SUPERFW_DIR);
+  if (FR_OK != f_open(&fd, SDBENCH_TMPFILE, FA_WRITE | FA_CREATE_ALWAYS))
+    return SDBENCH_ERR_FILE;
+  FRESULT res = f_expand(&fd, BENCH_FILE_SIZE, 1);
+  f_close(&fd);
+  if (res != FR_OK || !file_is_contiguous(SDBENCH_TMPFILE, &lba)) {
+    f_unlink(SDBENCH_TMPFILE);
+    return SDBENCH_ERR_FILE;
+  }
+
+  // Results are appended, so that several runs (ie. with different settings)
+  // can be compared.
+  if (FR_OK != f_open(&fo, SDBENCH_FILEPATH, FA_WRITE | FA_OPEN_APPEND)) {
+    f_unlink(SDBENCH_TMPFILE);
+    return SDBENCH_ERR_FILE;
+  }
+
+  UINT wrbytes;
+  npf_snprintf(line, sizeof(line), "SD benchmark | Card ID: %02x/%04x | %s %lu MiB | %s SD mode\n",
+               sd_info.manufacturer, sd_info.oemid, sd_info.sdhc ? "SDHC" : "SDSC",
+               sd_info.block_cnt >> 11, slowsd ? "slow" : "fast");
+  f_write(&fo, line, strlen(line), &wrbytes);
+  #ifdef SD_VERIFY_READS
+  npf_snprintf(line, sizeof(line), "Verified reads | speed level %u | %u CRC errors\n",
+               sdcard_read_level(), sdcard_crc_errors());
+  f_write(&fo, line, strlen(line), &wrbytes);
+  #endif
+
+  // Only cycle deltas are used, so a running counter (profiler builds) is
+  // not restarted, that would corrupt the profile.
+  #ifndef PROFILER_ENABLED
+  timer_cycles_start();
+  #endif
+  uint32_t rndst = 0x1234567;
+
+  for (unsigned c = 0; c < BENCH_CASE_CNT && !ret; c++) {
+    const unsigned flags = bench_cases[c];
+    if (!(flags & BENCH_RAW) &&
+        FR_OK != f_open(&fd, SDBENCH_TMPFILE, FA_READ | FA_WRITE)) {
+      ret = SDBENCH_ERR_FILE;
+      break;
+    }
+
+    for (unsigned s = 0; s < BENCH_SIZE_CNT; s++) {
+      const unsigned blocks = bench_sizes[s];
+      const unsigned maxreq = BENCH_FILE_SIZE / 512 / blocks;
+      const unsigned reqcnt = MIN(BENCH_MAX_SAMPLES, BENCH_CASE_BYTES / 512 / blocks);
+      // Sequential tests start at different offsets for each test case.
+      unsigned seqoff = ((c * BENCH_SIZE_CNT + s) * reqcnt) % (maxreq - reqcnt);
+
+      if (progcb(c * BENCH_SIZE_CNT + s, BENCH_CASE_CNT * BENCH_SIZE_CNT)) {
+        ret = SDBENCH_ABORTED;
+        break;
+      }
+
+      uint32_t lat[BENCH_MAX_SAMPLES];
+      uint32_t total = 0;
+      for (unsigned i = 0; i < reqcnt; i++) {
+        unsigned reqn = seqoff + i;
+        if (flags & BENCH_RANDOM) {
+          rndst = rndst * 1103515245 + 12345;
+          reqn = (rndst >> 8) % maxreq;
+        }
+
+        uint32_t t0 = timer_cycles_read();
+        bool ok = bench_request(flags, &fd, lba, reqn * blocks, blocks);
+        lat[i] = timer_cycles_read() - t0;
+        total += lat[i];
+
+        if (!ok) {
+          ret = SDBENCH_ERR_IO;
+          break;
+        }
+      }
+      if (ret)
+        break;
+
+      // Throughput in KiB/s is: (bytes / 1024) / (cycles / 2^24)
+      unsigned kibps = ((reqcnt * blocks * 512) << 4) / MAX(1, total >> 10);
+      if (!(flags & BENCH_RANDOM)) {
+        if (flags & BENCH_WRITE)
+          summary->seqwrite_kibps = MAX(summary->seqwrite_kibps, kibps);
+        else
+          summary->seqread_kibps = MAX(summary->seqread_kibps, kibps);
+      }
+
+      heapsort4(lat, reqcnt, 1, cmp_u32);
+      bench_format(line, sizeof(line), flags, blocks, reqcnt, kibps, lat);
+      f_write(&fo, line, strlen(line), &wrbytes);
+    }
+
+    if (!(flags & BENCH_RAW))
+      f_close(&fd);
+  }
+
+  if (ret == SDBENCH_ERR_IO)
+    f_write(&fo, "I/O error, benchmark stopped!\n", 30, &wrbytes);
+  f_write(&fo, "\n", 1, &wrbytes);
+  f_close(&fo);
+  f_unlink(SDBENCH_TMPFILE);
+
+  return ret;
+}
+
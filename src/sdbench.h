@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SDBENCH_H_
+#define _SDBENCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "common.h"
+
+#define SDBENCH_ERR_FILE      1    // Could not create the scratch/result files
+#define SDBENCH_ERR_IO        2    // Some read/write operation failed
+#define SDBENCH_ABORTED       3    // User aborted the benchmark
+
+typedef struct {
+  unsigned seqread_kibps;      // Best sequential read throughput
+  unsigned seqwrite_kibps;     // Best sequential write throughput
+} t_sdbench_summary;
+
+// Runs the full SD benchmark suite (raw driver and FatFs, reads and writes,
+// sequential and random, several request sizes). Results are appended to
+// SDBENCH_FILEPATH. Returns zero on success or an SDBENCH_* code.
+unsigned sdbench_run(progress_abort_fn progcb, t_sdbench_summary *summary);
+
+#endif
+
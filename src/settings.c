@@ -18,12 +18,14 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 
 #include "settings.h"
 #include "fatfs/ff.h"
 #include "common.h"
 #include "nanoprintf.h"
 #include "util.h"
+#include "crc.h"
 
 unsigned lang_lookup(uint16_t code);
 uint16_t lang_getcode();
@@ -82,6 +84,55 @@ uint32_t ingamemenu_default = 1;
 uint32_t rtcpatch_default = 1;
 t_rtc_state rtcvalue_default = { 20, 1, 26, 12, 0 };
 
+// Boot state blob. The header (first sector) holds the settings and flags,
+// followed by the recent list (as in the text file). The size and date of the
+// settings text files are recorded too, so that hand edits invalidate it.
+#define BOOTSTATE_MAGIC         0x54534246    // "FBST"
+#define BOOTSTATE_VERSION                2
+#define BOOTSTATE_HDRSIZE              512
+
+#define BST_STAMP_SETTINGS               0
+#define BST_STAMP_UISETTINGS             1
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t hdrsize;
+  uint32_t pending;                    // BOOTSTATE_PEND_* flags
+  uint32_t recent_size;                // Recent list size and CRC32
+  uint32_t recent_crc;
+  uint32_t stamps[2][2];               // Settings files size and date/time
+  // UI settings
+  uint32_t menu_theme, recent_menu, show_hidden_files, anim_speed, langcode;
+  // Settings
+  uint32_t hotkey_combo, boot_bios_splash, save_path_default, state_path_default;
+  uint32_t backup_sram_default, enable_cheats, use_slowsd, use_fastew;
+  uint32_t patcher_default, ingamemenu_default, rtcpatch_default;
+  uint32_t autoload_default, autosave_default, autosave_prefer_ds;
+  t_rtc_state rtcvalue_default;
+  uint8_t pad[3];
+  uint32_t crc;                        // CRC32 of all the fields above
+} t_bootstate;
+
+_Static_assert (sizeof(t_bootstate) <= BOOTSTATE_HDRSIZE, "boot state header fits a sector");
+_Static_assert (sizeof(t_bootstate) % 4 == 0, "t_bootstate must be word-friendly");
+
+static bool bst_valid = false;         // The blob on disk is valid and up to date
+static uint32_t bst_pending = 0;
+static uint32_t bst_recent_size = 0, bst_recent_crc = 0;
+static const char *bst_recent = NULL;
+static uint32_t bst_stamps[2][2];
+
+// Size and modification date of a settings file (all ones if missing).
+static void bootstate_stamp(const char *fn, uint32_t *stamp) {
+  FILINFO fi;
+  if (FR_OK == f_stat(fn, &fi)) {
+    stamp[0] = fi.fsize;
+    stamp[1] = (fi.fdate << 16) | fi.ftime;
+  } else
+    stamp[0] = stamp[1] = ~0U;
+}
+
 // Setting loading/saving routines
 bool save_ui_settings() {
   // Create the directory (just in case it doesn't exist
@@ -109,7 +160,8 @@ bool save_ui_settings() {
   FRESULT res = f_write(&fd, buf, strlen(buf), &wrbytes);
   f_close(&fd);
 
-  return FR_OK == res;
+  bootstate_stamp(UISETTINGS_FILEPATH, bst_stamps[BST_STAMP_UISETTINGS]);
+  return FR_OK == res && bootstate_set_pending(0);
 }
 
 bool save_settings() {
@@ -152,7 +204,8 @@ bool save_settings() {
   FRESULT res = f_write(&fd, buf, strlen(buf), &wrbytes);
   f_close(&fd);
 
-  return FR_OK == res;
+  bootstate_stamp(SETTINGS_FILEPATH, bst_stamps[BST_STAMP_SETTINGS]);
+  return FR_OK == res && bootstate_set_pending(0);
 }
 
 static void parse_settings(void *usr, const char *var, const char *value) {
@@ -252,6 +305,219 @@ void load_settings() {
   }
 }
 
+static void bootstate_fill(t_bootstate *bs) {
+  memset(bs, 0, sizeof(*bs));
+  bs->magic = BOOTSTATE_MAGIC;
+  bs->version = BOOTSTATE_VERSION;
+  bs->hdrsize = sizeof(*bs);
+  bs->pending = bst_pending;
+  bs->recent_size = bst_recent_size;
+  bs->recent_crc = bst_recent_crc;
+  memcpy(bs->stamps, bst_stamps, sizeof(bs->stamps));
+
+  bs->menu_theme = menu_theme;
+  bs->recent_menu = recent_menu;
+  bs->show_hidden_files = show_hidden_files;
+  bs->anim_speed = anim_speed;
+  bs->langcode = lang_getcode();
+
+  bs->hotkey_combo = hotkey_combo;
+  bs->boot_bios_splash = boot_bios_splash;
+  bs->save_path_default = save_path_default;
+  bs->state_path_default = state_path_default;
+  bs->backup_sram_default = backup_sram_default;
+  bs->enable_cheats = enable_cheats;
+  bs->use_slowsd = use_slowsd;
+  bs->use_fastew = use_fastew;
+  bs->patcher_default = patcher_default;
+  bs->ingamemenu_default = ingamemenu_default;
+  bs->rtcpatch_default = rtcpatch_default;
+  bs->autoload_default = autoload_default;
+  bs->autosave_default = autosave_default;
+  bs->autosave_prefer_ds = autosave_prefer_ds;
+  bs->rtcvalue_default = rtcvalue_default;
+
+  bs->crc = crc32_update(0, (uint8_t*)bs, offsetof(t_bootstate, crc));
+}
+
+bool bootstate_load(void *buf) {
+  bst_valid = false;
+  bst_recent = NULL;
+
+  // Read the whole thing with a single read.
+  FIL fd;
+  if (FR_OK != f_open(&fd, BOOTSTATE_FILEPATH, FA_READ))
+    return false;
+
+  UINT rdbytes;
+  FRESULT res = f_read(&fd, buf, BOOTSTATE_MAXSIZE, &rdbytes);
+  f_close(&fd);
+  if (res != FR_OK || rdbytes < BOOTSTATE_HDRSIZE)
+    return false;
+
+  t_bootstate bs;
+  memcpy32(&bs, buf, sizeof(bs));
+  if (bs.magic != BOOTSTATE_MAGIC || bs.version != BOOTSTATE_VERSION ||
+      bs.hdrsize != sizeof(bs) || bs.crc != crc32_update(0, (uint8_t*)&bs, offsetof(t_bootstate, crc)))
+    return false;
+
+  const uint8_t *recent = &((uint8_t*)buf)[BOOTSTATE_HDRSIZE];
+  if (bs.recent_size > rdbytes - BOOTSTATE_HDRSIZE ||
+      bs.recent_crc != crc32_update(0, recent, bs.recent_size))
+    return false;
+
+  // The text files are the editable source, drop the blob if they changed.
+  bootstate_stamp(SETTINGS_FILEPATH, bst_stamps[BST_STAMP_SETTINGS]);
+  bootstate_stamp(UISETTINGS_FILEPATH, bst_stamps[BST_STAMP_UISETTINGS]);
+  if (memcmp(bs.stamps, bst_stamps, sizeof(bs.stamps)))
+    return false;
+
+  menu_theme = bs.menu_theme;
+  recent_menu = bs.recent_menu;
+  show_hidden_files = bs.show_hidden_files;
+  anim_speed = bs.anim_speed;
+  lang_id = lang_lookup(bs.langcode);
+
+  hotkey_combo = bs.hotkey_combo % hotkey_listcnt;
+  boot_bios_splash = bs.boot_bios_splash & 1;
+  save_path_default = bs.save_path_default % SaveDirCNT;
+  state_path_default = bs.state_path_default % StateDirCNT;
+  backup_sram_default = bs.backup_sram_default;
+  enable_cheats = bs.enable_cheats & 1;
+  use_slowsd = bs.use_slowsd & 1;
+  use_fastew = bs.use_fastew & 1;
+  patcher_default = bs.patcher_default % PatchTotalCNT;
+  ingamemenu_default = bs.ingamemenu_default & 1;
+  rtcpatch_default = bs.rtcpatch_default & 1;
+  autoload_default = bs.autoload_default & 1;
+  autosave_default = bs.autosave_default & 1;
+  autosave_prefer_ds = bs.autosave_prefer_ds & 1;
+  rtcvalue_default = bs.rtcvalue_default;
+
+  bst_pending = bs.pending;
+  bst_recent_size = bs.recent_size;
+  bst_recent_crc = bs.recent_crc;
+  bst_recent = (const char*)recent;
+  bst_valid = true;
+  return true;
+}
+
+bool bootstate_valid() {
+  return bst_valid;
+}
+
+unsigned bootstate_pending() {
+  return bst_pending;
+}
+
+const char *bootstate_recent(unsigned *size) {
+  *size = bst_recent_size;
+  return bst_recent;
+}
+
+// Rewrites the header with the current settings/flags. If that fails the
+// blob is deleted, so that the next boot uses the regular files instead.
+static bool bootstate_write_header() {
+  if (!bst_valid)
+    return true;     // Nothing to update, will be regenerated.
+
+  t_bootstate bs;
+  bootstate_fill(&bs);
+
+  FIL fd;
+  if (FR_OK == f_open(&fd, BOOTSTATE_FILEPATH, FA_WRITE | FA_OPEN_EXISTING)) {
+    UINT wrbytes;
+    FRESULT res = f_write(&fd, &bs, sizeof(bs), &wrbytes);
+    if (FR_OK == f_close(&fd) && FR_OK == res && wrbytes == sizeof(bs))
+      return true;
+  }
+
+  bst_valid = false;
+  return FR_OK == f_unlink(BOOTSTATE_FILEPATH);
+}
+
+bool bootstate_set_pending(unsigned flags) {
+  bst_pending |= flags;
+  return bootstate_write_header();
+}
+
+bool bootstate_clear_pending() {
+  if (!bst_pending)
+    return true;
+  bst_pending = 0;
+  return bootstate_write_header();
+}
+
+bool bootstate_save(unsigned count, const char *(*recent_entry)(unsigned i)) {
+  // Create the directory (just in case it doesn't exist
+  f_mkdir(SUPERFW_DIR);
+  // Make it hidden
+  f_chmod(SUPERFW_DIR, AM_HID, AM_HID);
+
+  bst_valid = false;
+  bst_recent = NULL;
+  bootstate_stamp(SETTINGS_FILEPATH, bst_stamps[BST_STAMP_SETTINGS]);
+  bootstate_stamp(UISETTINGS_FILEPATH, bst_stamps[BST_STAMP_UISETTINGS]);
+
+  FIL fd;
+  if (FR_OK != f_open(&fd, BOOTSTATE_FILEPATH, FA_WRITE | FA_CREATE_ALWAYS))
+    return false;
+
+  // Write the recent list first (after the header), in 512 byte chunks.
+  uint32_t crc = 0, size = 0;
+  unsigned coff = 0;
+  char tmpbuf[1024];
+  bool ok = FR_OK == f_lseek(&fd, BOOTSTATE_HDRSIZE);
+  for (unsigned i = 0; ok && i <= count; i++) {
+    if (i < count) {
+      const char *fn = recent_entry(i);
+      unsigned fnlen = strlen(fn);
+      memcpy(&tmpbuf[coff], fn, fnlen);
+      coff += fnlen;
+      tmpbuf[coff++] = '\n';
+    }
+
+    unsigned wrcnt = (i == count) ? coff : (coff >= 512) ? 512 : 0;
+    if (wrcnt) {
+      UINT wrbytes;
+      ok = (size + wrcnt <= BOOTSTATE_MAXSIZE - BOOTSTATE_HDRSIZE) &&
+           FR_OK == f_write(&fd, tmpbuf, wrcnt, &wrbytes) && wrbytes == wrcnt;
+      crc = crc32_update(crc, (uint8_t*)tmpbuf, wrcnt);
+      size += wrcnt;
+      memmove(&tmpbuf[0], &tmpbuf[wrcnt], coff - wrcnt);
+      coff -= wrcnt;
+    }
+  }
+
+  // Pad the file to a whole number of sectors.
+  if (ok && (size & 511)) {
+    UINT wrbytes;
+    unsigned padcnt = 512 - (size & 511);
+    memset(tmpbuf, 0, padcnt);
+    ok = FR_OK == f_write(&fd, tmpbuf, padcnt, &wrbytes) && wrbytes == padcnt;
+  }
+
+  // Header goes last, so that the blob is only valid once complete.
+  if (ok) {
+    t_bootstate bs;
+    bst_recent_size = size;
+    bst_recent_crc = crc;
+    bootstate_fill(&bs);
+
+    UINT wrbytes;
+    ok = FR_OK == f_lseek(&fd, 0) &&
+         FR_OK == f_write(&fd, &bs, sizeof(bs), &wrbytes) && wrbytes == sizeof(bs);
+  }
+
+  if (FR_OK != f_close(&fd) || !ok) {
+    f_unlink(BOOTSTATE_FILEPATH);
+    return false;
+  }
+
+  bst_valid = true;
+  return true;
+}
+
 void sram_template_filename_calc(const char *rom, const char * extension, char *savefn) {
   if (save_path_default == SaveRomName) {
     strcpy(savefn, rom);   // Use the full ROM path
@@ -304,11 +570,28 @@ static void parse_rom_settings(void *usr, const char *var, const char *value) {
   }
 }
 
+static void rom_settings_filename(const char *fn, char *cfgfn) {
+  strcpy(cfgfn, ROMCONFIG_PATH);
+  strcat(cfgfn, file_basename(fn));
+  replace_extension(cfgfn, ".config");
+}
+
+bool rom_settings_stamp(const char *fn, uint32_t *stamp) {
+  char cfgfn[512];
+  rom_settings_filename(fn, cfgfn);
+
+  FILINFO fi;
+  if (FR_OK != f_stat(cfgfn, &fi))
+    return false;
+
+  stamp[0] = fi.fsize;
+  stamp[1] = (fi.fdate << 16) | fi.ftime;
+  return true;
+}
+
 bool load_rom_settings(const char *fn, t_rom_settings *rs) {
   char buf[512];
-  strcpy(buf, ROMCONFIG_PATH);
-  strcat(buf, file_basename(fn));
-  replace_extension(buf, ".config");
+  rom_settings_filename(fn, buf);
 
   // Attempt to open and read the file.
   FIL fd;
@@ -333,9 +616,7 @@ bool save_rom_settings(const char *fn, const t_rom_settings *rs) {
   f_chmod(SUPERFW_DIR, AM_HID, AM_HID);
 
   char buf[512];
-  strcpy(buf, ROMCONFIG_PATH);
-  strcat(buf, file_basename(fn));
-  replace_extension(buf, ".config");
+  rom_settings_filename(fn, buf);
 
   // Proceed to create the file
   FIL fd;
@@ -67,9 +67,34 @@ bool save_ui_settings();
 bool save_settings();
 void load_settings();
 
+// Boot state blob: a binary snapshot of the settings, the recent ROM list
+// and any pending boot operations, so booting only needs to read one file.
+// The text files are still written and used when the blob is not valid (or
+// when they were modified after the blob was written).
+#define BOOTSTATE_MAXSIZE        (64*1024)
+#define BOOTSTATE_PEND_SAVE             1      // There might be a pending save to flush
+#define BOOTSTATE_PEND_SRAMTEST         2      // There might be a pending SRAM test
+
+// Loads the blob into buf (BOOTSTATE_MAXSIZE bytes, must stay untouched while
+// the recent list is used). Applies the settings on success. The blob size is
+// a multiple of the sector size, so the buffer can be in SDRAM (no byte
+// writes are performed by the FS).
+bool bootstate_load(void *buf);
+bool bootstate_valid();
+unsigned bootstate_pending();
+// Returns the recent ROM list (same format as the text file) or NULL
+const char *bootstate_recent(unsigned *size);
+// Writes the full blob, recent entries are provided by the callback.
+bool bootstate_save(unsigned count, const char *(*recent_entry)(unsigned i));
+// Updates the pending flags (and current settings), rewriting the blob header
+bool bootstate_set_pending(unsigned flags);
+bool bootstate_clear_pending();
+
 // ROM-specific setting load/store
 bool load_rom_settings(const char *fn, t_rom_settings *rs);
 bool save_rom_settings(const char *fn, const t_rom_settings *rs);
+// Size and date of the ROM config file (false if there's none).
+bool rom_settings_stamp(const char *fn, uint32_t *stamp);
 
 #endif
 
@@ -23,6 +23,7 @@
 
 #include "compiler.h"
 #include "sha256.h"
+#include "fatfs/ff.h"
 
 #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
   #define read32be(x) __builtin_bswap32(x)
@@ -59,8 +60,29 @@ void sha256_init(SHA256_State *state) {
   state->bytecnt = 0;
 }
 
+#ifdef __GBA__
+
+// Unrolled ARM implementation (see sha256_arm.S), requires aligned input.
+void sha256_blocks_arm(uint32_t *st, const void *data, unsigned nblocks);
+
+// Perform N steps (consuming 64 bytes of input each)
+static void sha256_transform_blocks(SHA256_State *state, const void *data, unsigned nblocks) {
+  if (!((uintptr_t)data & 3))
+    sha256_blocks_arm(state->st, data, nblocks);
+  else {
+    // Unaligned input, bounce it through an aligned buffer.
+    const uint8_t *ibuf = (uint8_t*)data;
+    for (unsigned i = 0; i < nblocks; i++, ibuf += 64) {
+      uint32_t tmp[64/4];
+      memcpy(tmp, ibuf, sizeof(tmp));
+      sha256_blocks_arm(state->st, tmp, 1);
+    }
+  }
+}
+
+#else
+
 // Perform a single step (consuming 64 bytes of input)
-ARM_CODE IWRAM_CODE NOINLINE
 static void sha256_transform_step(SHA256_State *state, const void *data) {
   uint32_t w[16];
   const uint32_t * dui = (uint32_t*)data;
@@ -102,6 +124,14 @@ static void sha256_transform_step(SHA256_State *state, const void *data) {
     state->st[i] += ls[i];
 }
 
+static void sha256_transform_blocks(SHA256_State *state, const void *data, unsigned nblocks) {
+  const uint8_t *ibuf = (uint8_t*)data;
+  for (unsigned i = 0; i < nblocks; i++, ibuf += 64)
+    sha256_transform_step(state, ibuf);
+}
+
+#endif
+
 ARM_CODE IWRAM_CODE NOINLINE
 void sha256_transform(SHA256_State *state, const void *data, unsigned length) {
   const uint8_t *ibuf = (uint8_t*)data;
@@ -116,7 +146,7 @@ void sha256_transform(SHA256_State *state, const void *data, unsigned length) {
       // Complete a 64 byte chunk and process it.
       unsigned tail = 64 - state->datasz;
       memcpy(&state->data[state->datasz], ibuf, tail);
-      sha256_transform_step(state, state->data);
+      sha256_transform_blocks(state, state->data, 1);
 
       ibuf += tail;
       length -= tail;
@@ -125,11 +155,13 @@ void sha256_transform(SHA256_State *state, const void *data, unsigned length) {
     }
   }
 
-  while (length >= 64) {
-    sha256_transform_step(state, ibuf);
-    state->bytecnt += 64;
-    ibuf += 64;
-    length -= 64;
+  if (length >= 64) {
+    // Process all the full blocks in one go.
+    unsigned nblocks = length / 64;
+    sha256_transform_blocks(state, ibuf, nblocks);
+    state->bytecnt += nblocks * 64;
+    ibuf += nblocks * 64;
+    length -= nblocks * 64;
   }
 
   if (length) {
@@ -145,7 +177,7 @@ void sha256_finalize(SHA256_State *state, uint8_t *hash) {
 
   // Need to feed an extra 9 bytes at the end with the total processed length.
   if (state->datasz >= 56) {
-    sha256_transform_step(state, state->data);
+    sha256_transform_blocks(state, state->data, 1);
     state->bytecnt += state->datasz;
     state->datasz = 0;
     // Clear the data block for the last block
@@ -162,7 +194,7 @@ void sha256_finalize(SHA256_State *state, uint8_t *hash) {
   state->data[61] = state->bytecnt >> 16;
   state->data[62] = state->bytecnt >>  8;
   state->data[63] = state->bytecnt >>  0;
-  sha256_transform_step(state, state->data);
+  sha256_transform_blocks(state, state->data, 1);
 
   // Extract 32 byte hash.
   for (unsigned i = 0; i < 8; i++) {
@@ -182,4 +214,30 @@ void sha256sum(const uint8_t *inbuffer, unsigned length, void *output) {
   sha256_finalize(&st, (uint8_t*)output);
 }
 
+// Reads data from a file, hashing it as it's read.
+FRESULT sha256_fread(SHA256_State *state, FIL *fd, void *buf, UINT btr, UINT *br) {
+  FRESULT res = f_read(fd, buf, btr, br);
+  if (res == FR_OK)
+    sha256_transform(state, buf, *br);
+  return res;
+}
+
+// Hashes the file contents, from its current position until the end.
+bool sha256_file(FIL *fd, uint8_t *hash) {
+  SHA256_State st;
+  sha256_init(&st);
+
+  while (true) {
+    UINT rdbytes;
+    uint32_t tmp[SHA256_FILE_CHUNK / 4];
+    if (FR_OK != sha256_fread(&st, fd, tmp, sizeof(tmp), &rdbytes))
+      return false;
+    if (!rdbytes)
+      break;
+  }
+
+  sha256_finalize(&st, hash);
+  return true;
+}
+
 
@@ -19,6 +19,11 @@
 // Minimal SHA256 implementation
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "fatfs/ff.h"
+
+#define SHA256_FILE_CHUNK    (4*1024)     // Read size for file hashing
 
 typedef struct {
   uint32_t st[8];      // Internal SHA state.
@@ -32,3 +37,8 @@ void sha256_transform(SHA256_State *state, const void *data, unsigned length);
 void sha256_finalize(SHA256_State *state, uint8_t *hash);
 
 void sha256sum(const uint8_t *inbuffer, unsigned length, void *output);
+
+// Streaming file hashing: f_read wrapper that hashes the data it reads, and
+// a helper that hashes a whole file (from the current position).
+FRESULT sha256_fread(SHA256_State *state, FIL *fd, void *buf, UINT btr, UINT *br);
+bool sha256_file(FIL *fd, uint8_t *hash);
@@ -21,10 +21,12 @@
 // https://www.davidgf.net/2011/07/05/usb_sd_reader/index.html
 
 #include <stdio.h>
+#include <string.h>
 
 #include "gbahw.h"
 #include "supercard_driver.h"
 #include "crc.h"
+#include "profiler.h"
 
 extern bool isgba;
 extern bool slowsd;
@@ -62,6 +64,80 @@ const static t_wrsec_fn sc_write_sectors[2] = {
   &sc_write_sectors_w0, &sc_write_sectors_w1
 };
 
+#ifdef SD_VERIFY_READS
+int sc_read_sectors_crc_w0(uint8_t *buffer, unsigned count);
+int sc_read_sectors_crc_w1(uint8_t *buffer, unsigned count);
+
+const static t_rdsec_fn sc_read_sectors_crc[2] = {
+  &sc_read_sectors_crc_w0, &sc_read_sectors_crc_w1
+};
+
+extern uint32_t use_slowsd;
+
+// Verified reads check the data CRC and step down to a slower speed level on
+// mismatch. The fastest level that works is picked after the card init, so
+// it is tuned per card (and per session).
+#define SD_RDLEVEL_FAST          0            // 0xA mirror, 2/1 waitstates
+#define SD_RDLEVEL_MEDIUM        1            // 0xA mirror, 3/1 waitstates
+#define SD_RDLEVEL_SLOW          2            // 0x8 mirror, 4/2 waitstates
+
+#define MAX_READ_RETRIES         2            // Retries at the slowest level
+#define SD_TUNE_BLOCKS           4            // Blocks read per tuning pass
+#define SD_TUNE_PASSES           8            // Passes required per level
+
+static unsigned sd_rdlevel = SD_RDLEVEL_SLOW;
+static unsigned sd_crc_errors;
+
+static void sd_set_rdlevel(unsigned level) {
+  sd_rdlevel = level;
+  // Only the 0xA mirror (WS1) timings are changed.
+  REG_WAITCNT = (REG_WAITCNT & ~0xE0) | (level == SD_RDLEVEL_MEDIUM ? 0xA0 : 0xC0);
+}
+
+static inline unsigned verified_mirror() {
+  #ifdef SUPERCARD_LITE_IO
+    return 0;
+  #else
+    return isgba && !use_slowsd && sd_rdlevel < SD_RDLEVEL_SLOW ? 1 : 0;
+  #endif
+}
+
+// Receives the blocks of an issued read, unaligned buffers are bounced.
+static int sd_receive_verified(uint8_t *buffer, unsigned blkcnt) {
+  t_rdsec_fn rdfn = sc_read_sectors_crc[verified_mirror()];
+  if (!((uintptr_t)buffer & 3))
+    return rdfn(buffer, blkcnt);
+
+  int ret = 0;
+  for (unsigned i = 0; i < blkcnt; i++) {
+    uint32_t tmp[512/4];
+    int r = rdfn((uint8_t*)tmp, 1);
+    if (r == 1)
+      return r;
+    ret |= r;
+    memcpy(&buffer[i * 512], tmp, 512);
+  }
+  return ret;
+}
+
+// Steps down to the next speed level, returns false if already the slowest.
+static bool sd_crc_fallback() {
+  sd_crc_errors++;
+  if (verified_mirror() == 0)
+    return false;
+  sd_set_rdlevel(sd_rdlevel + 1);
+  return true;
+}
+
+unsigned sdcard_read_level() {
+  return verified_mirror() ? sd_rdlevel : SD_RDLEVEL_SLOW;
+}
+
+unsigned sdcard_crc_errors() {
+  return sd_crc_errors;
+}
+#endif
+
 // Util functions (implemented in ASM)
 void send_empty_clocks(unsigned count);
 bool wait_sdcard_idle(unsigned timeout);
@@ -242,6 +318,32 @@ static bool send_sdcard_reset() {
 
 // Re-init the SD card. This just initializes the driver variables/state and
 // the card is assume to be init/ready.
+#ifdef SD_VERIFY_READS
+// Picks the fastest speed level that reads the first blocks without any CRC
+// error a few times in a row.
+static void sdcard_autotune() {
+  sd_crc_errors = 0;
+  #ifndef SUPERCARD_LITE_IO
+  if (isgba) {
+    for (unsigned lvl = SD_RDLEVEL_FAST; lvl < SD_RDLEVEL_SLOW; lvl++) {
+      sd_set_rdlevel(lvl);
+      bool ok = true;
+      for (unsigned i = 0; i < SD_TUNE_PASSES && ok; i++) {
+        uint32_t tmp[SD_TUNE_BLOCKS * 512 / 4];
+        uint8_t resp[4];
+        ok = send_sdcard_command_noclock(SD_CMD18, 0, resp, sizeof(resp)) &&
+             !sc_read_sectors_crc_w1((uint8_t*)tmp, SD_TUNE_BLOCKS);
+        ok = send_sdcard_command(SD_CMD12, 0, NULL, SD_MAX_RESP) && ok;
+      }
+      if (ok)
+        return;
+    }
+  }
+  #endif
+  sd_set_rdlevel(SD_RDLEVEL_SLOW);
+}
+#endif
+
 unsigned sdcard_reinit() {
   uint8_t resp[20];
 
@@ -393,13 +495,35 @@ unsigned sdcard_init(t_card_info *info) {
   if (!send_sdcard_command(SD_CMD16, 512, NULL, SD_MAX_RESP))
     return SD_ERR_BAD_BUSSEL;
 
+  #ifdef SD_VERIFY_READS
+  sdcard_autotune();
+  #endif
+
   return 0;
 }
 
 #endif
 
 unsigned sdcard_read_blocks(uint8_t *buffer, uint32_t blocknum, unsigned blkcnt) {
+  PROF_SCOPE(PROF_SDCARD_READ);
   uint8_t resp[4];
+  #ifdef SD_VERIFY_READS
+  // Verified read, on CRC errors retry (slower if possible).
+  for (unsigned j = 0; j < 1+MAX_READ_RETRIES; ) {
+    if (!send_sdcard_command_noclock(SD_CMD18, sc_issdhc() ? blocknum : blocknum * 512, resp, sizeof(resp)))
+      return SD_ERR_BADREAD;
+
+    int ret = sd_receive_verified(buffer, blkcnt);
+
+    if (!send_sdcard_command(SD_CMD12, 0, NULL, SD_MAX_RESP) || ret == 1)
+      return SD_ERR_BADREAD;
+    if (!ret)
+      return 0;
+    if (!sd_crc_fallback())
+      j++;       // Already at the slowest speed, just retry
+  }
+  return SD_ERR_BADCRC;
+  #else
   if (!send_sdcard_command_noclock(SD_CMD18, sc_issdhc() ? blocknum : blocknum * 512, resp, sizeof(resp)))
     return SD_ERR_BADREAD;
 
@@ -410,6 +534,39 @@ unsigned sdcard_read_blocks(uint8_t *buffer, uint32_t blocknum, unsigned blkcnt)
   if (!send_sdcard_command(SD_CMD12, 0, NULL, SD_MAX_RESP))
     return SD_ERR_BADREAD;
   return 0;
+  #endif
+}
+
+// Streaming reads: a multi-block read is opened at a given block and can be
+// continued (any number of blocks at a time) until closed. The host drives
+// the clock, so the card simply waits in between stream reads.
+unsigned sdcard_read_stream_open(uint32_t blocknum) {
+  uint8_t resp[4];
+  if (!send_sdcard_command_noclock(SD_CMD18, sc_issdhc() ? blocknum : blocknum * 512, resp, sizeof(resp)))
+    return SD_ERR_BADREAD;
+  return 0;
+}
+
+unsigned sdcard_read_stream(uint8_t *buffer, unsigned blkcnt) {
+  #ifdef SD_VERIFY_READS
+  // The stream cannot be rewound, the caller must reopen it to retry.
+  int ret = sd_receive_verified(buffer, blkcnt);
+  if (ret == 2) {
+    sd_crc_fallback();
+    return SD_ERR_BADCRC;
+  }
+  #else
+  int ret = sc_read_sectors[SC_FAST_ROM_MIRROR ? 1 : 0](buffer, blkcnt);
+  #endif
+  if (ret)
+    return SD_ERR_BADREAD;
+  return 0;
+}
+
+unsigned sdcard_read_stream_close() {
+  if (!send_sdcard_command(SD_CMD12, 0, NULL, SD_MAX_RESP))
+    return SD_ERR_BADREAD;
+  return 0;
 }
 
 unsigned sdcard_write_blocks(const uint8_t *buffer, uint32_t blocknum, unsigned blkcnt) {
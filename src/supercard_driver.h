@@ -48,6 +48,16 @@ uint16_t sc_rca();
 unsigned sdcard_read_blocks(uint8_t *buffer, uint32_t blocknum, unsigned blkcnt);
 unsigned sdcard_write_blocks(const uint8_t *buffer, uint32_t blocknum, unsigned blkcnt);
 
+// Multi-block read stream (kept open across reads until closed)
+unsigned sdcard_read_stream_open(uint32_t blocknum);
+unsigned sdcard_read_stream(uint8_t *buffer, unsigned blkcnt);
+unsigned sdcard_read_stream_close();
+
+// Verified reads (SD_VERIFY_READS): current speed level (0 is the fastest)
+// and number of CRC errors seen since the card init.
+unsigned sdcard_read_level();
+unsigned sdcard_crc_errors();
+
 #define SD_ERR_NO_STARTUP       1
 #define SD_ERR_BAD_IDENT        2
 #define SD_ERR_BAD_INIT         3
@@ -59,6 +69,7 @@ unsigned sdcard_write_blocks(const uint8_t *buffer, uint32_t blocknum, unsigned
 #define SD_ERR_BADWRITE         9
 #define SD_ERR_READTIMEOUT     10
 #define SD_ERR_WRITETIMEOUT    11
+#define SD_ERR_BADCRC          12
 
 #endif
 
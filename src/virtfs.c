@@ -17,35 +17,129 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include "common.h"
+#include "util.h"
+
+// Assets are stored (compressed) in SDRAM as a list of vf_header entries.
+// An index (hashed by name) is built on first use, and assets can be unpacked
+// into the asset cache (at ROM_OFF_ASSETCACHE) so that each one is only
+// unpacked once per boot. Assets that do not fit in the index are still found
+// by walking the list, but are never cached.
+
+#define VFS_INDEX_BITS           4
+#define VFS_INDEX_SIZE  (1 << VFS_INDEX_BITS)   // Hash table entries
 
 typedef struct {
   char fn[4];
-  uint32_t size;
+  uint32_t size;                 // Payload size (padded to 4 bytes in the list)
+  uint32_t unpacked_size;        // Size once unpacked
   uint8_t payload[];
 } vf_header;
 
-const void *get_vfile_ptr(const char *fname) {
+typedef struct {
+  uint32_t key;                  // Asset name as a word (zero if unused)
+  const vf_header *hdr;          // Asset header (compressed payload)
+  const void *unpacked;          // Unpacked copy in the cache (if any)
+  uint32_t unpacked_size;
+} t_vfs_entry;
+
+static t_vfs_entry vfs_index[VFS_INDEX_SIZE];
+static bool vfs_indexed = false;
+static bool vfs_overflow = false;  // Some assets did not fit in the index
+static uint32_t vfs_cache_used = 0;
+
+static inline uint32_t vfs_key(const char *fname) {
+  return ((uint8_t)fname[0]) | ((uint8_t)fname[1] << 8) |
+         ((uint8_t)fname[2] << 16) | ((uint32_t)(uint8_t)fname[3] << 24);
+}
+
+static inline unsigned vfs_hash(uint32_t key) {
+  return (key * 2654435761U) >> (32 - VFS_INDEX_BITS);
+}
+
+static inline const vf_header *vfs_next(const vf_header *ptr) {
+  return (vf_header*)&ptr->payload[ROUND_UP2(ptr->size, 4)];
+}
+
+static void vfs_build_index() {
+  memset(vfs_index, 0, sizeof(vfs_index));
   const vf_header *ptr = (vf_header*)ROM_ASSETS_U8;
-  while (ptr->size) {
-    if (!memcmp(ptr->fn, fname, sizeof(ptr->fn)))
-      return ptr->payload;
-    ptr = (vf_header*)&ptr->payload[ptr->size];
+  for (unsigned cnt = 0; ptr->size && cnt < VFS_INDEX_SIZE; cnt++) {
+    uint32_t key = vfs_key(ptr->fn);
+    unsigned h = vfs_hash(key);
+    while (vfs_index[h].key)
+      h = (h + 1) & (VFS_INDEX_SIZE - 1);
+    vfs_index[h].key = key;
+    vfs_index[h].hdr = ptr;
+    ptr = vfs_next(ptr);
   }
+  vfs_overflow = ptr->size != 0;
+  vfs_indexed = true;
+}
+
+static t_vfs_entry *vfs_lookup(const char *fname) {
+  if (!vfs_indexed)
+    vfs_build_index();
 
+  uint32_t key = vfs_key(fname);
+  unsigned h = vfs_hash(key);
+  for (unsigned i = 0; i < VFS_INDEX_SIZE && vfs_index[h].key; i++) {
+    if (vfs_index[h].key == key)
+      return &vfs_index[h];
+    h = (h + 1) & (VFS_INDEX_SIZE - 1);
+  }
   return NULL;
 }
 
-int get_vfile_size(const char *fname) {
+// Finds the asset header, walks the asset list if the asset is not indexed.
+static const vf_header *vfs_find(const char *fname) {
+  const t_vfs_entry *e = vfs_lookup(fname);
+  if (e)
+    return e->hdr;
+  if (!vfs_overflow)
+    return NULL;
+
   const vf_header *ptr = (vf_header*)ROM_ASSETS_U8;
   while (ptr->size) {
     if (!memcmp(ptr->fn, fname, sizeof(ptr->fn)))
-      return (int)ptr->size;
-    ptr = (vf_header*)&ptr->payload[ptr->size];
+      return ptr;
+    ptr = vfs_next(ptr);
+  }
+  return NULL;
+}
+
+const void *get_vfile_ptr(const char *fname) {
+  const vf_header *hdr = vfs_find(fname);
+  return hdr ? hdr->payload : NULL;
+}
+
+int get_vfile_size(const char *fname) {
+  const vf_header *hdr = vfs_find(fname);
+  return hdr ? (int)hdr->size : -1;
+}
+
+// Returns the unpacked asset, unpacking it into the cache if not there yet.
+// Returns NULL if the asset can't be cached (the caller can unpack it then).
+// Requires the SDRAM to be mapped (and writable).
+const void *get_vfile_unpacked(const char *fname, unsigned *size) {
+  t_vfs_entry *e = vfs_lookup(fname);
+  if (!e)
+    return NULL;
+
+  if (!e->unpacked) {
+    if (ROUND_UP2(e->hdr->unpacked_size, 4) > ASSETCACHE_SIZE - vfs_cache_used)
+      return NULL;     // No space left for this asset.
+
+    uint8_t *dst = (uint8_t*)&ROM_ASSETCACHE_U8[vfs_cache_used];
+    e->unpacked_size = apunpack16(e->hdr->payload, dst);
+    e->unpacked = dst;
+    vfs_cache_used += ROUND_UP2(e->unpacked_size, 4);
   }
 
-  return -1;
+  *size = e->unpacked_size;
+  return e->unpacked;
 }
 
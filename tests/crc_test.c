@@ -164,6 +164,13 @@ int main() {
     0x21,0xd4,0xf8,0x07,0x56,0xcf,
   };
   assert(ds_crc16(tsthdr, sizeof(tsthdr)) == 0x544a);
+
+  // CRC32, in one go and in several steps
+  assert(crc32_update(0, (uint8_t*)"", 0) == 0);
+  assert(crc32_update(0, (uint8_t*)"123456789", 9) == 0xCBF43926);
+  assert(crc32_update(crc32_update(0, (uint8_t*)"1234", 4), (uint8_t*)"56789", 5) == 0xCBF43926);
+  assert(crc32_update(0, tsthdr, sizeof(tsthdr)) ==
+         crc32_update(crc32_update(0, tsthdr, 100), &tsthdr[100], sizeof(tsthdr) - 100));
 }
 
 
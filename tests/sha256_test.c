@@ -20,17 +20,62 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 
-#include <openssl/sha.h>
+// SHA256_KAT_ONLY runs the known answer tests only (ie. cross builds that
+// use the ARM kernel, see the sha256_arm_test target).
+#ifndef SHA256_KAT_ONLY
+  #include <openssl/sha.h>
+#endif
 
 #include "sha256.h"
 
+#include "fatfs/ff.h"
+
+// Fake file, reads return odd sized chunks to exercise the streaming path.
+static const uint8_t *ffile_data;
+static unsigned ffile_size, ffile_pos;
+FRESULT f_read (FIL* fp, void* buff, UINT btr, UINT* br) {
+  unsigned n = btr > 1000 ? btr - 777 : btr;
+  if (n > ffile_size - ffile_pos)
+    n = ffile_size - ffile_pos;
+  memcpy(buff, &ffile_data[ffile_pos], n);
+  ffile_pos += n;
+  *br = n;
+  return FR_OK;
+}
+
+#ifndef SHA256_KAT_ONLY
+static double elapsed_ms(const struct timespec *start) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (t.tv_sec - start->tv_sec) * 1000.0 + (t.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+#endif
+
 int main() {
   const struct {
     const char *data;
     const uint8_t len;
     const char *hash;
   } testvec[] = {
+    // FIPS 180 examples
+    {
+      "abc", 3,
+      "\xba\x78\x16\xbf\x8f\x01\xcf\xea\x41\x41\x40\xde\x5d\xae\x22\x23"
+      "\xb0\x03\x61\xa3\x96\x17\x7a\x9c\xb4\x10\xff\x61\xf2\x00\x15\xad",
+    },
+    {
+      "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56,
+      "\x24\x8d\x6a\x61\xd2\x06\x38\xb8\xe5\xc0\x26\x93\x0c\x3e\x60\x39"
+      "\xa3\x3c\xe4\x59\x64\xff\x21\x67\xf6\xec\xed\xd4\x19\xdb\x06\xc1",
+    },
+    {
+      "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmno"
+      "ijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu", 112,
+      "\xcf\x5b\x16\xa7\x78\xaf\x83\x80\x03\x6c\xe5\x9e\x7b\x04\x92\x37"
+      "\x0b\x24\x9b\x11\xe8\xf0\x7a\x51\xaf\xac\x45\x03\x7a\xfe\xe9\xd1",
+    },
     {
       "", 0,
       "\xe3\xb0\xc4\x42\x98\xfc\x1c\x14\x9a\xfb\xf4\xc8\x99\x6f\xb9\x24"
@@ -120,6 +165,26 @@ int main() {
     assert(!memcmp(h, testvec[i].hash, sizeof(h)));
   }
 
+  // FIPS 180 long message (a million 'a'), in one go and as a file.
+  static uint8_t million_a[1000000];
+  const uint8_t million_a_hash[] =
+    "\xcd\xc7\x6e\x5c\x99\x14\xfb\x92\x81\xa1\xc7\xe2\x84\xd7\x3e\x67"
+    "\xf1\x80\x9a\x48\xa4\x97\x20\x0e\x04\x6d\x39\xcc\xc7\x11\x2c\xd0";
+  memset(million_a, 'a', sizeof(million_a));
+  {
+    uint8_t h[32];
+    sha256sum(million_a, sizeof(million_a), h);
+    assert(!memcmp(h, million_a_hash, sizeof(h)));
+
+    FIL fd;
+    ffile_data = million_a;
+    ffile_size = sizeof(million_a);
+    ffile_pos = 0;
+    assert(sha256_file(&fd, h));
+    assert(!memcmp(h, million_a_hash, sizeof(h)));
+  }
+
+  #ifndef SHA256_KAT_ONLY
   // Try some random vectors:
   for (unsigned i = 0; i < 256*1024; i++) {
     uint8_t href[32], h[32];
@@ -132,6 +197,37 @@ int main() {
     sha256sum(tmp, size, h);
     assert(!memcmp(h, href, sizeof(h)));
   }
+
+  // Hash a big (ROM sized) buffer, in one go and as a file, and benchmark it.
+  const unsigned bigsize = 16*1024*1024 + 123;
+  uint8_t *big = malloc(bigsize);
+  for (unsigned i = 0; i < bigsize; i++)
+    big[i] = rand();
+
+  uint8_t href[32], h[32];
+  SHA256(big, bigsize, href);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  sha256sum(big, bigsize, h);
+  double ms = elapsed_ms(&start);
+  assert(!memcmp(h, href, sizeof(h)));
+  printf("sha256sum: %.1f MiB/s\n", bigsize / 1048576.0 / (ms / 1000.0));
+
+  FIL fd;
+  ffile_data = big;
+  ffile_size = bigsize;
+  ffile_pos = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  assert(sha256_file(&fd, h));
+  ms = elapsed_ms(&start);
+  assert(!memcmp(h, href, sizeof(h)));
+  printf("sha256_file: %.1f MiB/s\n", bigsize / 1048576.0 / (ms / 1000.0));
+
+  free(big);
+  #endif
+
+  return 0;
 }
 
 
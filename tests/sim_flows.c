@@ -0,0 +1,561 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+// Runs the firmware core flows on top of the SuperCard simulation, reporting
+// the I/O performed by every operation. Suitable for perf/valgrind runs:
+//   ./sim_flows.bin [-i sd.img] [-s size_mb] [-d patches.db] [-r reference.db] [-t trace.bin] [rom.gba ...]
+// Host ROMs are copied to the SD root (a synthetic one is used if none given).
+// The I/O trace of the whole run can be exported for tools/iotrace.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gbahw.h"
+#include "common.h"
+#include "settings.h"
+#include "save.h"
+#include "patchengine.h"
+#include "supercard_driver.h"
+#include "fatfs/ff.h"
+#include "emu.h"
+#include "util.h"
+#include "iotrace.h"
+#include "memtest.h"
+#include "sim_supercard.h"
+
+#define MAX_SIM_ROMS     32
+
+extern FATFS sdfs;
+extern t_card_info sd_info;
+
+bool generate_patches_progress(const char *fn, unsigned fs);
+
+static struct timespec op_start;
+
+static void op_begin() {
+  sim_stats_reset();
+  clock_gettime(CLOCK_MONOTONIC, &op_start);
+}
+
+static void op_end(const char *name, const char *arg, bool ok) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  double ms = (t.tv_sec - op_start.tv_sec) * 1000.0 + (t.tv_nsec - op_start.tv_nsec) / 1000000.0;
+
+  printf("%-9s %-24.24s %3s %9.2f %7u %8u %7u %8u %6u %7u\n",
+         name, arg ? arg : "", ok ? "ok" : "ERR", ms,
+         sim_stats.rd_cmds, sim_stats.rd_blocks, sim_stats.wr_cmds, sim_stats.wr_blocks,
+         sim_stats.seeks, sim_stats.mode_switches);
+}
+
+static void noprogress(unsigned done, unsigned total) {}
+
+static bool import_file(const char *hostfn, const char *fn) {
+  FILE *fd = fopen(hostfn, "rb");
+  if (!fd)
+    return false;
+
+  FIL fo;
+  if (FR_OK != f_open(&fo, fn, FA_WRITE | FA_CREATE_ALWAYS)) {
+    fclose(fd);
+    return false;
+  }
+
+  bool ok = true;
+  static uint8_t tmp[64*1024];
+  size_t rd;
+  while (ok && (rd = fread(tmp, 1, sizeof(tmp), fd)) > 0) {
+    UINT wrbytes;
+    ok = FR_OK == f_write(&fo, tmp, rd, &wrbytes) && wrbytes == rd;
+  }
+  fclose(fd);
+  return f_close(&fo) == FR_OK && ok;
+}
+
+// Copies a file from the SD image to the host.
+static bool export_file(const char *fn, const char *hostfn) {
+  FIL fi;
+  if (FR_OK != f_open(&fi, fn, FA_READ))
+    return false;
+
+  FILE *fd = fopen(hostfn, "wb");
+  if (!fd) {
+    f_close(&fi);
+    return false;
+  }
+
+  bool ok = true;
+  static uint8_t tmp[64*1024];
+  UINT rdbytes;
+  while (ok && FR_OK == f_read(&fi, tmp, sizeof(tmp), &rdbytes) && rdbytes)
+    ok = fwrite(tmp, 1, rdbytes, fd) == rdbytes;
+  f_close(&fi);
+  return !fclose(fd) && ok;
+}
+
+// Writes a 4MiB ROM with a valid header and an SRAM save signature.
+static bool synth_rom(const char *fn) {
+  FIL fo;
+  if (FR_OK != f_open(&fo, fn, FA_WRITE | FA_CREATE_ALWAYS))
+    return false;
+
+  static uint32_t tmp[16*1024];
+  bool ok = true;
+  uint32_t seed = 0x12345678;
+  for (unsigned off = 0; ok && off < 4*1024*1024; off += sizeof(tmp)) {
+    for (unsigned i = 0; i < sizeof(tmp)/4; i++) {
+      seed = seed * 1103515245 + 12345;
+      tmp[i] = seed;
+    }
+    if (!off) {
+      t_rom_header *h = (t_rom_header*)tmp;
+      memset(h, 0, sizeof(*h));
+      h->start_branch = 0xEA00002E;
+      memcpy(h->gtitle, "SIMULATION  ", 12);
+      memcpy(h->gcode, "SIMT", 4);
+      memcpy(h->gmkcode, "01", 2);
+      h->fixed = 0x96;
+      uint8_t chk = 0x19;
+      for (unsigned i = 0xA0; i < 0xBD; i++)
+        chk += ((uint8_t*)h)[i];
+      h->checksum = -chk;
+    }
+    if (off == 1024*1024)
+      memcpy(tmp, "SRAM_V113", 9);
+
+    UINT wrbytes;
+    ok = FR_OK == f_write(&fo, tmp, sizeof(tmp), &wrbytes) && wrbytes == sizeof(tmp);
+  }
+  return f_close(&fo) == FR_OK && ok;
+}
+
+// Writes a file filled with pseudo-random data (deterministic given the seed).
+static void synth_fill(uint8_t *buf, unsigned size, uint32_t seed) {
+  for (unsigned i = 0; i < size; i++) {
+    seed = seed * 1103515245 + 12345;
+    buf[i] = seed >> 24;
+  }
+}
+
+static bool synth_file(const char *fn, unsigned size, uint32_t seed) {
+  uint8_t *tmp = malloc(size);
+  synth_fill(tmp, size, seed);
+  create_basepath(fn);
+
+  FIL fo;
+  UINT wrbytes;
+  bool ok = FR_OK == f_open(&fo, fn, FA_WRITE | FA_CREATE_ALWAYS);
+  ok = ok && FR_OK == f_write(&fo, tmp, size, &wrbytes) && wrbytes == size;
+  ok = ok && FR_OK == f_close(&fo);
+  free(tmp);
+  return ok;
+}
+
+// Mimics the boot sequence: flush any pending SRAM and load settings.
+static void sim_boot() {
+  op_begin();
+  bool ok = true;
+  bool bstvalid = bootstate_load((void*)ROM_SCRATCH_U8);
+  unsigned pending = bstvalid ? bootstate_pending() : ~0U;
+  if ((pending & BOOTSTATE_PEND_SAVE) && FR_OK == f_stat(PENDING_SAVE_FILEPATH, NULL)) {
+    ok = flush_pending_sram() != ERR_SAVE_FLUSH_WRITEFAIL;
+    f_unlink(PENDING_SAVE_FILEPATH);
+  }
+  if (pending & BOOTSTATE_PEND_SRAMTEST)
+    check_peding_sram_test();
+  bootstate_clear_pending();
+  if (!bstvalid)
+    load_settings();
+  patchmem_dbinfo((uint8_t*)ROM_PATCHDB_U8, &pdbinfo.patch_count, pdbinfo.version, pdbinfo.date, pdbinfo.creator);
+  op_end("boot", NULL, ok);
+}
+
+// Hand edits to the settings text file must take precedence over the blob.
+static void sim_settings_edit() {
+  op_begin();
+  FIL fd;
+  UINT wrbytes;
+  const char *cfg = "enable_cheats=1\n";
+  bool ok = save_settings() && bootstate_save(0, NULL) &&
+            bootstate_load((void*)ROM_SCRATCH_U8) && !enable_cheats &&
+            FR_OK == f_open(&fd, SETTINGS_FILEPATH, FA_WRITE | FA_CREATE_ALWAYS);
+  if (ok) {
+    ok = FR_OK == f_write(&fd, cfg, strlen(cfg), &wrbytes);
+    ok = FR_OK == f_close(&fd) && ok;
+  }
+  ok = ok && !bootstate_load((void*)ROM_SCRATCH_U8);
+  load_settings();
+  op_end("setedit", SETTINGS_FILEPATH, ok && enable_cheats);
+}
+
+static void sim_browse(unsigned entries) {
+  op_begin();
+  menu_init(-1);
+  menu_render(1);
+  menu_flip();
+  for (unsigned i = 0; i < entries + 1; i++) {
+    menu_keypress(KEY_BUTTDOWN);
+    menu_render(1);
+    menu_idle();
+    menu_flip();
+  }
+  op_end("browse", "/", true);
+}
+
+static void sim_game(const char *fn, uint32_t fs) {
+  op_begin();
+  op_end("patchgen", fn, generate_patches_progress(fn, fs));
+
+  op_begin();
+  t_rom_header romh;
+  t_patch ptch;
+  char savefn[MAX_FN_LEN];
+  bool ok = !preload_gba_rom(fn, fs, &romh);
+  bool has_patches = ok && load_cached_patches(fn, &ptch);
+  sram_filename_calc(fn, savefn);
+  EnumSavetype stype = has_patches ? ptch.save_mode : SaveTypeSRAM;
+  t_sram_load_policy loadp = FR_OK == f_stat(savefn, NULL) ? SaveLoadSav : SaveLoadReset;
+  ok = ok && !prepare_savegame(loadp, SaveReboot, stype, NULL, savefn);
+  if (ok && !setjmp(sim_launch_jmp))
+    ok = !load_gba_rom(fn, fs, &romh, has_patches ? &ptch : NULL, NULL, false, NULL, 0, noprogress);
+  op_end("load", fn, ok);
+
+  // Let the game write to the SRAM, so that it gets flushed on reboot.
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+  for (unsigned i = 0; i < 32*1024; i++)
+    ((volatile uint8_t*)0x0E000000)[i] = i ^ fs;
+
+  sim_boot();
+}
+
+// Loads a ROM with a synthetic patch set (unsorted ops, some straddling load
+// chunks or past the ROM end) and checks that patching it during the load
+// matches patching it afterwards.
+static void sim_patchload(const char *fn, uint32_t fs) {
+  t_patch ptch = {
+    .wcnt_ops = 9, .save_ops = 2, .irqh_ops = 0, .rtc_ops = 1,
+    .save_mode = SaveTypeFlash512K,
+    .op = {
+      0x20040000,                              // ARM nop, chunk start
+      0x00000000 | 0x3FFFC,                    // Program, straddles 256K
+      0x10000100,                              // Thumb nop
+      0x3C000000 | 0x01001, 0xA1B2C3D4, 0x0055E6F7,   // 7 bytes, unaligned
+      0x44000000 | 0x02002, 0x11111111, 0x22222222, 0x33333333,
+      0x58000000 | 0x80000,                    // ARM dummy function
+      0x20000000 | (fs + 16),                  // Past the ROM end
+      0x3000000F | 0x7FFF0,                    // Single byte
+      0x20000000 | 0x000C0,                    // Header area
+      0x80000000 | 0x90000,                    // EEPROM read handler
+      0x96000000 | 0xA0000,                    // FLASH write sector handler
+      0x70000000 | 0xC0000,                    // RTC probe
+    },
+    .prgs = {{ 10, { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 } }},
+  };
+  t_rtc_state rtc = { .year = 24, .month = 5, .day = 17, .hour = 12, .mins = 34 };
+  const unsigned chksize = fs + 1024;
+  uint8_t *fused = malloc(chksize);
+  const uint8_t *rom = (uint8_t*)GBA_ROM_BASE;
+
+  op_begin();
+  t_rom_header romh;
+  bool ok = !preload_gba_rom(fn, fs, &romh);
+  if (ok && !setjmp(sim_launch_jmp))
+    ok = !load_gba_rom(fn, fs, &romh, &ptch, NULL, false, &rtc, 0, noprogress);
+  set_supercard_mode(MAPPED_SDRAM, true, false);
+  memcpy(fused, rom, chksize);
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+
+  if (ok && !setjmp(sim_launch_jmp))
+    ok = !load_gba_rom(fn, fs, &romh, NULL, NULL, false, NULL, 0, noprogress);
+  set_supercard_mode(MAPPED_SDRAM, true, false);
+  patch_apply_rom(&ptch, &rtc, 0, 0);
+  ok = ok && !memcmp(fused, rom, chksize);
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+  free(fused);
+  op_end("patchload", fn, ok);
+}
+
+static bool noabort(unsigned done, unsigned total) {
+  return false;
+}
+
+// Runs the SDRAM self-test, which must pass and leave the SDRAM untouched.
+static void sim_sdramtest() {
+  uint8_t *snap = malloc(MAX_GBA_ROM_SIZE);
+  t_sdram_report rep;
+
+  op_begin();
+  set_supercard_mode(MAPPED_SDRAM, true, false);
+  memcpy(snap, (void*)GBA_ROM_BASE, MAX_GBA_ROM_SIZE);
+  bool ok = sdram_test(noabort, &rep) == SDRAM_TEST_OK;
+  ok = ok && !memcmp(snap, (void*)GBA_ROM_BASE, MAX_GBA_ROM_SIZE);
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+  free(snap);
+  op_end("sdramtest", NULL, ok);
+}
+
+// Launches an external emulator game, checks the emulator and ROM in SDRAM.
+static void sim_emugame(const t_emu_loader *ldinfo, const char *fn, unsigned emusize, unsigned fs) {
+  op_begin();
+  bool ok = true;
+  if (!setjmp(sim_launch_jmp))
+    ok = !load_extemu_rom(fn, fs, ldinfo, noprogress);
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+
+  uint8_t *exp = malloc(emusize + fs);
+  synth_fill(exp, emusize, emusize);
+  synth_fill(&exp[emusize], fs, fs);
+  uint32_t hdr[64];
+  unsigned hdrsize = ldinfo->hndlr ? ldinfo->hndlr((uint8_t*)hdr, fn, fs) : 0;
+  const uint8_t *rom = (uint8_t*)GBA_ROM_BASE;
+  ok = ok && !memcmp(rom, exp, emusize) && !memcmp(&rom[emusize + hdrsize], &exp[emusize], fs);
+  free(exp);
+  op_end("emuload", fn, ok);
+}
+
+// Sorts the ops of each section by address (stable), which is how v2 DBs
+// store them, so that lookups from different DB versions can be compared.
+static void patch_canon(t_patch *p) {
+  unsigned cnt[4] = { p->wcnt_ops, p->save_ops, p->irqh_ops, p->rtc_ops };
+  uint32_t *sec = p->op;
+  for (unsigned s = 0; s < 4; sec += cnt[s++]) {
+    uint32_t tmp[MAX_PATCH_OPS];
+    bool taken[MAX_PATCH_OPS] = {0};
+    unsigned n = 0;
+    while (n < cnt[s]) {
+      // Pick the op with the lowest address (first one on ties).
+      unsigned best = ~0U, bw = 0;
+      for (unsigned i = 0, w; i < cnt[s]; i += w) {
+        uint32_t opc = sec[i] >> 28, arg = (sec[i] >> 25) & 7;
+        w = opc == 0x3 ? 1 + (arg + 4) / 4 : opc == 0x4 ? arg + 2 : 1;
+        if (!taken[i] && (best == ~0U || (sec[i] & 0x1FFFFFF) < (sec[best] & 0x1FFFFFF))) {
+          best = i;
+          bw = w;
+        }
+      }
+      memcpy(&tmp[n], &sec[best], bw * sizeof(uint32_t));
+      taken[best] = true;
+      n += bw;
+    }
+    memcpy(sec, tmp, n * sizeof(uint32_t));
+  }
+}
+
+static uint8_t *read_host_file(const char *hostfn, size_t *size) {
+  FILE *fd = fopen(hostfn, "rb");
+  if (!fd)
+    return NULL;
+  uint8_t *buf = malloc(1024*1024);
+  *size = fread(buf, 1, 1024*1024, fd);
+  fclose(fd);
+  return buf;
+}
+
+// Looks up every game in the reference DB, the results must match.
+static bool check_patchdb(const uint8_t *ref, bool builtin) {
+  bool ok = true;
+  for (unsigned i = 0; ok && i < parse32le(&ref[8]); i++) {
+    t_patch p1, p2;
+    memset(&p1, 0, sizeof(p1));
+    memset(&p2, 0, sizeof(p2));
+    const uint8_t *gcode = &ref[1024 + i * 8];
+    if (builtin) {
+      set_supercard_mode(MAPPED_SDRAM, true, false);
+      ok = patchmem_lookup(gcode, (uint8_t*)ROM_PATCHDB_U8, &p1);
+      set_supercard_mode(MAPPED_SDRAM, true, true);
+    } else
+      ok = patchdb_lookup(gcode, &p1);
+    ok = ok && patchmem_lookup(gcode, ref, &p2);
+    patch_canon(&p1);
+    patch_canon(&p2);
+    ok = ok && !memcmp(&p1, &p2, sizeof(p1));
+  }
+  t_patch p;
+  return ok && !patchdb_lookup((uint8_t*)"\xFF\xFF\xFF\xFF\xFF", &p) &&
+         !patchdb_lookup((uint8_t*)"\0\0\0\0\0", &p);
+}
+
+// Checks the builtin DB, and then installs the DB as the user DB and checks
+// that every game in it is found through the SD lookup (with the builtin
+// DB hidden). Lookups are compared against the reference DB (if any).
+static void sim_usrpatchdb(const char *hostfn, const char *reffn) {
+  size_t dbsize, refsize;
+  uint8_t *db = read_host_file(hostfn, &dbsize);
+  uint8_t *ref = reffn ? read_host_file(reffn, &refsize) : db;
+  if (!db || !ref)
+    return;
+
+  op_begin();
+  op_end("pdblookup", hostfn, check_patchdb(ref, true));
+
+  op_begin();
+  op_end("import", USRPATCHDB_FILEPATH, import_file(hostfn, USRPATCHDB_FILEPATH));
+
+  op_begin();
+  set_supercard_mode(MAPPED_SDRAM, true, false);
+  volatile uint32_t *bsig = (uint32_t*)ROM_PATCHDB_U8;
+  uint32_t sig = *bsig;
+  *bsig = 0;
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+
+  uint32_t pcnt = 0;
+  bool ok = dbsize > 1024 && patchusr_init(USRPATCHDB_FILEPATH);
+  patchusr_dbinfo(&pcnt);
+  ok = ok && pcnt == parse32le(&db[8]) && check_patchdb(ref, false);
+  op_end("usrpdb", hostfn, ok);
+
+  // Third party DBs might not be sorted, swap the first and last games.
+  op_begin();
+  FIL fd;
+  UINT bcnt;
+  uint8_t ent[2][8];
+  const unsigned lastoff = 1024 + (pcnt - 1) * 8;
+  ok = pcnt > 1 && FR_OK == f_open(&fd, USRPATCHDB_FILEPATH, FA_READ | FA_WRITE);
+  if (ok) {
+    ok = FR_OK == f_lseek(&fd, 1024) && FR_OK == f_read(&fd, ent[0], 8, &bcnt) &&
+         FR_OK == f_lseek(&fd, lastoff) && FR_OK == f_read(&fd, ent[1], 8, &bcnt) &&
+         FR_OK == f_lseek(&fd, lastoff) && FR_OK == f_write(&fd, ent[0], 8, &bcnt) &&
+         FR_OK == f_lseek(&fd, 1024) && FR_OK == f_write(&fd, ent[1], 8, &bcnt);
+    ok = FR_OK == f_close(&fd) && ok;
+  }
+  ok = ok && patchusr_init(USRPATCHDB_FILEPATH) && check_patchdb(ref, false);
+
+  set_supercard_mode(MAPPED_SDRAM, true, false);
+  *bsig = sig;
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+  op_end("pdbunsort", hostfn, ok);
+
+  if (ref != db)
+    free(ref);
+  free(db);
+}
+
+int main(int argc, char **argv) {
+  const char *image = NULL, *patchdb = NULL, *refdb = NULL, *tracefn = NULL;
+  unsigned image_mb = 4096;
+  int opt;
+  while ((opt = getopt(argc, argv, "i:s:d:r:t:")) != -1) {
+    switch (opt) {
+    case 'i': image = optarg; break;
+    case 's': image_mb = atoi(optarg); break;
+    case 'd': patchdb = optarg; break;
+    case 'r': refdb = optarg; break;
+    case 't': tracefn = optarg; break;
+    default:
+      printf("Usage: %s [-i sd.img] [-s size_mb] [-d patches.db] [-r reference.db] [-t trace.bin] [rom.gba ...]\n", argv[0]);
+      return 1;
+    };
+  }
+
+  if (!sim_init(image, image_mb))
+    return 1;
+  if (patchdb && !sim_load_sdram(patchdb, ROM_OFF_PATCH_DB)) {
+    printf("Could not load %s\n", patchdb);
+    return 1;
+  }
+
+  set_supercard_mode(MAPPED_SDRAM, true, true);
+  sdcard_init(&sd_info);
+  if (f_mount(&sdfs, "0:", 1)) {
+    printf("Cannot mount the SD image\n");
+    return 1;
+  }
+  iotrace_init();
+
+  printf("%-9s %-24s %3s %9s %7s %8s %7s %8s %6s %7s\n",
+         "op", "file", "res", "host-ms", "rd-cmd", "rd-blk", "wr-cmd", "wr-blk", "seeks", "modesw");
+
+  for (int i = optind; i < argc; i++) {
+    const char *bn = strrchr(argv[i], '/');
+    char fn[MAX_FN_LEN] = "/";
+    strcat(fn, bn ? bn + 1 : argv[i]);
+    op_begin();
+    op_end("import", fn, import_file(argv[i], fn));
+  }
+  if (optind == argc && !image) {
+    op_begin();
+    op_end("import", "/sim_test.gba", synth_rom("/sim_test.gba"));
+  }
+
+  sim_boot();
+
+  // Collect the GBA ROMs found in the root directory.
+  unsigned nroms = 0, entries = 0;
+  static struct {
+    char fn[MAX_FN_LEN];
+    uint32_t fs;
+  } roms[MAX_SIM_ROMS];
+
+  DIR d;
+  FILINFO info;
+  if (FR_OK == f_opendir(&d, "/")) {
+    while (FR_OK == f_readdir(&d, &info) && info.fname[0]) {
+      entries++;
+      const char *ext = strrchr(info.fname, '.');
+      if (nroms < MAX_SIM_ROMS && ext && !strcasecmp(ext, ".gba")) {
+        strcpy(roms[nroms].fn, "/");
+        strcat(roms[nroms].fn, info.fname);
+        roms[nroms++].fs = info.fsize;
+      }
+    }
+    f_closedir(&d);
+  }
+
+  sim_browse(entries);
+
+  for (unsigned i = 0; i < nroms; i++)
+    sim_game(roms[i].fn, roms[i].fs);
+  if (nroms)
+    sim_patchload(roms[0].fn, roms[0].fs);
+
+  // External emulator games: the second launch uses the resident emulator.
+  const t_emu_loader *ldinfo = emu_platforms[0].loaders;
+  for (const t_emu_platform *p = emu_platforms; p->extension; p++)
+    if (!strcmp(p->extension, "nes"))
+      ldinfo = p->loaders;
+
+  char emufn[64];
+  strcpy(emufn, EMULATORS_PATH);
+  strcat(emufn, ldinfo->emu_name);
+  strcat(emufn, ".gba");
+  op_begin();
+  op_end("import", emufn, synth_file(emufn, 192*1024 + 12, 192*1024 + 12) &&
+                          synth_file("/sim_test.nes", 384*1024 + 100, 384*1024 + 100));
+  sim_emugame(ldinfo, "/sim_test.nes", 192*1024 + 12, 384*1024 + 100);
+  sim_emugame(ldinfo, "/sim_test.nes", 192*1024 + 12, 384*1024 + 100);
+
+  sim_sdramtest();
+
+  if (patchdb)
+    sim_usrpatchdb(patchdb, refdb);
+
+  // Regular boot, nothing pending.
+  sim_boot();
+  sim_settings_edit();
+
+  if (tracefn) {
+    op_begin();
+    op_end("iotrace", tracefn, iotrace_dump(IOTRACE_FILEPATH) && export_file(IOTRACE_FILEPATH, tracefn));
+  }
+
+  return 0;
+}
+
@@ -0,0 +1,361 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+// SuperCard simulation layer for the host build (see sim_supercard.h).
+// Replaces the SD driver, gbahw.c, main.c globals and the asm routines.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gbahw.h"
+#include "common.h"
+#include "ingame.h"
+#include "directsave.h"
+#include "memtest.h"
+#include "supercard_driver.h"
+#include "fatfs/ff.h"
+#include "sim_supercard.h"
+
+#define SRAM_BANK_SIZE      (64*1024)
+
+// Globals usually living in main.c
+FATFS sdfs;
+bool isgba = true;
+bool fastew = false;
+bool slowsd = true;
+uint32_t flash_deviceid;
+t_card_info sd_info;
+t_patchdb_info pdbinfo;
+volatile unsigned frame_count = 0;
+void *font_base_addr = (void*)ROM_FONTBASE_U8;
+
+t_sim_iostats sim_stats;
+jmp_buf sim_launch_jmp;
+
+// GBA address space regions, mapped at their real addresses.
+static const struct {
+  uintptr_t addr;
+  unsigned size;
+} gba_regions[] = {
+  { 0x02000000,  256*1024 },        // EWRAM
+  { 0x03000000,   32*1024 },        // IWRAM
+  { 0x04000000,   64*1024 },        // IO registers
+  { 0x05000000,   96*1024 },        // Palette (MEM_PALETTE_SIZE)
+  { 0x06000000,   96*1024 },        // VRAM
+  { 0x07000000,    4*1024 },        // OAM
+  { GBA_ROM_BASE, MAX_GBA_ROM_SIZE },  // SuperCard SDRAM
+  { 0x0E000000, SRAM_BANK_SIZE },   // SRAM (one bank mapped at a time)
+};
+
+static uint8_t *sdimg;              // SD card image
+static uint32_t sdimg_blocks;
+static uint32_t sd_next_block;      // Block following the last command
+static uint16_t sc_mode = 0x7;      // Current SuperCard mode bits
+static uint8_t sram_banks[2][SRAM_BANK_SIZE];
+
+// Creates an empty FAT32 filesystem (no partition table) on the image.
+static void sim_format_fat32(uint8_t *img, uint32_t nsect) {
+  const unsigned rsvd = 32, spc = 64;   // 32KiB clusters
+  uint32_t fatsz = (((nsect - rsvd) / spc + 2) * 4 + 511) / 512;
+
+  uint8_t *bs = img;
+  memcpy(bs, "\xEB\x58\x90" "SUPERFW ", 11);
+  bs[11] = 0x00; bs[12] = 0x02;       // 512 bytes per sector
+  bs[13] = spc;
+  bs[14] = rsvd; bs[15] = 0;
+  bs[16] = 2;                         // Two FATs
+  bs[21] = 0xF8;                      // Fixed media
+  bs[24] = 63; bs[26] = 255;          // Fake CHS geometry
+  memcpy(&bs[32], &nsect, 4);
+  memcpy(&bs[36], &fatsz, 4);
+  bs[44] = 2;                         // Root dir cluster
+  bs[48] = 1;                         // FSInfo sector
+  bs[50] = 6;                         // Backup boot sector
+  bs[64] = 0x80;
+  bs[66] = 0x29;
+  memcpy(&bs[67], "\x53\x49\x4D\x31" "NO NAME    " "FAT32   ", 4 + 11 + 8);
+  bs[510] = 0x55; bs[511] = 0xAA;
+  memcpy(&img[6 * 512], bs, 512);
+
+  uint8_t *fsi = &img[512];
+  memcpy(&fsi[0], "RRaA", 4);
+  memcpy(&fsi[484], "rrAa", 4);
+  memset(&fsi[488], 0xFF, 8);         // Unknown free count and next free
+  fsi[510] = 0x55; fsi[511] = 0xAA;
+
+  const uint32_t fatinit[3] = { 0x0FFFFFF8, 0x0FFFFFFF, 0x0FFFFFFF };
+  for (unsigned i = 0; i < 2; i++)
+    memcpy(&img[(rsvd + i * fatsz) * 512], fatinit, sizeof(fatinit));
+}
+
+bool sim_init(const char *image, unsigned image_mb) {
+  for (unsigned i = 0; i < sizeof(gba_regions)/sizeof(gba_regions[0]); i++) {
+    void *p = mmap((void*)gba_regions[i].addr, gba_regions[i].size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != (void*)gba_regions[i].addr) {
+      fprintf(stderr, "Cannot map GBA region at %08lx\n", (unsigned long)gba_regions[i].addr);
+      return false;
+    }
+  }
+  memset(sram_banks, 0xFF, sizeof(sram_banks));
+  memset((void*)0x0E000000, 0xFF, SRAM_BANK_SIZE);
+  REG_KEYINPUT = 0x3FF;               // No keys pressed
+
+  if (image) {
+    int fd = open(image, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) || st.st_size < 512) {
+      fprintf(stderr, "Cannot open SD image %s\n", image);
+      return false;
+    }
+    sdimg_blocks = st.st_size / 512;
+    sdimg = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+  } else {
+    sdimg_blocks = image_mb * 2048;
+    sdimg = mmap(NULL, (size_t)sdimg_blocks * 512, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (sdimg != MAP_FAILED)
+      sim_format_fat32(sdimg, sdimg_blocks);
+  }
+  return sdimg != MAP_FAILED;
+}
+
+bool sim_load_sdram(const char *fn, uint32_t offset) {
+  FILE *fd = fopen(fn, "rb");
+  if (!fd)
+    return false;
+  size_t rd = fread((uint8_t*)GBA_ROM_BASE + offset, 1, MAX_GBA_ROM_SIZE - offset, fd);
+  fclose(fd);
+  return rd > 0;
+}
+
+void sim_stats_reset() {
+  memset(&sim_stats, 0, sizeof(sim_stats));
+}
+
+// SuperCard driver replacement.
+
+void write_supercard_mode(uint16_t modebits) {
+  sim_stats.mode_switches++;
+
+  // Bit2 write-protects the SDRAM and selects the SRAM bank.
+  if ((modebits ^ sc_mode) & 0x4) {
+    unsigned curr = (sc_mode >> 2) & 1;
+    memcpy(sram_banks[curr], (void*)0x0E000000, SRAM_BANK_SIZE);
+    memcpy((void*)0x0E000000, sram_banks[curr ^ 1], SRAM_BANK_SIZE);
+    mprotect((void*)GBA_ROM_BASE, MAX_GBA_ROM_SIZE,
+             (modebits & 0x4) ? PROT_READ | PROT_WRITE : PROT_READ);
+    sim_stats.sram_bank_switches++;
+  }
+  sc_mode = modebits;
+}
+
+void set_supercard_mode(unsigned mapped_area, bool write_access, bool sdcard_interface) {
+  uint16_t value = mapped_area | (sdcard_interface ? 0x2 : 0x0) | (write_access ? 0x4 : 0x0);
+  write_supercard_mode(value);
+}
+
+unsigned sdcard_init(t_card_info *info) {
+  info->block_cnt = sdimg_blocks;
+  info->sdhc = true;
+  info->manufacturer = 0x53;
+  info->oemid = 0x494D;
+  return 0;
+}
+
+unsigned sdcard_reinit() {
+  return 0;
+}
+
+void sdcard_side_init(bool _issdhc, uint16_t _rca) {}
+
+bool sc_issdhc() {
+  return true;
+}
+
+uint16_t sc_rca() {
+  return 0x1234;
+}
+
+// The SD interface must be mapped for the real driver to work, fail otherwise.
+unsigned sdcard_read_blocks(uint8_t *buffer, uint32_t blocknum, unsigned blkcnt) {
+  if (!(sc_mode & 0x2))
+    return SD_ERR_READTIMEOUT;
+  if (blocknum >= sdimg_blocks || blkcnt > sdimg_blocks - blocknum)
+    return SD_ERR_BADREAD;
+
+  sim_stats.rd_cmds++;
+  sim_stats.rd_blocks += blkcnt;
+  if (!slowsd)
+    sim_stats.rd_fast_blocks += blkcnt;
+  if (blocknum != sd_next_block)
+    sim_stats.seeks++;
+  sd_next_block = blocknum + blkcnt;
+
+  memcpy(buffer, &sdimg[(size_t)blocknum * 512], blkcnt * 512);
+  return 0;
+}
+
+unsigned sdcard_write_blocks(const uint8_t *buffer, uint32_t blocknum, unsigned blkcnt) {
+  if (!(sc_mode & 0x2))
+    return SD_ERR_WRITETIMEOUT;
+  if (blocknum >= sdimg_blocks || blkcnt > sdimg_blocks - blocknum)
+    return SD_ERR_BADWRITE;
+
+  sim_stats.wr_cmds++;
+  sim_stats.wr_blocks += blkcnt;
+  if (blocknum != sd_next_block)
+    sim_stats.seeks++;
+  sd_next_block = blocknum + blkcnt;
+
+  memcpy(&sdimg[(size_t)blocknum * 512], buffer, blkcnt * 512);
+  return 0;
+}
+
+// gbahw.c replacement: DMA copies become plain copies.
+
+void dma_memset16(volatile void *ptr, uint16_t value, uint16_t count) {
+  volatile uint16_t *p = ptr;
+  for (unsigned i = 0; i < count; i++)
+    p[i] = value;
+}
+
+void dma_memcpy16(volatile void *dst, const void *src, uint16_t count) {
+  memcpy((void*)dst, src, count * 2);
+}
+
+void dma_memcpy32(volatile void *dst, const void *src, uint16_t count) {
+  memcpy((void*)dst, src, count * 4);
+}
+
+// memtest.S replacement: plain C march elements.
+
+void memtest_fill(uint32_t *ptr, uint32_t unused, uint32_t value, unsigned bytes) {
+  for (unsigned i = 0; i < bytes / 4; i++)
+    ptr[i] = value;
+}
+
+uint32_t *memtest_check(uint32_t *ptr, uint32_t expected, uint32_t unused, unsigned bytes) {
+  for (unsigned i = 0; i < bytes / 4; i++)
+    if (ptr[i] != expected)
+      return &ptr[i & ~7U];
+  return NULL;
+}
+
+uint32_t *memtest_rw_up(uint32_t *ptr, uint32_t expected, uint32_t value, unsigned bytes) {
+  for (unsigned i = 0; i < bytes / 4; i++) {
+    if (ptr[i] != expected)
+      return &ptr[i & ~7U];
+    ptr[i] = value;
+  }
+  return NULL;
+}
+
+uint32_t *memtest_rw_down(uint32_t *ptr, uint32_t expected, uint32_t value, unsigned bytes) {
+  for (unsigned i = bytes / 4; i > 0; i--) {
+    if (ptr[i - 1] != expected)
+      return &ptr[(i - 1) & ~7U];
+    ptr[i - 1] = value;
+  }
+  return NULL;
+}
+
+static uint64_t sim_start_ns;
+
+static uint64_t sim_host_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void timer_cycles_start() {
+  sim_start_ns = sim_host_ns();
+}
+
+uint32_t timer_cycles_read() {
+  // Emulate the 2^24 Hz cascaded timer using the host clock.
+  return ((sim_host_ns() - sim_start_ns) << 24) / 1000000000ULL;
+}
+
+// Assembly routines
+
+void launch_reset(bool via_bios, bool ewram_overclock) {
+  longjmp(sim_launch_jmp, 1);
+}
+
+void wait_ms(unsigned ms) {}
+
+void set_irq_enable(bool enable) {}
+
+unsigned apunpack16(const uint8_t *src, uint8_t *dst) {
+  return 0;    // Compressed emulator payloads are not available.
+}
+
+// Binary payloads, these only need to exist and be patchable.
+const t_igmenu ingame_menu_payload = {
+  .menu_rsize = 96*1024,
+};
+const uint32_t ingame_menu_payload_size = sizeof(ingame_menu_payload);
+
+const uint8_t directsave_payload[sizeof(t_dirsave_header)];
+const uint32_t directsave_payload_size = sizeof(directsave_payload);
+
+#define SIM_PATCH(name)                                     \
+  uint16_t name[8];                                         \
+  const uint32_t name##_size = sizeof(name);
+
+// Start/end delimited patches, the end label must follow the data.
+#define SIM_PATCH_END(name)                                 \
+  asm(".data\n.global " #name "\n" #name ": .space 16\n"    \
+      ".global " #name "_end\n" #name "_end:\n.text\n");
+
+SIM_PATCH_END(patch_rtc_probe)
+SIM_PATCH_END(patch_rtc_getstatus)
+SIM_PATCH_END(patch_rtc_gettimedate)
+SIM_PATCH_END(patch_rtc_reset)
+
+SIM_PATCH(patch_eeprom_read_sram64k)
+SIM_PATCH(patch_eeprom_write_sram64k)
+SIM_PATCH(patch_eeprom_read_directsave)
+SIM_PATCH(patch_eeprom_write_directsave)
+
+SIM_PATCH(patch_flash_read_sram64k)
+SIM_PATCH(patch_flash_write_sector_sram64k)
+SIM_PATCH(patch_flash_write_byte_sram64k)
+SIM_PATCH(patch_flash_erase_sector_sram64k)
+SIM_PATCH(patch_flash_erase_device_sram64k)
+
+SIM_PATCH(patch_flash_read_sram128k)
+SIM_PATCH(patch_flash_write_sector_sram128k)
+SIM_PATCH(patch_flash_write_byte_sram128k)
+SIM_PATCH(patch_flash_erase_sector_sram128k)
+SIM_PATCH(patch_flash_erase_device_sram128k)
+
+SIM_PATCH(patch_flash_read_directsave)
+SIM_PATCH(patch_flash_write_sector_directsave)
+SIM_PATCH(patch_flash_write_byte_directsave)
+SIM_PATCH(patch_flash_erase_sector_directsave)
+SIM_PATCH(patch_flash_erase_device_directsave)
+
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SIM_SUPERCARD_H_
+#define _SIM_SUPERCARD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <setjmp.h>
+
+// Host side simulation of a SuperCard, used to run the firmware core (menu,
+// loaders, save and patching code plus FatFs) natively on Linux.
+// The GBA memory regions are mapped at their real addresses, the SD card is
+// a RAM backed image and the SuperCard driver is replaced by a stub that
+// accounts every I/O operation.
+
+// I/O and mode switch counters, reset by sim_stats_reset()
+typedef struct {
+  uint32_t rd_cmds, rd_blocks;      // Read commands and blocks read
+  uint32_t rd_fast_blocks;          // Blocks read using the fast mirror
+  uint32_t wr_cmds, wr_blocks;      // Write commands and blocks written
+  uint32_t seeks;                   // Commands not following the previous one
+  uint32_t mode_switches;           // Calls to set_supercard_mode()
+  uint32_t sram_bank_switches;      // SRAM bank selector changes
+} t_sim_iostats;
+
+extern t_sim_iostats sim_stats;
+
+// launch_reset() jumps here, since the firmware does not return from it.
+extern jmp_buf sim_launch_jmp;
+
+// Maps the GBA memory and sets up the SD card. If image is NULL a sparse
+// FAT32 image of the given size is created, otherwise the image file is
+// mapped copy-on-write (the file itself is never modified).
+bool sim_init(const char *image, unsigned image_mb);
+
+// Loads a host file into the SDRAM (ie. a patch database or font pack).
+bool sim_load_sdram(const char *fn, uint32_t offset);
+
+void sim_stats_reset();
+
+#endif
+
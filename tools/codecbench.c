@@ -0,0 +1,381 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lz4enc.h"
+
+// Boot unpacking benchmark: decodes the compressed build artifacts using C
+// versions of the bootloader unpackers (upkr, aPLib/apultra and LZ4) and
+// reports an estimate of the ARM7TDMI cycles spent by the ARM routines.
+// Estimates are obtained by counting decoder events and using the costs
+// below (taken from the assembly loops: IWRAM code, input read from the
+// flash/ROM using the default waitstates and output written to EWRAM).
+
+#define GBA_CPU_FREQ       16777216
+
+typedef struct {
+  unsigned bits;          // Entropy/bit-stream decoded bits
+  unsigned inbytes;       // Input bytes read
+  unsigned literals;      // Literal bytes emitted
+  unsigned matches;       // Matches (backreferences)
+  unsigned matchbytes;    // Bytes copied from a match
+} t_stats;
+
+typedef struct {
+  unsigned bit, inbyte, literal, match, matchbyte;
+} t_costs;
+
+static const t_costs upkr_costs  = { 30, 11,  8, 10, 11 };
+static const t_costs aplib_costs = {  5,  6, 12, 20, 14 };
+static const t_costs lz4_costs   = {  0,  8, 13, 22, 11 };
+
+static uint64_t est_cycles(const t_stats *st, const t_costs *c) {
+  return (uint64_t)st->bits * c->bit + (uint64_t)st->inbytes * c->inbyte +
+         (uint64_t)st->literals * c->literal + (uint64_t)st->matches * c->match +
+         (uint64_t)st->matchbytes * c->matchbyte;
+}
+
+// upkr (default bitstream config), as in src/upkrunpack.S
+typedef struct {
+  const uint8_t *in;
+  uint32_t state;
+  uint8_t probs[384];
+  t_stats *st;
+} t_upkr;
+
+static unsigned upkr_bit(t_upkr *u, unsigned ctx) {
+  while (u->state < 4096) {
+    u->state = (u->state << 8) | *u->in++;
+    u->st->inbytes++;
+  }
+  u->st->bits++;
+
+  unsigned prob = u->probs[ctx];
+  unsigned bit = (u->state & 255) < prob;
+  if (bit) {
+    u->state = prob * (u->state >> 8) + (u->state & 255);
+    prob += (256 - prob + 8) >> 4;
+  } else {
+    u->state = (256 - prob) * (u->state >> 8) + (u->state & 255) - prob;
+    prob -= (prob + 8) >> 4;
+  }
+  u->probs[ctx] = prob;
+  return bit;
+}
+
+static unsigned upkr_length(t_upkr *u, unsigned ctx) {
+  unsigned length = 0, bitpos = 0;
+  while (upkr_bit(u, ctx)) {
+    length |= upkr_bit(u, ctx + 1) << bitpos++;
+    ctx += 2;
+  }
+  return length | (1 << bitpos);
+}
+
+static unsigned upkr_decode(const uint8_t *in, uint8_t *out, unsigned maxout, t_stats *st) {
+  t_upkr u = { .in = in, .state = 0, .st = st };
+  memset(u.probs, 128, sizeof(u.probs));
+
+  unsigned outp = 0, offset = 0;
+  bool prev_match = false;
+  while (1) {
+    if (upkr_bit(&u, 0)) {
+      if (prev_match || upkr_bit(&u, 256)) {
+        offset = upkr_length(&u, 257) - 1;
+        if (!offset)
+          break;
+      }
+      unsigned length = upkr_length(&u, 257 + 64);
+      if (offset > outp || outp + length > maxout)
+        return 0;
+      st->matches++;
+      st->matchbytes += length;
+      for (unsigned i = 0; i < length; i++, outp++)
+        out[outp] = out[outp - offset];
+      prev_match = true;
+    } else {
+      unsigned byte = 1;
+      while (byte < 256)
+        byte = (byte << 1) | upkr_bit(&u, byte);
+      if (outp >= maxout)
+        return 0;
+      out[outp++] = byte;
+      st->literals++;
+      prev_match = false;
+    }
+  }
+  return outp;
+}
+
+// aPLib (as generated by apultra), as in src/unpack.S
+typedef struct {
+  const uint8_t *in;
+  unsigned tag, bitcnt;
+  t_stats *st;
+} t_aplib;
+
+static unsigned ap_byte(t_aplib *a) {
+  a->st->inbytes++;
+  return *a->in++;
+}
+
+static unsigned ap_bit(t_aplib *a) {
+  if (!a->bitcnt--) {
+    a->tag = ap_byte(a);
+    a->bitcnt = 7;
+  }
+  a->st->bits++;
+  unsigned bit = (a->tag >> 7) & 1;
+  a->tag <<= 1;
+  return bit;
+}
+
+static unsigned ap_gamma(t_aplib *a) {
+  unsigned v = 1;
+  do {
+    v = (v << 1) + ap_bit(a);
+  } while (ap_bit(a));
+  return v;
+}
+
+static unsigned aplib_decode(const uint8_t *in, uint8_t *out, unsigned maxout, t_stats *st) {
+  t_aplib a = { .in = in, .bitcnt = 0, .st = st };
+  unsigned outp = 0, r0 = 0;
+  bool lwm = false;
+
+  out[outp++] = ap_byte(&a);
+  st->literals++;
+  while (1) {
+    unsigned offs, len;
+    if (!ap_bit(&a)) {
+      // Literal
+      if (outp >= maxout)
+        return 0;
+      out[outp++] = ap_byte(&a);
+      st->literals++;
+      lwm = false;
+      continue;
+    }
+    if (!ap_bit(&a)) {
+      // Gamma coded offset and length
+      offs = ap_gamma(&a);
+      if (!lwm && offs == 2) {
+        offs = r0;
+        len = ap_gamma(&a);
+      } else {
+        offs -= lwm ? 2 : 3;
+        offs = (offs << 8) + ap_byte(&a);
+        len = ap_gamma(&a);
+        if (offs >= 32000)
+          len++;
+        if (offs >= 1280)
+          len++;
+        if (offs < 128)
+          len += 2;
+        r0 = offs;
+      }
+      lwm = true;
+    }
+    else if (!ap_bit(&a)) {
+      // Short match (or end of stream)
+      offs = ap_byte(&a);
+      len = 2 + (offs & 1);
+      offs >>= 1;
+      if (!offs)
+        break;
+      r0 = offs;
+      lwm = true;
+    }
+    else {
+      // Single byte, near offset (or zero)
+      offs = 0;
+      for (unsigned i = 0; i < 4; i++)
+        offs = (offs << 1) + ap_bit(&a);
+      if (outp >= maxout || offs > outp)
+        return 0;
+      out[outp] = offs ? out[outp - offs] : 0;
+      outp++;
+      st->literals++;
+      lwm = false;
+      continue;
+    }
+
+    if (!offs || offs > outp || outp + len > maxout)
+      return 0;
+    st->matches++;
+    st->matchbytes += len;
+    for (unsigned i = 0; i < len; i++, outp++)
+      out[outp] = out[outp - offs];
+  }
+  return outp;
+}
+
+// LZ4 (with a size prefix), as in src/lz4unpack.S
+static unsigned lz4_decode(const uint8_t *in, uint8_t *out, unsigned maxout, t_stats *st) {
+  unsigned blksize = in[0] | (in[1] << 8) | (in[2] << 16) | (in[3] << 24);
+  const uint8_t *ip = &in[4], *iend = &in[4 + blksize];
+  unsigned outp = 0;
+
+  while (1) {
+    unsigned token = *ip++;
+    unsigned len = token >> 4;
+    if (len == 15) {
+      unsigned b;
+      do {
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+    }
+    if (outp + len > maxout)
+      return 0;
+    memcpy(&out[outp], ip, len);
+    ip += len;
+    outp += len;
+    st->literals += len;
+
+    if (ip >= iend)
+      break;
+
+    unsigned offs = ip[0] | (ip[1] << 8);
+    ip += 2;
+    len = token & 15;
+    if (len == 15) {
+      unsigned b;
+      do {
+        b = *ip++;
+        len += b;
+      } while (b == 255);
+    }
+    len += 4;
+    if (!offs || offs > outp || outp + len > maxout)
+      return 0;
+    st->matches++;
+    st->matchbytes += len;
+    for (unsigned i = 0; i < len; i++, outp++)
+      out[outp] = out[outp - offs];
+  }
+  st->inbytes = ip - in;
+  return outp;
+}
+
+static uint8_t *readfile(const char *fn, unsigned *fs) {
+  FILE *fd = fopen(fn, "rb");
+  if (!fd)
+    return NULL;
+  fseek(fd, 0, SEEK_END);
+  *fs = ftell(fd);
+  fseek(fd, 0, SEEK_SET);
+  uint8_t *buf = malloc(*fs + 64);    // Some padding for corrupted streams
+  memset(buf, 0, *fs + 64);
+  if (fread(buf, 1, *fs, fd) != *fs) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fd);
+  return buf;
+}
+
+static void report(const char *codec, unsigned csize, const uint8_t *raw, unsigned rawsize,
+                   const uint8_t *out, unsigned outsize, const t_stats *st, const t_costs *c) {
+  if (outsize != rawsize || memcmp(raw, out, rawsize)) {
+    printf("%-8s  %9u  decoded data mismatch!\n", codec, csize);
+    return;
+  }
+  uint64_t cycles = est_cycles(st, c);
+  printf("%-8s  %9u  %6.2f%%  %12llu  %8.1f  %7.2f\n", codec, csize,
+         csize * 100.0 / rawsize, (unsigned long long)cycles,
+         cycles * 1000.0 / GBA_CPU_FREQ, (double)cycles / rawsize);
+}
+
+int main(int argc, char **argv) {
+  const char *upkrfn = NULL, *aplibfn = NULL;
+  unsigned level = 9;
+  int opt;
+  while ((opt = getopt(argc, argv, "u:a:l:")) != -1) {
+    switch (opt) {
+    case 'u': upkrfn = optarg; break;
+    case 'a': aplibfn = optarg; break;
+    case 'l': level = atoi(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-u file.upkr] [-a file.apk] [-l lz4-level] rawfile\n", argv[0]);
+      return 1;
+    };
+  }
+  if (optind + 1 != argc) {
+    fprintf(stderr, "Usage: %s [-u file.upkr] [-a file.apk] [-l lz4-level] rawfile\n", argv[0]);
+    return 1;
+  }
+
+  unsigned rawsize;
+  uint8_t *raw = readfile(argv[optind], &rawsize);
+  if (!raw) {
+    fprintf(stderr, "Could not read %s\n", argv[optind]);
+    return 1;
+  }
+  uint8_t *out = malloc(rawsize + 1);
+
+  printf("%s (%u bytes), estimated ARM7TDMI unpacking cost:\n", argv[optind], rawsize);
+  printf("codec          size    ratio        cycles        ms   cyc/B\n");
+
+  if (upkrfn) {
+    unsigned csize;
+    uint8_t *comp = readfile(upkrfn, &csize);
+    if (!comp) {
+      fprintf(stderr, "Could not read %s\n", upkrfn);
+      return 1;
+    }
+    t_stats st = {0};
+    unsigned osize = upkr_decode(comp, out, rawsize, &st);
+    report("upkr", csize, raw, rawsize, out, osize, &st, &upkr_costs);
+    free(comp);
+  }
+
+  if (aplibfn) {
+    unsigned csize;
+    uint8_t *comp = readfile(aplibfn, &csize);
+    if (!comp) {
+      fprintf(stderr, "Could not read %s\n", aplibfn);
+      return 1;
+    }
+    t_stats st = {0};
+    unsigned osize = aplib_decode(comp, out, rawsize, &st);
+    report("apultra", csize, raw, rawsize, out, osize, &st, &aplib_costs);
+    free(comp);
+  }
+
+  // LZ4 is generated on the fly, since it's not part of the regular build.
+  uint8_t *comp = malloc(lz4enc_bound(rawsize));
+  unsigned csize = lz4enc_compress(raw, rawsize, comp, level);
+  t_stats st = {0};
+  unsigned osize = lz4_decode(comp, out, rawsize, &st);
+  report("lz4", csize, raw, rawsize, out, osize, &st, &lz4_costs);
+
+  // Plain copy, as a reference (ldm/stm from ROM to EWRAM)
+  printf("%-8s  %9u  %6.2f%%  %12llu  %8.1f  %7.2f\n", "copy", rawsize, 100.0,
+         (unsigned long long)rawsize * 2, rawsize * 2 * 1000.0 / GBA_CPU_FREQ, 2.0);
+
+  free(comp);
+  free(out);
+  free(raw);
+  return 0;
+}
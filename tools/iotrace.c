@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "iotrace.h"
+
+// I/O trace analyzer: loads a trace recorded by the firmware (IOTRACE=1
+// builds, or the host simulation) and reports the access pattern. The trace
+// is then replayed under a few caching/coalescing policies, estimating the
+// number of SD commands and the time they would take. Command and sector
+// costs are fitted from the trace timings (or given in the command line).
+// A disk image can be provided to classify accesses by FAT region.
+
+#define CACHE_WAYS      8
+
+typedef struct {
+  double rd_cmd, rd_sec;        // Read costs (us per command, per sector)
+  double wr_cmd, wr_sec;        // Write costs
+} t_costs;
+
+typedef struct {
+  const char *name;
+  unsigned coalesce;            // Merge requests that continue the previous one
+  unsigned cache_sectors;       // LRU sector cache size (0 disables it)
+  unsigned readahead;           // Single buffer read-ahead size (in sectors)
+} t_policy;
+
+typedef struct {
+  uint64_t rd_cmds, rd_secs;
+  uint64_t wr_cmds, wr_secs;
+} t_result;
+
+static const t_policy policies[] = {
+  { "none",                0,    0,  0 },
+  { "coalesce",            1,    0,  0 },
+  { "readahead-8",         0,    0,  8 },
+  { "readahead-8+coal",    1,    0,  8 },
+  { "cache-64",            0,   64,  0 },
+  { "cache-512",           0,  512,  0 },
+  { "cache-512+coal",      1,  512,  0 },
+};
+
+// Set associative LRU sector cache.
+typedef struct {
+  unsigned sets;
+  uint32_t *tags;               // sets * CACHE_WAYS entries (sector + 1, 0 is empty)
+  uint64_t *lastuse;
+  uint64_t clock;
+} t_cache;
+
+static void cache_init(t_cache *c, unsigned sectors) {
+  c->sets = sectors / CACHE_WAYS;
+  c->tags = calloc(sectors, sizeof(uint32_t));
+  c->lastuse = calloc(sectors, sizeof(uint64_t));
+  c->clock = 0;
+}
+
+static void cache_free(t_cache *c) {
+  free(c->tags);
+  free(c->lastuse);
+}
+
+static int cache_find(t_cache *c, uint32_t sector) {
+  unsigned base = (sector % c->sets) * CACHE_WAYS;
+  for (unsigned i = 0; i < CACHE_WAYS; i++)
+    if (c->tags[base + i] == sector + 1)
+      return base + i;
+  return -1;
+}
+
+static bool cache_lookup(t_cache *c, uint32_t sector) {
+  int e = cache_find(c, sector);
+  if (e >= 0)
+    c->lastuse[e] = ++c->clock;
+  return e >= 0;
+}
+
+static void cache_insert(t_cache *c, uint32_t sector) {
+  int e = cache_find(c, sector);
+  if (e < 0) {
+    unsigned base = (sector % c->sets) * CACHE_WAYS;
+    e = base;
+    for (unsigned i = 1; i < CACHE_WAYS; i++)
+      if (c->lastuse[base + i] < c->lastuse[e])
+        e = base + i;
+    c->tags[e] = sector + 1;
+  }
+  c->lastuse[e] = ++c->clock;
+}
+
+// Replays the trace using a given policy, counting device commands/sectors.
+static void replay(const t_iotrace_rec *recs, unsigned cnt, const t_policy *pol, t_result *res) {
+  t_cache cache;
+  if (pol->cache_sectors)
+    cache_init(&cache, pol->cache_sectors);
+  uint32_t ra_start = 0, ra_count = 0;       // Read-ahead buffer contents
+  int lastop = -1;                           // Last device access (to coalesce)
+  uint32_t lastend = 0;
+
+  memset(res, 0, sizeof(*res));
+  for (unsigned i = 0; i < cnt; i++) {
+    const t_iotrace_rec *r = &recs[i];
+    if (r->op == IOTRACE_OP_IOCTL)
+      continue;
+
+    // Split the request in runs of sectors that must hit the device.
+    uint32_t sector = r->sector, end = r->sector + r->count;
+    while (sector < end) {
+      uint32_t run = end - sector;
+      if (r->op == IOTRACE_OP_READ) {
+        if (pol->readahead && sector >= ra_start && sector < ra_start + ra_count) {
+          sector++;                                  // Served from the buffer
+          continue;
+        }
+        if (pol->cache_sectors && cache_lookup(&cache, sector)) {
+          sector++;
+          continue;
+        }
+        // Extend the run while the sectors miss.
+        if (pol->cache_sectors) {
+          run = 1;
+          while (sector + run < end && cache_find(&cache, sector + run) < 0)
+            run++;
+        }
+        uint32_t devcnt = run;
+        if (pol->readahead && r->count < pol->readahead) {
+          devcnt = pol->readahead;                   // Fill the buffer
+          ra_start = sector;
+          ra_count = devcnt;
+          run = devcnt < end - sector ? devcnt : end - sector;
+        }
+        if (!(pol->coalesce && lastop == IOTRACE_OP_READ && lastend == sector))
+          res->rd_cmds++;
+        res->rd_secs += devcnt;
+        if (pol->cache_sectors)
+          for (uint32_t j = 0; j < run; j++)
+            cache_insert(&cache, sector + j);
+        lastop = IOTRACE_OP_READ;
+        lastend = sector + devcnt;
+      } else {
+        // Write-through, keep cached copies up to date.
+        if (!(pol->coalesce && lastop == IOTRACE_OP_WRITE && lastend == sector))
+          res->wr_cmds++;
+        res->wr_secs += run;
+        if (pol->cache_sectors)
+          for (uint32_t j = 0; j < run; j++)
+            cache_insert(&cache, sector + j);
+        if (ra_count && sector < ra_start + ra_count && end > ra_start)
+          ra_count = 0;                              // Drop stale read-ahead
+        lastop = IOTRACE_OP_WRITE;
+        lastend = end;
+      }
+      sector += run;
+    }
+  }
+
+  if (pol->cache_sectors)
+    cache_free(&cache);
+}
+
+// Least squares fit of duration = cmd + sec * count for a given operation.
+static bool fit_costs(const t_iotrace_rec *recs, unsigned cnt, unsigned op, double freq,
+                      double *cmd, double *sec) {
+  double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (unsigned i = 0; i < cnt; i++) {
+    if (recs[i].op != op || (recs[i].arg & IOTRACE_ARG_ERROR))
+      continue;
+    double x = recs[i].count, y = recs[i].duration * 1000000.0 / freq;
+    n++; sx += x; sy += y; sxx += x * x; sxy += x * y;
+  }
+  double den = n * sxx - sx * sx;
+  if (n < 2 || den <= 0)
+    return false;
+  double b = (n * sxy - sx * sy) / den;
+  double a = (sy - b * sx) / n;
+  if (b <= 0 || a < 0)
+    return false;
+  *cmd = a;
+  *sec = b;
+  return true;
+}
+
+// FAT layout (for region classification), absolute sector numbers.
+typedef struct {
+  bool valid;
+  uint32_t part_start, fat_start, root_start, data_start, total;
+} t_fat_layout;
+
+static uint32_t rd32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint16_t rd16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static bool is_fat_vbr(const uint8_t *s) {
+  return s[510] == 0x55 && s[511] == 0xAA && (s[0] == 0xEB || s[0] == 0xE9) &&
+         rd16(&s[11]) == 512 && s[13] && rd16(&s[14]) && s[16];
+}
+
+static void parse_image(FILE *fd, t_fat_layout *l) {
+  uint8_t s[512];
+  memset(l, 0, sizeof(*l));
+  fseek(fd, 0, SEEK_END);
+  l->total = ftell(fd) / 512;
+  if (fseek(fd, 0, SEEK_SET) || fread(s, 1, 512, fd) != 512)
+    return;
+
+  if (!is_fat_vbr(s)) {
+    // Try the first MBR partition.
+    l->part_start = rd32(&s[446 + 8]);
+    if (fseek(fd, (long)l->part_start * 512, SEEK_SET) || fread(s, 1, 512, fd) != 512 || !is_fat_vbr(s))
+      return;
+  }
+
+  uint32_t fatsz = rd16(&s[22]) ? rd16(&s[22]) : rd32(&s[36]);
+  uint32_t rootsecs = (rd16(&s[17]) * 32 + 511) / 512;
+  l->fat_start = l->part_start + rd16(&s[14]);
+  l->root_start = l->fat_start + s[16] * fatsz;
+  l->data_start = l->root_start + rootsecs;
+  l->valid = true;
+}
+
+static const char * const region_names[] = { "reserved", "fat", "rootdir", "data", "out-of-range" };
+
+static unsigned classify(const t_fat_layout *l, uint32_t sector) {
+  if (sector >= l->total)
+    return 4;
+  if (sector < l->fat_start)
+    return 0;
+  if (sector < l->root_start)
+    return 1;
+  if (sector < l->data_start)
+    return 2;
+  return 3;
+}
+
+int main(int argc, char **argv) {
+  const char *image = NULL;
+  bool custom_costs = false;
+  t_costs costs = { 200, 170, 800, 250 };       // Rough SuperCard SD figures
+  int opt;
+  while ((opt = getopt(argc, argv, "i:c:")) != -1) {
+    switch (opt) {
+    case 'i': image = optarg; break;
+    case 'c':
+      if (sscanf(optarg, "%lf,%lf,%lf,%lf", &costs.rd_cmd, &costs.rd_sec, &costs.wr_cmd, &costs.wr_sec) != 4) {
+        fprintf(stderr, "Costs must be rdcmd,rdsec,wrcmd,wrsec (in us)\n");
+        return 1;
+      }
+      custom_costs = true;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-i sd.img] [-c rdcmd,rdsec,wrcmd,wrsec] trace.bin\n", argv[0]);
+      return 1;
+    };
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Usage: %s [-i sd.img] [-c rdcmd,rdsec,wrcmd,wrsec] trace.bin\n", argv[0]);
+    return 1;
+  }
+
+  FILE *fd = fopen(argv[optind], "rb");
+  if (!fd) {
+    fprintf(stderr, "Cannot open %s\n", argv[optind]);
+    return 1;
+  }
+  t_iotrace_hdr hdr;
+  if (fread(&hdr, 1, sizeof(hdr), fd) != sizeof(hdr) || hdr.magic != IOTRACE_MAGIC ||
+      hdr.version != IOTRACE_VERSION || hdr.recsize != sizeof(t_iotrace_rec) || !hdr.timer_freq) {
+    fprintf(stderr, "%s is not a valid I/O trace\n", argv[optind]);
+    return 1;
+  }
+  t_iotrace_rec *recs = malloc((hdr.count + 1) * sizeof(t_iotrace_rec));
+  unsigned cnt = fread(recs, sizeof(t_iotrace_rec), hdr.count, fd);
+  fclose(fd);
+  if (cnt != hdr.count)
+    fprintf(stderr, "Warning: truncated trace (%u out of %u records)\n", cnt, hdr.count);
+  if (hdr.dropped)
+    printf("Warning: %u records were lost (ring overflow), trace starts mid-run\n", hdr.dropped);
+
+  // Access pattern summary.
+  double freq = hdr.timer_freq;
+  uint64_t calls[3] = {0}, secs[3] = {0}, cycles[3] = {0};
+  unsigned errors = 0, sequential = 0, xfers = 0, ioctls[256] = {0};
+  unsigned hist[2][5] = {{0}};
+  static const char * const hist_names[] = { "1", "2-7", "8-63", "64-255", "256+" };
+  uint32_t lastend = ~0U;
+  for (unsigned i = 0; i < cnt; i++) {
+    const t_iotrace_rec *r = &recs[i];
+    if (r->op > IOTRACE_OP_IOCTL)
+      continue;
+    calls[r->op]++;
+    secs[r->op] += r->count;
+    cycles[r->op] += r->duration;
+    if (r->op == IOTRACE_OP_IOCTL) {
+      ioctls[r->arg & 0x7F]++;
+      continue;
+    }
+    if (r->arg & IOTRACE_ARG_ERROR)
+      errors++;
+    unsigned b = r->count < 2 ? 0 : r->count < 8 ? 1 : r->count < 64 ? 2 : r->count < 256 ? 3 : 4;
+    hist[r->op][b]++;
+    if (r->sector == lastend)
+      sequential++;
+    lastend = r->sector + r->count;
+    xfers++;
+  }
+
+  printf("Records: %u (%.3f s traced)\n", cnt,
+         cnt ? (recs[cnt - 1].timestamp - recs[0].timestamp) / freq : 0.0);
+  for (unsigned op = IOTRACE_OP_READ; op <= IOTRACE_OP_WRITE; op++)
+    printf("%-6s %8llu calls %10llu sectors %8.2f avg %10.2f ms\n",
+           op == IOTRACE_OP_READ ? "read" : "write",
+           (unsigned long long)calls[op], (unsigned long long)secs[op],
+           calls[op] ? (double)secs[op] / calls[op] : 0.0, cycles[op] * 1000.0 / freq);
+  printf("ioctl  %8llu calls", (unsigned long long)calls[IOTRACE_OP_IOCTL]);
+  for (unsigned i = 0; i < 128; i++)
+    if (ioctls[i])
+      printf(" [cmd %u: %u]", i, ioctls[i]);
+  printf("\nErrors: %u\n", errors);
+  printf("Sequential: %u of %u transfers (%.1f%%), %u seeks\n", sequential, xfers,
+         xfers ? sequential * 100.0 / xfers : 0.0, xfers - sequential);
+  printf("Size histogram (sectors):  ");
+  for (unsigned b = 0; b < 5; b++)
+    printf(" %7s", hist_names[b]);
+  printf("\n");
+  for (unsigned op = IOTRACE_OP_READ; op <= IOTRACE_OP_WRITE; op++) {
+    printf("  %-24s", op == IOTRACE_OP_READ ? "read" : "write");
+    for (unsigned b = 0; b < 5; b++)
+      printf(" %7u", hist[op][b]);
+    printf("\n");
+  }
+
+  // Region breakdown.
+  if (image) {
+    FILE *ifd = fopen(image, "rb");
+    t_fat_layout layout;
+    if (!ifd) {
+      fprintf(stderr, "Cannot open image %s\n", image);
+      return 1;
+    }
+    parse_image(ifd, &layout);
+    fclose(ifd);
+    if (!layout.valid)
+      printf("Image: no FAT filesystem found, skipping region breakdown\n");
+    else {
+      uint64_t regsecs[2][5] = {{0}};
+      for (unsigned i = 0; i < cnt; i++)
+        if (recs[i].op <= IOTRACE_OP_WRITE)
+          for (uint32_t j = 0; j < recs[i].count; j++)
+            regsecs[recs[i].op][classify(&layout, recs[i].sector + j)]++;
+      printf("Regions (sectors read/written):\n");
+      for (unsigned rg = 0; rg < 5; rg++)
+        printf("  %-13s %10llu %10llu\n", region_names[rg],
+               (unsigned long long)regsecs[0][rg], (unsigned long long)regsecs[1][rg]);
+    }
+  }
+
+  // Cost model: fit it from the trace unless provided.
+  if (!custom_costs) {
+    bool rdfit = fit_costs(recs, cnt, IOTRACE_OP_READ, freq, &costs.rd_cmd, &costs.rd_sec);
+    bool wrfit = fit_costs(recs, cnt, IOTRACE_OP_WRITE, freq, &costs.wr_cmd, &costs.wr_sec);
+    printf("Cost model (%s/%s): read %.1f us/cmd + %.1f us/sector, write %.1f us/cmd + %.1f us/sector\n",
+           rdfit ? "fitted" : "default", wrfit ? "fitted" : "default",
+           costs.rd_cmd, costs.rd_sec, costs.wr_cmd, costs.wr_sec);
+  }
+
+  printf("\n%-18s %9s %10s %9s %10s %11s\n", "policy", "rd-cmd", "rd-sec", "wr-cmd", "wr-sec", "model-ms");
+  for (unsigned i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+    t_result res;
+    replay(recs, cnt, &policies[i], &res);
+    double us = res.rd_cmds * costs.rd_cmd + res.rd_secs * costs.rd_sec +
+                res.wr_cmds * costs.wr_cmd + res.wr_secs * costs.wr_sec;
+    printf("%-18s %9llu %10llu %9llu %10llu %11.2f\n", policies[i].name,
+           (unsigned long long)res.rd_cmds, (unsigned long long)res.rd_secs,
+           (unsigned long long)res.wr_cmds, (unsigned long long)res.wr_secs, us / 1000.0);
+  }
+
+  free(recs);
+  return 0;
+}
+
@@ -0,0 +1,260 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# Copyright 2024 David Guillen Fandos <david@davidgf.net>
+# Profile guided IWRAM code placement.
+#
+# plan: reads a hot function profile and the firmware map file (of a previous
+#       build) and generates a linker script fragment (ldscripts/iwram_hot.ld)
+#       that moves the hottest functions into IWRAM, filling the free space.
+#       The C functions among them are listed in the fragment too (along with
+#       the files that define them), so that they are built as ARM code.
+# annotate: copies a C file, marking the planned functions it defines as ARM
+#       code. The Makefile builds these copies instead (see IWRAM_ARM_FILES),
+#       so the rest of the file stays Thumb.
+# report: compares the expected IWRAM usage (recorded in the fragment) against
+#       the actual usage found in the map file.
+#
+# The profile is a text file with one function per line, with self (not
+# inclusive) weights: first column is the weight, last one the function name,
+# as in "gprof -b -p" or "perf report --stdio". Unknown lines are ignored.
+# The firmware profiler dump is rejected: its entries are inclusive scopes
+# (mostly waiting on SD I/O), not functions.
+
+import sys, re, argparse
+
+IWRAM_SIZE = 32 * 1024
+IWRAM_RESERVED = 0x20 + 0x40 + 0xA0       # BIOS area, SVC and IRQ stacks
+STACK_USR_MIN = 0x4000                    # See ldscripts/gba_ewram.ld
+HOT_SECTION = ".iwram_hot"
+IWRAM_SECTIONS = [HOT_SECTION, ".bss", ".data", ".iwram"]
+FUNC_ALIGN_SLACK = 4                      # ARM functions are 4 byte aligned
+ARM_SIZE_FACTOR = 1.5                     # Thumb to ARM code size (estimate)
+
+def basename(symbol):
+  # Drops compiler generated suffixes (.lto_priv.0, .part.0, .isra.0...)
+  return symbol.split(".")[0]
+
+def parse_map(fn):
+  # Returns output section sizes and the .text.* input sections (per function)
+  # found in the given output sections.
+  outsecs, funcs = {}, {}
+  lines = open(fn).read().split("\n")
+  try:
+    lines = lines[lines.index("Linker script and memory map"):]
+  except ValueError:
+    pass
+
+  cursec, i = None, 0
+  while i < len(lines):
+    l = lines[i]
+    m = re.match(r"^(\.\S+)\s*(0x[0-9a-fA-F]+)?\s*(0x[0-9a-fA-F]+)?", l)
+    if m:
+      name, size = m.group(1), m.group(3)
+      if not m.group(2) and i + 1 < len(lines):
+        # Long names wrap (address and size are in the next line)
+        n = re.match(r"^\s+(0x[0-9a-fA-F]+)\s+(0x[0-9a-fA-F]+)", lines[i+1])
+        if n:
+          size = n.group(2)
+          i += 1
+      cursec = name
+      outsecs[name] = int(size, 16) if size else 0
+    else:
+      m = re.match(r"^ (\.text\.\S+)\s*(0x[0-9a-fA-F]+)?\s*(0x[0-9a-fA-F]+)?", l)
+      if m and cursec in (".text", HOT_SECTION):
+        size = m.group(3)
+        if not m.group(2) and i + 1 < len(lines):
+          n = re.match(r"^\s+(0x[0-9a-fA-F]+)\s+(0x[0-9a-fA-F]+)", lines[i+1])
+          if n:
+            size = n.group(2)
+            i += 1
+        if size:
+          fname = basename(m.group(1)[len(".text."):])
+          f = funcs.setdefault(fname, {"size": 0, "hot": False})
+          f["size"] += int(size, 16)
+          f["hot"] = f["hot"] or cursec == HOT_SECTION
+    i += 1
+
+  return outsecs, funcs
+
+def parse_profile(fn):
+  # Returns the weight and call count (if known) of each function.
+  prof = {}
+  for l in open(fn):
+    f = l.split()
+    if len(f) < 2:
+      continue
+    calls = "0"
+    # Firmware profiler dump: "name  N calls  M ms  K cycles/call"
+    if len(f) >= 5 and f[2] == "calls" and f[4] == "ms":
+      sys.stderr.write("%s is a firmware profiler dump (inclusive I/O scopes), "
+                       "use a flat profile instead\n" % fn)
+      sys.exit(1)
+    # gprof flat profile: "%time cumulative self calls self/call total/call name"
+    if len(f) == 7:
+      name, w, calls = f[-1], f[0], f[3]
+    else:
+      name, w = f[-1], f[0].rstrip("%")
+    try:
+      w, calls = float(w), int(calls)
+    except ValueError:
+      continue
+    if (w > 0 or calls > 0) and re.match(r"^[A-Za-z_][\w.]*$", name):
+      e = prof.setdefault(basename(name), [0.0, 0])
+      e[0] += w
+      e[1] += calls
+  return prof
+
+ARM_ATTR = "__attribute__((target(\"arm\"))) "
+
+def parse_fragment(fn):
+  # Returns the expected sizes, planned functions and ARM functions (file and
+  # function name) of a fragment.
+  expected, planned, armfuncs = None, [], []
+  try:
+    lines = open(fn).readlines()
+  except IOError:
+    lines = []
+  for l in lines:
+    m = re.match(r"^/\* budget (\d+) expected-hot (\d+) expected-iwram (\d+) \*/", l)
+    if m:
+      expected = (int(m.group(2)), int(m.group(3)))
+    m = re.match(r"^/\* arm-func (\S+) (\S+) \*/", l)
+    if m:
+      armfuncs.append((m.group(1), m.group(2)))
+    m = re.match(r"^\*\(\.text\.(\S+) ", l)
+    if m:
+      planned.append(m.group(1))
+  return expected, planned, armfuncs
+
+def find_definition(name, text):
+  # Returns the position of a function definition (start of its declaration).
+  m = re.search(r"^[A-Za-z_][^;{}()#=]*\b%s\s*\([^;{]*\)\s*\{" % re.escape(name), text, re.M)
+  return m.start() if m else None
+
+def find_sources(names, sources):
+  # Returns the C files that define each function (static functions might be
+  # defined in several of them).
+  defs = {}
+  for fn in sources:
+    text = open(fn, errors="replace").read()
+    for n in names:
+      if find_definition(n, text) is not None:
+        defs.setdefault(n, []).append(fn)
+  return defs
+
+def plan(args):
+  outsecs, funcs = parse_map(args.mapfile)
+  prof = parse_profile(args.profile)
+  curarm = set(n for _, n in parse_fragment(args.fragment)[2])
+
+  # Functions defined in C are built as ARM, sizes in the map are Thumb sizes
+  # unless they were already built as ARM.
+  defs = find_sources([n for n in prof if n in funcs], args.sources)
+  def size(n):
+    if n in defs and n not in curarm:
+      return int(funcs[n]["size"] * ARM_SIZE_FACTOR)
+    return funcs[n]["size"]
+
+  # Space used by everything else, the current hot code is replaced.
+  fixed = sum(outsecs.get(s, 0) for s in IWRAM_SECTIONS if s != HOT_SECTION)
+  budget = IWRAM_SIZE - IWRAM_RESERVED - STACK_USR_MIN - args.reserve - fixed
+
+  # Greedy fill, by weight per byte. Short profiles have many functions with
+  # no samples, the call count is used to break ties.
+  total = sum(w for w, _ in prof.values()) or 1
+  cands = [((prof[n][0] / size(n), prof[n][1] / size(n)), n)
+           for n in prof if n in funcs and funcs[n]["size"] > 0]
+  chosen, used = [], 0
+  for _, n in sorted(cands, reverse=True):
+    fsize = size(n) + FUNC_ALIGN_SLACK
+    if used + fsize <= budget:
+      chosen.append(n)
+      used += fsize
+  armfuncs = sorted(set((f, n) for n in chosen for f in defs.get(n, [])))
+
+  out = open(args.fragment, "w")
+  out.write("/* Generated by tools/iwramplan.py from %s, do not edit. */\n" % args.profile)
+  out.write("/* budget %d expected-hot %d expected-iwram %d */\n" % (budget, used, fixed + used))
+  for f, n in armfuncs:
+    out.write("/* arm-func %s %s */\n" % (f, n))
+  for n in chosen:
+    out.write("/* %s: %d bytes, %.2f%% */\n" % (n, size(n), 100.0 * prof[n][0] / total))
+    out.write("*(.text.%s .text.%s.*)\n" % (n, n))
+  out.close()
+
+  print("IWRAM plan: %d functions, %d of %d free bytes (%.2f%% of the profile), %d ARM functions" %
+        (len(chosen), used, budget, 100.0 * sum(prof[n][0] for n in chosen) / total,
+         len(set(n for _, n in armfuncs))))
+  return 0
+
+def annotate(args):
+  # Inserts the attribute in front of each planned definition. Line numbers
+  # are preserved, and #line keeps the original file name for diagnostics.
+  text = open(args.source, errors="replace").read()
+  names = [n for f, n in parse_fragment(args.fragment)[2] if f == args.source]
+  pos = []
+  for n in names:
+    p = find_definition(n, text)
+    if p is None:
+      sys.stderr.write("%s: %s not found, replan?\n" % (args.source, n))
+      return 1
+    pos.append(p)
+  for p in sorted(pos, reverse=True):
+    text = text[:p] + ARM_ATTR + text[p:]
+
+  out = open(args.output, "w")
+  out.write("#line 1 \"%s\"\n" % args.source)
+  out.write(text)
+  out.close()
+  return 0
+
+def report(args):
+  outsecs, funcs = parse_map(args.mapfile)
+  actual_hot = outsecs.get(HOT_SECTION, 0)
+  actual = sum(outsecs.get(s, 0) for s in IWRAM_SECTIONS)
+  stack = IWRAM_SIZE - IWRAM_RESERVED - actual
+
+  expected, planned, armfuncs = parse_fragment(args.fragment)
+
+  if expected:
+    print("IWRAM hot code: expected %d bytes, actual %d bytes" % (expected[0], actual_hot))
+    print("IWRAM usage: expected %d bytes, actual %d bytes (%d bytes of user stack)" %
+          (expected[1], actual, stack))
+  else:
+    print("IWRAM usage: %d bytes (%d bytes of user stack), no hot code plan" % (actual, stack))
+
+  if armfuncs:
+    print("IWRAM hot code built as ARM: " + ", ".join(sorted(set(n for _, n in armfuncs))))
+
+  # Functions that were inlined or renamed since the plan was made.
+  missing = [n for n in planned if not funcs.get(n, {}).get("hot")]
+  if missing:
+    print("IWRAM hot code not placed (replan?): " + ", ".join(missing))
+  return 0
+
+parser = argparse.ArgumentParser(description="Profile guided IWRAM code placement")
+sub = parser.add_subparsers(dest="cmd")
+p = sub.add_parser("plan")
+p.add_argument("mapfile")
+p.add_argument("profile")
+p.add_argument("fragment")
+p.add_argument("--reserve", type=int, default=0, help="IWRAM bytes to keep free")
+p.add_argument("--sources", nargs="*", default=[], help="C files, to build hot code as ARM")
+p = sub.add_parser("annotate")
+p.add_argument("fragment")
+p.add_argument("source")
+p.add_argument("output")
+p = sub.add_parser("report")
+p.add_argument("mapfile")
+p.add_argument("fragment")
+args = parser.parse_args()
+
+if args.cmd == "plan":
+  sys.exit(plan(args))
+elif args.cmd == "annotate":
+  sys.exit(annotate(args))
+elif args.cmd == "report":
+  sys.exit(report(args))
+parser.print_help()
+sys.exit(1)
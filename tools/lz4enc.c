@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz4enc.h"
+
+// Simple LZ4 block encoder, using hash chains to find matches. Follows the
+// LZ4 block format rules (last 5 bytes are literals, no match starts in the
+// last 12 bytes) so that any LZ4 decoder can be used.
+
+#define MIN_MATCH        4
+#define MAX_OFFSET   65535
+#define LAST_LITERALS    5
+#define MFLIMIT         12
+#define HASH_BITS       16
+
+static inline uint32_t hash4(const uint8_t *p) {
+  uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+  return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static uint8_t *emit_length(uint8_t *op, unsigned len) {
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+static uint8_t *emit_sequence(uint8_t *op, const uint8_t *lit, unsigned litlen,
+                              unsigned offset, unsigned mlen) {
+  uint8_t *token = op++;
+  *token = (litlen >= 15 ? 15 : litlen) << 4;
+  if (litlen >= 15)
+    op = emit_length(op, litlen - 15);
+  memcpy(op, lit, litlen);
+  op += litlen;
+
+  if (mlen) {
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    mlen -= MIN_MATCH;
+    *token |= mlen >= 15 ? 15 : mlen;
+    if (mlen >= 15)
+      op = emit_length(op, mlen - 15);
+  }
+  return op;
+}
+
+unsigned lz4enc_bound(unsigned size) {
+  return 4 + size + size / 255 + 16;
+}
+
+unsigned lz4enc_compress(const uint8_t *src, unsigned size, uint8_t *dst, unsigned level) {
+  unsigned depth = level <= 1 ? 1 : 1U << (level - 1);
+  int32_t *head = malloc(sizeof(int32_t) << HASH_BITS);
+  int32_t *chain = malloc(sizeof(int32_t) * (size ? size : 1));
+  for (unsigned i = 0; i < (1U << HASH_BITS); i++)
+    head[i] = -1;
+
+  uint8_t *op = &dst[4];
+  unsigned anchor = 0, ip = 0;
+  unsigned mflimit = size > MFLIMIT ? size - MFLIMIT : 0;
+  unsigned matchlimit = size > LAST_LITERALS ? size - LAST_LITERALS : 0;
+
+  #define INSERT_POS(p) {                  \
+    uint32_t h = hash4(&src[p]);           \
+    chain[p] = head[h];                    \
+    head[h] = p;                           \
+  }
+
+  while (ip < mflimit) {
+    // Walk the chain looking for the longest match.
+    unsigned bestlen = 0, bestoff = 0;
+    int32_t cand = head[hash4(&src[ip])];
+    for (unsigned d = 0; d < depth && cand >= 0 && ip - cand <= MAX_OFFSET; d++) {
+      unsigned l = 0;
+      while (ip + l < matchlimit && src[cand + l] == src[ip + l])
+        l++;
+      if (l > bestlen) {
+        bestlen = l;
+        bestoff = ip - cand;
+      }
+      cand = chain[cand];
+    }
+
+    if (bestlen < MIN_MATCH) {
+      INSERT_POS(ip);
+      ip++;
+      continue;
+    }
+
+    op = emit_sequence(op, &src[anchor], ip - anchor, bestoff, bestlen);
+    for (unsigned i = 0; i < bestlen; i++, ip++)
+      if (ip < mflimit)
+        INSERT_POS(ip);
+    anchor = ip;
+  }
+
+  // Last literals (might be empty)
+  op = emit_sequence(op, &src[anchor], size - anchor, 0, 0);
+
+  free(head);
+  free(chain);
+
+  unsigned blksize = op - &dst[4];
+  dst[0] = blksize;
+  dst[1] = blksize >> 8;
+  dst[2] = blksize >> 16;
+  dst[3] = blksize >> 24;
+  return blksize + 4;
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LZ4ENC_H_
+#define _LZ4ENC_H_
+
+#include <stdint.h>
+
+// Compresses a buffer into an LZ4 block, prefixed with the 32 bit (LE) block
+// size, which is the format lz4_unpack (src/lz4unpack.S) expects.
+// The output buffer must be at least lz4enc_bound(size) bytes.
+// The level sets the match finder search depth (1 to 9).
+unsigned lz4enc_bound(unsigned size);
+unsigned lz4enc_compress(const uint8_t *src, unsigned size, uint8_t *dst, unsigned level);
+
+#endif
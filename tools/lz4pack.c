@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lz4enc.h"
+
+// Compresses a file using the LZ4-based format used by the bootloader.
+
+int main(int argc, char **argv) {
+  unsigned level = 9;
+  int opt;
+  while ((opt = getopt(argc, argv, "l:")) != -1) {
+    switch (opt) {
+    case 'l': level = atoi(optarg); break;
+    default:
+      fprintf(stderr, "Usage: %s [-l level] input output\n", argv[0]);
+      return 1;
+    };
+  }
+  if (argc - optind != 2) {
+    fprintf(stderr, "Usage: %s [-l level] input output\n", argv[0]);
+    return 1;
+  }
+
+  FILE *fd = fopen(argv[optind], "rb");
+  if (!fd) {
+    fprintf(stderr, "Could not open %s\n", argv[optind]);
+    return 1;
+  }
+  fseek(fd, 0, SEEK_END);
+  long fs = ftell(fd);
+  fseek(fd, 0, SEEK_SET);
+  uint8_t *buf = malloc(fs + 1);
+  if (fread(buf, 1, fs, fd) != fs) {
+    fprintf(stderr, "Could not read %s\n", argv[optind]);
+    return 1;
+  }
+  fclose(fd);
+
+  uint8_t *out = malloc(lz4enc_bound(fs));
+  unsigned outsize = lz4enc_compress(buf, fs, out, level);
+
+  fd = fopen(argv[optind + 1], "wb");
+  if (!fd || fwrite(out, 1, outsize, fd) != outsize) {
+    fprintf(stderr, "Could not write %s\n", argv[optind + 1]);
+    return 1;
+  }
+  fclose(fd);
+
+  return 0;
+}
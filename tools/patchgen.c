@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "util.h"
+#include "patchengine.h"
+
+// Batch patch generator: walks a ROM directory and writes the patch cache
+// files (the ones generated on the device) into an SD card tree, using as
+// many threads as CPUs available.
+
+typedef struct {
+  char **roms;
+  unsigned count;
+  unsigned next;
+  const char *outdir;
+  bool overwrite;
+  unsigned generated, skipped, failed;
+  pthread_mutex_t lock;
+} t_jobs;
+
+static void add_rom(t_jobs *jobs, const char *fn) {
+  if (!(jobs->count & 255))
+    jobs->roms = realloc(jobs->roms, (jobs->count + 256) * sizeof(char*));
+  jobs->roms[jobs->count++] = strdup(fn);
+}
+
+// Recursively collects all .gba files (skipping hidden dirs like .superfw)
+static void scan_dir(t_jobs *jobs, const char *path) {
+  DIR *d = opendir(path);
+  if (!d)
+    return;
+
+  struct dirent *ent;
+  while ((ent = readdir(d))) {
+    if (ent->d_name[0] == '.')
+      continue;
+
+    char fn[4096];
+    snprintf(fn, sizeof(fn), "%s/%s", path, ent->d_name);
+    struct stat st;
+    if (stat(fn, &st))
+      continue;
+
+    const char *ext = strrchr(ent->d_name, '.');
+    if (S_ISDIR(st.st_mode))
+      scan_dir(jobs, fn);
+    else if (ext && !strcasecmp(ext, ".gba"))
+      add_rom(jobs, fn);
+  }
+  closedir(d);
+}
+
+static void noprogress(unsigned p) {}
+
+static bool generate_patch(const char *romfn, const char *patchfn) {
+  FILE *fd = fopen(romfn, "rb");
+  if (!fd)
+    return false;
+  fseek(fd, 0, SEEK_END);
+  long fs = ftell(fd);
+  fseek(fd, 0, SEEK_SET);
+  if (fs <= 0 || fs > MAX_GBA_ROM_SIZE) {
+    fclose(fd);
+    return false;
+  }
+
+  // The scanner might read a few words past the end, pad the buffer.
+  uint32_t *rom = calloc(1, fs + 64);
+  bool ok = fread(rom, 1, fs, fd) == fs;
+  fclose(fd);
+
+  if (ok) {
+    t_patch_builder pb;
+    patchengine_init(&pb, fs);
+    patchengine_process_rom(rom, fs, &pb, noprogress);
+    patchengine_finalize(&pb);
+
+    uint8_t buf[1024];
+    int psize = serialize_patch(&pb.p, buf);
+
+    // Write to a temp file first, so no partial patch files are left behind.
+    char tmpfn[4096];
+    snprintf(tmpfn, sizeof(tmpfn), "%s.tmp", patchfn);
+    FILE *fo = fopen(tmpfn, "wb");
+    ok = fo && fwrite(buf, 1, psize, fo) == psize;
+    if (fo)
+      ok = !fclose(fo) && ok;
+    ok = ok && !rename(tmpfn, patchfn);
+    if (!ok)
+      unlink(tmpfn);
+  }
+
+  free(rom);
+  return ok;
+}
+
+static void *worker(void *arg) {
+  t_jobs *jobs = (t_jobs*)arg;
+  while (1) {
+    pthread_mutex_lock(&jobs->lock);
+    unsigned n = jobs->next++;
+    pthread_mutex_unlock(&jobs->lock);
+    if (n >= jobs->count)
+      return NULL;
+
+    // Same naming as the device cache: ROM basename with .patch extension.
+    char name[MAX_FN_LEN];
+    strncpy(name, file_basename(jobs->roms[n]), sizeof(name) - 8);
+    name[sizeof(name) - 8] = 0;
+    replace_extension(name, ".patch");
+
+    char patchfn[4096];
+    snprintf(patchfn, sizeof(patchfn), "%s%s", jobs->outdir, name);
+
+    struct stat st;
+    bool skip = !jobs->overwrite && !stat(patchfn, &st);
+    bool ok = skip || generate_patch(jobs->roms[n], patchfn);
+
+    pthread_mutex_lock(&jobs->lock);
+    if (skip)
+      jobs->skipped++;
+    else if (ok)
+      jobs->generated++;
+    else {
+      jobs->failed++;
+      printf("Failed to generate patches for %s\n", jobs->roms[n]);
+    }
+    pthread_mutex_unlock(&jobs->lock);
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  bool overwrite = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:f")) != -1) {
+    switch (opt) {
+    case 'j': nthreads = atoi(optarg); break;
+    case 'f': overwrite = true; break;
+    default:
+      optind = argc;
+    };
+  }
+
+  if (optind >= argc || !nthreads) {
+    printf("Usage: %s [-j threads] [-f] romdir [sdroot]\n", argv[0]);
+    printf("  Writes patches to sdroot%s (sdroot defaults to romdir)\n", PATCHDB_PATH);
+    printf("  -f: regenerate existing patch files\n");
+    exit(1);
+  }
+
+  const char *romdir = argv[optind];
+  const char *sdroot = optind + 1 < argc ? argv[optind + 1] : romdir;
+
+  // Create the patch directory tree
+  char outdir[4096];
+  snprintf(outdir, sizeof(outdir), "%s%s", sdroot, SUPERFW_DIR);
+  mkdir(outdir, 0755);
+  snprintf(outdir, sizeof(outdir), "%s%s", sdroot, PATCHDB_PATH);
+  mkdir(outdir, 0755);
+  struct stat st;
+  if (stat(outdir, &st) || !S_ISDIR(st.st_mode)) {
+    printf("Cannot create directory %s\n", outdir);
+    exit(1);
+  }
+
+  t_jobs jobs = {
+    .outdir = outdir,
+    .overwrite = overwrite,
+  };
+  pthread_mutex_init(&jobs.lock, NULL);
+  scan_dir(&jobs, romdir);
+
+  pthread_t *th = malloc(nthreads * sizeof(pthread_t));
+  for (unsigned i = 0; i < nthreads; i++)
+    pthread_create(&th[i], NULL, worker, &jobs);
+  for (unsigned i = 0; i < nthreads; i++)
+    pthread_join(th[i], NULL);
+
+  printf("%u ROMs: %u generated, %u skipped, %u failed\n",
+         jobs.count, jobs.generated, jobs.skipped, jobs.failed);
+
+  return jobs.failed ? 1 : 0;
+}
+
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2024 David Guillen Fandos <david@davidgf.net>
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Converts a (v1) patch database into the compact v2 format.
+// Header, programs page and index keep their layout (index offsets become
+// byte offsets). Each entry becomes a byte stream with all its ops sorted by
+// address and delta coded using varints. Word data (op 0x4) is moved to a
+// pool that is shared by all the entries. See src/patcher.c for the format.
+
+#define PATCHDB_SIG          0x31424450
+#define PATCHDB_V1           0x00010000
+#define PATCHDB_V2           0x00020000
+#define HDR_BLKOFF           64          // blkoff field in the header
+
+#define MAX_PATCH_OPS        128
+
+typedef struct {
+  uint32_t addr;
+  unsigned sec, idx;         // Section and original position (stable sort)
+  const uint32_t *op;
+} t_op;
+
+static uint32_t rd32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void wr32(uint8_t *p, uint32_t v) {
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static unsigned op_words(uint32_t op) {
+  uint32_t opc = op >> 28;
+  uint32_t arg = (op >> 25) & 7;
+  if (opc == 0x3)
+    return 1 + (arg + 1 + 3) / 4;
+  if (opc == 0x4)
+    return 1 + arg + 1;
+  return 1;
+}
+
+static unsigned put_varint(uint8_t *p, uint32_t v) {
+  unsigned n = 0;
+  while (v >= 0x80) {
+    p[n++] = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+static int opcmp(const void *a, const void *b) {
+  const t_op *o1 = a, *o2 = b;
+  if (o1->addr != o2->addr)
+    return o1->addr < o2->addr ? -1 : 1;
+  return (int)o1->idx - (int)o2->idx;
+}
+
+// Shared word pool, blocks are reused if they appear anywhere in it.
+#define POOL_WORDS    (64*1024)
+static uint32_t pool[POOL_WORDS];
+static unsigned poolcnt;
+
+// Returns the block word offset (or ~0U if the pool is full).
+static uint32_t pool_add(const uint32_t *w, unsigned cnt) {
+  for (unsigned i = 0; i + cnt <= poolcnt; i++)
+    if (!memcmp(&pool[i], w, cnt * sizeof(uint32_t)))
+      return i;
+  if (poolcnt + cnt > POOL_WORDS) {
+    fprintf(stderr, "Block pool is full (%u words)\n", POOL_WORDS);
+    return ~0U;
+  }
+  memcpy(&pool[poolcnt], w, cnt * sizeof(uint32_t));
+  poolcnt += cnt;
+  return poolcnt - cnt;
+}
+
+// Encodes a v1 entry, returns its size (or zero on error).
+static unsigned encode_entry(const uint32_t *e, unsigned maxwords, uint8_t *out) {
+  const uint32_t ph = e[0];
+  const unsigned cnt[4] = { ph & 0xFF, (ph >> 8) & 0x1F, (ph >> 16) & 0xFF, (ph >> 24) & 0x0F };
+  const unsigned numops = cnt[0] + cnt[1] + cnt[2] + cnt[3];
+  const bool hole = (ph >> 28) & 1;
+  if (numops > MAX_PATCH_OPS || 1 + numops + hole > maxwords)
+    return 0;
+
+  // Collect the ops (and their sections) and sort them by address.
+  t_op ops[MAX_PATCH_OPS];
+  unsigned nops = 0, w = 0;
+  for (unsigned s = 0; s < 4; s++) {
+    for (unsigned end = w + cnt[s]; w < end; w += op_words(e[1 + w])) {
+      if (w + op_words(e[1 + w]) > end)
+        return 0;
+      ops[nops] = (t_op){ e[1 + w] & 0x1FFFFFF, s, nops, &e[1 + w] };
+      nops++;
+    }
+  }
+  qsort(ops, nops, sizeof(t_op), opcmp);
+
+  unsigned n = 0;
+  out[n++] = ((ph >> 13) & 0x7) | (hole ? 0x8 : 0);
+  for (unsigned s = 0; s < 4; s++)
+    n += put_varint(&out[n], cnt[s]);
+
+  uint32_t prev = 0;
+  for (unsigned i = 0; i < nops; i++) {
+    const uint32_t op = ops[i].op[0];
+    const unsigned opc = op >> 28, arg = (op >> 25) & 7;
+    out[n++] = op >> 25;
+    n += put_varint(&out[n], ((ops[i].addr - prev) << 2) | ops[i].sec);
+    prev = ops[i].addr;
+
+    if (opc == 0x3) {
+      for (unsigned j = 0; j < arg + 1; j++)
+        out[n++] = ops[i].op[1 + j / 4] >> ((j % 4) * 8);
+    }
+    else if (opc == 0x4) {
+      uint32_t woff = pool_add(&ops[i].op[1], arg + 1);
+      if (woff == ~0U)
+        return 0;
+      n += put_varint(&out[n], woff);
+    }
+  }
+
+  if (hole) {
+    n += put_varint(&out[n], e[1 + numops] >> 16);
+    n += put_varint(&out[n], e[1 + numops] & 0xFFFF);
+  }
+  return n;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s patches.db output.db\n", argv[0]);
+    return 1;
+  }
+
+  FILE *fd = fopen(argv[1], "rb");
+  if (!fd) {
+    fprintf(stderr, "Could not open %s\n", argv[1]);
+    return 1;
+  }
+  fseek(fd, 0, SEEK_END);
+  long fs = ftell(fd);
+  fseek(fd, 0, SEEK_SET);
+  uint8_t *db = malloc(fs + 1);
+  if (fread(db, 1, fs, fd) != fs) {
+    fprintf(stderr, "Could not read %s\n", argv[1]);
+    return 1;
+  }
+  fclose(fd);
+
+  if (fs < 1024 || rd32(&db[0]) != PATCHDB_SIG || rd32(&db[4]) != PATCHDB_V1) {
+    fprintf(stderr, "%s is not a v1 patch database\n", argv[1]);
+    return 1;
+  }
+
+  const uint32_t patchcnt = rd32(&db[8]), idxcnt = rd32(&db[12]);
+  const unsigned base = 1024 + 512 * idxcnt;
+  if (base > fs || patchcnt > idxcnt * 64) {
+    fprintf(stderr, "Invalid index in %s\n", argv[1]);
+    return 1;
+  }
+  const unsigned totwords = (fs - base) / 4;
+
+  // Header, programs and index are copied, entries are appended after that.
+  uint8_t *out = calloc(fs * 2 + 1024, 1);     // Entries can grow (5 bytes per word)
+  uint32_t *newoff = malloc(totwords * sizeof(uint32_t));
+  memset(newoff, 0xFF, totwords * sizeof(uint32_t));
+  memcpy(out, db, base);
+  unsigned outsize = base, entcnt = 0;
+
+  for (unsigned i = 0; i < patchcnt; i++) {
+    uint8_t *idx = &out[1024 + i * 8];
+    uint32_t offset = rd32(&idx[4]);
+    uint32_t woff = offset >> 8;
+    if (woff >= totwords) {
+      fprintf(stderr, "Invalid entry offset (game %u)\n", i);
+      return 1;
+    }
+
+    // Entries shared by several games are encoded once.
+    if (newoff[woff] == ~0U) {
+      uint32_t ent[MAX_PATCH_OPS + 2];
+      unsigned maxwords = totwords - woff < MAX_PATCH_OPS + 2 ? totwords - woff : MAX_PATCH_OPS + 2;
+      for (unsigned j = 0; j < maxwords; j++)
+        ent[j] = rd32(&db[base + (woff + j) * 4]);
+
+      unsigned size = encode_entry(ent, maxwords, &out[outsize]);
+      if (!size) {
+        fprintf(stderr, "Invalid entry (game %u)\n", i);
+        return 1;
+      }
+      newoff[woff] = outsize - base;
+      outsize += size;
+      entcnt++;
+    }
+    wr32(&idx[4], (newoff[woff] << 8) | (offset & 0xFF));
+  }
+
+  // Word aligned pool at the end.
+  outsize = (outsize + 3) & ~3U;
+  out = realloc(out, outsize + poolcnt * 4);
+  wr32(&out[4], PATCHDB_V2);
+  wr32(&out[HDR_BLKOFF], outsize);
+  for (unsigned i = 0; i < poolcnt; i++, outsize += 4)
+    wr32(&out[outsize], pool[i]);
+
+  fd = fopen(argv[2], "wb");
+  if (!fd || fwrite(out, 1, outsize, fd) != outsize) {
+    fprintf(stderr, "Could not write %s\n", argv[2]);
+    return 1;
+  }
+  fclose(fd);
+
+  printf("%u games, %u entries, %u pool words: %ld -> %u bytes\n",
+         patchcnt, entcnt, poolcnt, fs, outsize);
+  return 0;
+}